@@ -4,6 +4,16 @@ console.log('[Debug] OpenSSL Worker file executing...')
 // import type { WorkerMessage } from './types' // REMOVED to avoid Module syntax
 
 // Inline Types to keep this a "Script" (not a Module)
+// groups + sigalgs (':' separated) select the group × sigalg matrix; quic
+// runs it as QUIC handshakes.
+type TLSBenchmarkRequest = {
+  iterations: number
+  flags?: number
+  groups?: string
+  sigalgs?: string
+  quic?: boolean
+}
+
 type WorkerMessage =
   | {
       type: 'COMMAND'
@@ -22,6 +32,11 @@ type WorkerMessage =
       files?: { name: string; data: Uint8Array }[]
       commands?: string[]
       hsmMode?: boolean
+      streamTrace?: boolean
+      hsmReset?: boolean
+      benchmark?: TLSBenchmarkRequest
+      resumption?: 'psk_dhe_ke' | 'psk_ke'
+      load?: { connections: number }
       requestId?: string
     }
   | { type: 'READY'; requestId?: string }
@@ -57,6 +72,17 @@ interface EmscriptenModule {
   _malloc: (size: number) => number
   _free: (ptr: number) => void
   HEAPU8: Uint8Array
+  onTlsTraceBatch?: (events: string) => void
+  // Raw exports of newer simulator builds, probed before cwrap-ing them
+  _tls_simulation_result_len?: () => number
+  _tls_simulation_set_event_sink?: (fd: number, retain: number, batchBytes: number) => void
+  _tls_simulation_hsm_reset?: () => void
+  _execute_tls_benchmark?: (...args: number[]) => number
+  _execute_tls_benchmark_matrix?: (...args: number[]) => number
+  _execute_tls_quic_matrix?: (...args: number[]) => number
+  _tls_simulation_set_resumption?: (...args: number[]) => void
+  _execute_tls_load?: (...args: number[]) => number
+  _tls_simulation_set_input?: (...args: number[]) => number
 }
 
 interface ModuleConfig {
@@ -202,14 +228,18 @@ var loadOpenSSLScript = async (
   }
 }
 
-var createOpenSSLInstance = async (requestId?: string): Promise<EmscriptenModule> => {
+// `requestId` may be a getter for instances that outlive a single request.
+var createOpenSSLInstance = async (
+  requestId?: string | (() => string | undefined)
+): Promise<EmscriptenModule> => {
   if (!moduleFactory) throw new Error('Module factory not loaded. Call loadOpenSSLScript first.')
+  const target = typeof requestId === 'function' ? requestId : () => requestId
   const moduleConfig: ModuleConfig = {
     noInitialRun: true,
     print: (text: string) =>
-      self.postMessage({ type: 'LOG', stream: 'stdout', message: text, requestId }),
+      self.postMessage({ type: 'LOG', stream: 'stdout', message: text, requestId: target() }),
     printErr: (text: string) =>
-      self.postMessage({ type: 'LOG', stream: 'stderr', message: text, requestId }),
+      self.postMessage({ type: 'LOG', stream: 'stderr', message: text, requestId: target() }),
     locateFile: (path: string) => (path.endsWith('.wasm') ? '/wasm/openssl.wasm' : path),
   }
   return await moduleFactory(moduleConfig)
@@ -593,12 +623,42 @@ var executeCommand = async (
   }
 }
 
+// The simulator instance is kept across TLS_SIMULATE requests so the SSL_CTX
+// cache in tls_simulation.c can serve repeated runs with the same settings.
+// Its output is routed to whichever request is currently running.
+var simulationModule: EmscriptenModule | null = null
+var simulationRequestId: string | undefined
+var simulationFiles: string[] = []
+
+var getSimulationInstance = async (requestId?: string): Promise<EmscriptenModule> => {
+  simulationRequestId = requestId
+  if (simulationModule) {
+    // Drop the previous run's inputs so stale credentials can't leak into this one
+    for (const name of simulationFiles) {
+      try {
+        simulationModule.FS.unlink('/' + name)
+      } catch (e) {}
+    }
+    simulationFiles = []
+    return simulationModule
+  }
+  const module = await createOpenSSLInstance(() => simulationRequestId)
+  configureEnvironment(module, requestId)
+  simulationModule = module
+  return module
+}
+
 var executeSimulation = async (
   clientConfig: string,
   serverConfig: string,
   files: { name: string; data: Uint8Array }[] = [],
   commands: string[] = [],
   hsmMode: boolean = false,
+  streamTrace: boolean = false,
+  hsmReset: boolean = false,
+  benchmark: TLSBenchmarkRequest | undefined = undefined,
+  resumption: 'psk_dhe_ke' | 'psk_ke' | undefined = undefined,
+  load: { connections: number } | undefined = undefined,
   requestId?: string
 ) => {
   self.postMessage({
@@ -611,28 +671,63 @@ var executeSimulation = async (
   try {
     // 1. Load and Instantiate
     await loadOpenSSLScript('/wasm/openssl.js', requestId)
-    const openSSLModule = await createOpenSSLInstance(requestId)
+    const openSSLModule = await getSimulationInstance(requestId)
 
     // 2. Prepare Environment (Files)
     injectEntropy(openSSLModule, requestId)
-    configureEnvironment(openSSLModule, requestId)
-    if (files.length > 0) {
-      writeInputFiles(openSSLModule, files, requestId)
+
+    // int tls_simulation_set_input(const char* path, const void* data, size_t len)
+    // Builds exporting it take configs, credentials and the script as
+    // in-memory inputs under the paths they would have in MEMFS, so nothing is
+    // written to or read back from the filesystem; older builds get files.
+    const setInputC =
+      typeof openSSLModule._tls_simulation_set_input === 'function'
+        ? openSSLModule.cwrap('tls_simulation_set_input', 'number', ['string', 'number', 'number'])
+        : null
+    const putInput = (path: string, data: Uint8Array) => {
+      if (!setInputC) {
+        openSSLModule.FS.writeFile(path, data)
+        return
+      }
+      const ptr = openSSLModule._malloc(data.length || 1)
+      openSSLModule.HEAPU8.set(data, ptr)
+      const rc = setInputC(path, ptr, data.length)
+      openSSLModule._free(ptr)
+      if (rc !== 0) throw new Error(`tls_simulation_set_input failed for ${path}`)
+    }
+
+    if (setInputC) {
+      // Inputs persist on the kept instance; start from none
+      openSSLModule.cwrap('tls_simulation_clear_inputs', null, [])()
+      for (const file of files) {
+        try {
+          putInput('/' + file.name, file.data)
+        } catch (e) {
+          self.postMessage({
+            type: 'LOG',
+            stream: 'stderr',
+            message: `Failed to load input file ${file.name}: ${e}`,
+            requestId,
+          })
+        }
+      }
+    } else if (files.length > 0) {
+      simulationFiles = [...writeInputFiles(openSSLModule, files, requestId)]
     }
 
-    // Write Config Files to FS
+    // Config Files
     const enc = new TextEncoder()
     const clientPath = '/ssl/client.cnf'
     const serverPath = '/ssl/server.cnf'
-    openSSLModule.FS.writeFile(clientPath, enc.encode(clientConfig))
-    openSSLModule.FS.writeFile(serverPath, enc.encode(serverConfig))
+    putInput(clientPath, enc.encode(clientConfig))
+    putInput(serverPath, enc.encode(serverConfig))
 
-    // Write Command Script
+    // Command Script
     let scriptPath = ''
     if (commands && commands.length > 0) {
       scriptPath = '/ssl/commands.txt'
       const scriptContent = commands.join('\n')
-      openSSLModule.FS.writeFile(scriptPath, enc.encode(scriptContent))
+      putInput(scriptPath, enc.encode(scriptContent))
     }
 
     // 3. Bind C Functions
@@ -656,12 +751,141 @@ var executeSimulation = async (
       })
     }
 
+    // void tls_simulation_hsm_reset(void)
+    // HSM keypairs and their minted certs persist across runs on the kept
+    // instance; a reset destroys them so the next HSM run generates fresh ones.
+    if (hsmReset && typeof openSSLModule._tls_simulation_hsm_reset === 'function') {
+      openSSLModule.cwrap('tls_simulation_hsm_reset', null, [])()
+      self.postMessage({
+        type: 'LOG',
+        stream: 'stdout',
+        message: '[Debug] tls_simulation_hsm_reset()',
+        requestId,
+      })
+    }
+
+    // const char* execute_tls_benchmark_matrix(const char* groups,
+    //   const char* sigalgs, int iterations, unsigned int flags)
+    // Every group × sigalg pair with generated server credentials; the
+    // configs are not used. execute_tls_quic_matrix takes the same arguments.
+    if (benchmark?.groups && benchmark.sigalgs) {
+      const fn = benchmark.quic ? 'execute_tls_quic_matrix' : 'execute_tls_benchmark_matrix'
+      const exported = benchmark.quic
+        ? openSSLModule._execute_tls_quic_matrix
+        : openSSLModule._execute_tls_benchmark_matrix
+      if (typeof exported !== 'function') {
+        throw new Error(`${fn} function not found in WASM module`)
+      }
+      const matrixC = openSSLModule.cwrap(fn, 'string', [
+        'string',
+        'string',
+        'number',
+        'number',
+      ])
+      const rows = matrixC(
+        benchmark.groups,
+        benchmark.sigalgs,
+        benchmark.iterations,
+        benchmark.flags ?? 0
+      )
+      self.postMessage({
+        type: 'LOG',
+        stream: 'stdout',
+        message: 'SIMULATION_RESULT:' + rows,
+        requestId,
+      })
+      return
+    }
+
+    // const char* execute_tls_benchmark(const char* client_conf_path,
+    //   const char* server_conf_path, int iterations, unsigned int flags)
+    // N untraced handshakes; the result is a small statistics document.
+    if (benchmark) {
+      if (typeof openSSLModule._execute_tls_benchmark !== 'function') {
+        throw new Error('execute_tls_benchmark function not found in WASM module')
+      }
+      const benchmarkC = openSSLModule.cwrap('execute_tls_benchmark', 'string', [
+        'string',
+        'string',
+        'number',
+        'number',
+      ])
+      const stats = benchmarkC(clientPath, serverPath, benchmark.iterations, benchmark.flags ?? 0)
+      self.postMessage({
+        type: 'LOG',
+        stream: 'stdout',
+        message: 'SIMULATION_RESULT:' + stats,
+        requestId,
+      })
+      return
+    }
+
+    // const char* execute_tls_load(const char* client_conf_path,
+    //   const char* server_conf_path, int connections)
+    // A burst of K simultaneous handshakes against one server context.
+    if (load) {
+      if (typeof openSSLModule._execute_tls_load !== 'function') {
+        throw new Error('execute_tls_load function not found in WASM module')
+      }
+      const loadC = openSSLModule.cwrap('execute_tls_load', 'string', [
+        'string',
+        'string',
+        'number',
+      ])
+      const stats = loadC(clientPath, serverPath, load.connections)
+      self.postMessage({
+        type: 'LOG',
+        stream: 'stdout',
+        message: 'SIMULATION_RESULT:' + stats,
+        requestId,
+      })
+      return
+    }
+
+    // void tls_simulation_set_resumption(int mode)
+    // 0 = off, 1 = psk_dhe_ke, 2 = psk_ke. Always set: the mode persists on the
+    // kept instance.
+    if (typeof openSSLModule._tls_simulation_set_resumption === 'function') {
+      const resumeMode = resumption === 'psk_ke' ? 2 : resumption === 'psk_dhe_ke' ? 1 : 0
+      openSSLModule.cwrap('tls_simulation_set_resumption', null, ['number'])(resumeMode)
+    } else if (resumption) {
+      self.postMessage({
+        type: 'LOG',
+        stream: 'stderr',
+        message: '[Debug] tls_simulation_set_resumption unavailable; running one handshake',
+        requestId,
+      })
+    }
+
+    // void tls_simulation_set_event_sink(int fd, int retain, size_t batch_bytes)
+    // Stream trace batches as the handshake runs; the final document still
+    // carries the full trace (retain=1) so SIMULATION_RESULT is unchanged.
+    if (typeof openSSLModule._tls_simulation_set_event_sink === 'function') {
+      const setEventSinkC = openSSLModule.cwrap('tls_simulation_set_event_sink', null, [
+        'number',
+        'number',
+        'number',
+      ])
+      openSSLModule.onTlsTraceBatch = streamTrace
+        ? (events: string) => self.postMessage({ type: 'TRACE_BATCH', events, requestId })
+        : undefined
+      setEventSinkC(streamTrace ? 0 : -1, 1, 0)
+    }
+
     // char* execute_tls_simulation(const char* client_conf_path, const char* server_conf_path, const char* script_path)
-    const simulateC = openSSLModule.cwrap('execute_tls_simulation', 'string', [
-      'string',
-      'string',
-      'string',
-    ])
+    // Builds exporting tls_simulation_result_len() get the result pointer back
+    // raw and the JSON is decoded straight from the WASM heap (no NUL scan, no
+    // intermediate copy); older builds keep cwrap's 'string' return type.
+    const zeroCopy = typeof openSSLModule._tls_simulation_result_len === 'function'
+    const simulateC = openSSLModule.cwrap(
+      'execute_tls_simulation',
+      zeroCopy ? 'number' : 'string',
+      ['string', 'string', 'string']
+    )
+    // size_t tls_simulation_result_len(void)
+    const resultLenC = zeroCopy
+      ? openSSLModule.cwrap('tls_simulation_result_len', 'number', [])
+      : null
 
     if (!simulateC) {
       throw new Error('execute_tls_simulation function not found in WASM module')
@@ -675,7 +899,10 @@ var executeSimulation = async (
       requestId,
     })
 
-    const resultJson = simulateC(clientPath, serverPath, scriptPath)
+    const result = simulateC(clientPath, serverPath, scriptPath)
+    const resultJson = resultLenC
+      ? new TextDecoder().decode(openSSLModule.HEAPU8.subarray(result, result + resultLenC()))
+      : result
 
     // 5. Return Result
     self.postMessage({
@@ -685,6 +912,8 @@ var executeSimulation = async (
       requestId,
     })
   } catch (error: any) {
+    // An aborted run can leave the instance unusable; start fresh next time
+    simulationModule = null
     self.postMessage({ type: 'ERROR', error: error.message || 'Simulation failed', requestId })
   } finally {
     self.postMessage({ type: 'DONE', requestId })
@@ -791,13 +1020,29 @@ self.addEventListener('message', async (event: MessageEvent<WorkerMessage>) => {
       }
       await executeCommand(command, args, files, requestId)
     } else if (type === 'TLS_SIMULATE') {
-      const { clientConfig, serverConfig, files, commands, hsmMode } = event.data as {
+      const {
+        clientConfig,
+        serverConfig,
+        files,
+        commands,
+        hsmMode,
+        streamTrace,
+        hsmReset,
+        benchmark,
+        resumption,
+        load,
+      } = event.data as {
         type: 'TLS_SIMULATE'
         clientConfig: string
         serverConfig: string
         files?: { name: string; data: Uint8Array }[]
         commands?: string[]
         hsmMode?: boolean
+        streamTrace?: boolean
+        hsmReset?: boolean
+        benchmark?: TLSBenchmarkRequest
+        resumption?: 'psk_dhe_ke' | 'psk_ke'
+        load?: { connections: number }
         requestId?: string
       }
       await executeSimulation(
@@ -806,6 +1051,11 @@ self.addEventListener('message', async (event: MessageEvent<WorkerMessage>) => {
         files,
         commands || [],
         Boolean(hsmMode),
+        Boolean(streamTrace),
+        Boolean(hsmReset),
+        benchmark,
+        resumption,
+        load,
         requestId
       )
     } else if (type === 'DELETE_FILE') {
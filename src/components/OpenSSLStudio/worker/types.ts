@@ -1,4 +1,14 @@
 // SPDX-License-Identifier: GPL-3.0-only
+/** TLS_SIMULATE benchmark mode; groups + sigalgs (':' separated) select the
+ * group × sigalg matrix, and quic runs it as QUIC handshakes. */
+export type TLSBenchmarkRequest = {
+  iterations: number
+  flags?: number
+  groups?: string
+  sigalgs?: string
+  quic?: boolean
+}
+
 export type WorkerMessage =
   | {
       type: 'COMMAND'
@@ -15,6 +25,15 @@ export type WorkerMessage =
       clientConfig: string
       serverConfig: string
       files?: { name: string; data: Uint8Array }[]
+      commands?: string[]
+      hsmMode?: boolean
+      streamTrace?: boolean
+      hsmReset?: boolean
+      benchmark?: TLSBenchmarkRequest
+      /** Resume the session on a second connection (EARLY_DATA: lines = 0-RTT). */
+      resumption?: 'psk_dhe_ke' | 'psk_ke'
+      /** Burst of simultaneous handshakes against one server context. */
+      load?: { connections: number }
       requestId?: string
     }
   | {
@@ -37,6 +56,7 @@ export type WorkerMessage =
 export type WorkerResponse =
   | { type: 'LOG'; stream: 'stdout' | 'stderr'; message: string; requestId?: string }
   | { type: 'FILE_CREATED'; name: string; data: Uint8Array; requestId?: string }
+  | { type: 'TRACE_BATCH'; events: string; requestId?: string }
   | { type: 'READY'; requestId?: string }
   | { type: 'ERROR'; error: string; requestId?: string }
   | { type: 'DONE'; requestId?: string }
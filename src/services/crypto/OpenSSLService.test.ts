@@ -462,6 +462,272 @@ describe('OpenSSLService Functionality', () => {
         expect.objectContaining({ type: 'TLS_SIMULATE', hsmMode: false })
       )
     })
+
+    it('forwards hsmReset to worker TLS_SIMULATE message', async () => {
+      const worker = (openSSLService as any).worker
+      const postMessageMock = vi.fn((data: any) => {
+        worker.onmessage({
+          data: {
+            type: 'LOG',
+            stream: 'stdout',
+            message: 'SIMULATION_RESULT:{"status":"success","trace":[]}',
+            requestId: data.requestId,
+          },
+        } as MessageEvent)
+        worker.onmessage({ data: { type: 'DONE', requestId: data.requestId } } as MessageEvent)
+      })
+      worker.postMessage = postMessageMock
+
+      await openSSLService.simulateTLS('client', 'server', [], [], {
+        hsmMode: true,
+        hsmReset: true,
+      })
+
+      expect(postMessageMock).toHaveBeenCalledWith(
+        expect.objectContaining({ type: 'TLS_SIMULATE', hsmMode: true, hsmReset: true })
+      )
+    })
+
+    it('forwards the resumption mode to worker TLS_SIMULATE message', async () => {
+      const worker = (openSSLService as any).worker
+      const postMessageMock = vi.fn((data: any) => {
+        worker.onmessage({
+          data: {
+            type: 'LOG',
+            stream: 'stdout',
+            message: 'SIMULATION_RESULT:{"status":"success","trace":[]}',
+            requestId: data.requestId,
+          },
+        } as MessageEvent)
+        worker.onmessage({ data: { type: 'DONE', requestId: data.requestId } } as MessageEvent)
+      })
+      worker.postMessage = postMessageMock
+
+      await openSSLService.simulateTLS('client', 'server', [], ['EARLY_DATA:GET /'], {
+        resumption: 'psk_ke',
+      })
+
+      expect(postMessageMock).toHaveBeenCalledWith(
+        expect.objectContaining({
+          type: 'TLS_SIMULATE',
+          commands: ['EARLY_DATA:GET /'],
+          resumption: 'psk_ke',
+        })
+      )
+    })
+
+    it('benchmarkTLS sends a benchmark request and parses the statistics', async () => {
+      const worker = (openSSLService as any).worker
+      const stats = {
+        status: 'success',
+        iterations: 50,
+        group: 'X25519MLKEM768',
+        latency_ms: { min: 1, median: 2, p99: 3, max: 4, mean: 2 },
+        handshakes_per_sec: 500,
+        bytes_per_handshake: { client: 1500, server: 2500 },
+      }
+      const postMessageMock = vi.fn((data: any) => {
+        worker.onmessage({
+          data: {
+            type: 'LOG',
+            stream: 'stdout',
+            message: 'SIMULATION_RESULT:' + JSON.stringify(stats),
+            requestId: data.requestId,
+          },
+        } as MessageEvent)
+        worker.onmessage({ data: { type: 'DONE', requestId: data.requestId } } as MessageEvent)
+      })
+      worker.postMessage = postMessageMock
+
+      const result = await openSSLService.benchmarkTLS('client', 'server', 50, { flags: 1 })
+
+      expect(postMessageMock).toHaveBeenCalledWith(
+        expect.objectContaining({
+          type: 'TLS_SIMULATE',
+          benchmark: { iterations: 50, flags: 1 },
+        })
+      )
+      expect(result).toEqual(stats)
+    })
+
+    it('loadTestTLS sends a load request and parses the statistics', async () => {
+      const worker = (openSSLService as any).worker
+      const stats = {
+        status: 'success',
+        connections: 100,
+        completed: 100,
+        latency_ms: { min: 70, median: 80, p99: 84, max: 84, mean: 80 },
+        makespan_ms: 84,
+        server_cpu_ms: { total: 32, per_connection: 0.32 },
+        peak_heap_bytes: 15000000,
+      }
+      const postMessageMock = vi.fn((data: any) => {
+        worker.onmessage({
+          data: {
+            type: 'LOG',
+            stream: 'stdout',
+            message: 'SIMULATION_RESULT:' + JSON.stringify(stats),
+            requestId: data.requestId,
+          },
+        } as MessageEvent)
+        worker.onmessage({ data: { type: 'DONE', requestId: data.requestId } } as MessageEvent)
+      })
+      worker.postMessage = postMessageMock
+
+      const result = await openSSLService.loadTestTLS('client', 'server', 100)
+
+      expect(postMessageMock).toHaveBeenCalledWith(
+        expect.objectContaining({ type: 'TLS_SIMULATE', load: { connections: 100 } })
+      )
+      expect(result).toEqual(stats)
+    })
+
+    it('benchmarkTLSMatrix joins the lists into a matrix benchmark request', async () => {
+      const worker = (openSSLService as any).worker
+      const matrix = {
+        status: 'success',
+        iterations: 20,
+        rows: [
+          {
+            group: 'X25519MLKEM768',
+            sigalg: 'mldsa65',
+            status: 'success',
+            negotiated_group: 'X25519MLKEM768',
+            signature_scheme: 'mldsa65',
+            hrr: true,
+            round_trips: 2,
+            server_flight: {
+              bytes: 17510,
+              segments: 12,
+              cwnd: 11,
+              over_initcwnd: true,
+              extra_rtts: 1,
+            },
+          },
+        ],
+      }
+      const postMessageMock = vi.fn((data: any) => {
+        worker.onmessage({
+          data: {
+            type: 'LOG',
+            stream: 'stdout',
+            message: 'SIMULATION_RESULT:' + JSON.stringify(matrix),
+            requestId: data.requestId,
+          },
+        } as MessageEvent)
+        worker.onmessage({ data: { type: 'DONE', requestId: data.requestId } } as MessageEvent)
+      })
+      worker.postMessage = postMessageMock
+
+      const result = await openSSLService.benchmarkTLSMatrix(
+        ['X25519', 'X25519MLKEM768'],
+        ['ecdsa_secp256r1_sha256', 'mldsa65'],
+        20,
+        { flags: 4 }
+      )
+
+      expect(postMessageMock).toHaveBeenCalledWith(
+        expect.objectContaining({
+          type: 'TLS_SIMULATE',
+          benchmark: {
+            iterations: 20,
+            flags: 4,
+            groups: 'X25519:X25519MLKEM768',
+            sigalgs: 'ecdsa_secp256r1_sha256:mldsa65',
+          },
+        })
+      )
+      expect(result).toEqual(matrix)
+    })
+
+    it('benchmarkQUICMatrix sends a QUIC matrix benchmark request', async () => {
+      const worker = (openSSLService as any).worker
+      const matrix = {
+        status: 'success',
+        transport: 'quic',
+        iterations: 5,
+        rows: [
+          {
+            group: 'X25519MLKEM768',
+            sigalg: 'mldsa87',
+            status: 'success',
+            hrr: false,
+            round_trips: 2,
+            quic: {
+              datagrams: { client: 4, server: 12 },
+              packets: {
+                client: { initial: 3, handshake: 2, one_rtt: 0 },
+                server: { initial: 2, handshake: 11, one_rtt: 0 },
+              },
+              initial_datagrams: 2,
+              amplification_stalls: 1,
+              extra_round_trips: 1,
+            },
+          },
+        ],
+      }
+      const postMessageMock = vi.fn((data: any) => {
+        worker.onmessage({
+          data: {
+            type: 'LOG',
+            stream: 'stdout',
+            message: 'SIMULATION_RESULT:' + JSON.stringify(matrix),
+            requestId: data.requestId,
+          },
+        } as MessageEvent)
+        worker.onmessage({ data: { type: 'DONE', requestId: data.requestId } } as MessageEvent)
+      })
+      worker.postMessage = postMessageMock
+
+      const result = await openSSLService.benchmarkQUICMatrix(['X25519MLKEM768'], ['mldsa87'], 5)
+
+      expect(postMessageMock).toHaveBeenCalledWith(
+        expect.objectContaining({
+          type: 'TLS_SIMULATE',
+          benchmark: {
+            iterations: 5,
+            flags: 0,
+            groups: 'X25519MLKEM768',
+            sigalgs: 'mldsa87',
+            quic: true,
+          },
+        })
+      )
+      expect(result).toEqual(matrix)
+    })
+
+    it('streams TRACE_BATCH events to onTraceBatch before the result', async () => {
+      const worker = (openSSLService as any).worker
+      const postMessageMock = vi.fn((data: any) => {
+        worker.onmessage({
+          data: {
+            type: 'TRACE_BATCH',
+            events: '[{"side":"client","event":"handshake_start","details":"TLS handshake initiated"}]',
+            requestId: data.requestId,
+          },
+        } as MessageEvent)
+        worker.onmessage({
+          data: {
+            type: 'LOG',
+            stream: 'stdout',
+            message: 'SIMULATION_RESULT:{"status":"success","trace":[]}',
+            requestId: data.requestId,
+          },
+        } as MessageEvent)
+        worker.onmessage({ data: { type: 'DONE', requestId: data.requestId } } as MessageEvent)
+      })
+      worker.postMessage = postMessageMock
+      const onTraceBatch = vi.fn()
+
+      await openSSLService.simulateTLS('client', 'server', [], [], { onTraceBatch })
+
+      expect(postMessageMock).toHaveBeenCalledWith(
+        expect.objectContaining({ type: 'TLS_SIMULATE', streamTrace: true })
+      )
+      expect(onTraceBatch).toHaveBeenCalledWith([
+        { side: 'client', event: 'handshake_start', details: 'TLS handshake initiated' },
+      ])
+    })
   })
 
   describe('executeSkey()', () => {
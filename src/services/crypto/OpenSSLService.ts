@@ -1,5 +1,9 @@
 // SPDX-License-Identifier: GPL-3.0-only
-import type { WorkerMessage, WorkerResponse } from '../../components/OpenSSLStudio/worker/types'
+import type {
+  TLSBenchmarkRequest,
+  WorkerMessage,
+  WorkerResponse,
+} from '../../components/OpenSSLStudio/worker/types'
 
 export interface OpenSSLCommandResult {
   stdout: string
@@ -8,6 +12,98 @@ export interface OpenSSLCommandResult {
   error?: string
 }
 
+/** One TLS simulator trace event, as streamed in TRACE_BATCH messages. */
+export interface TLSTraceEvent {
+  side: string
+  event: string
+  /** Microseconds since the run started (monotonic clock). */
+  t_us?: number
+  details: string
+}
+
+/** Statistics document returned by execute_tls_benchmark. */
+export interface TLSBenchmarkResult {
+  status: 'success' | 'failed'
+  iterations?: number
+  group?: string
+  cipher?: string
+  latency_ms?: { min: number; median: number; p99: number; max: number; mean: number }
+  handshakes_per_sec?: number
+  bytes_per_handshake?: { client: number; server: number }
+  error?: string
+  ssl_error?: string
+  completed?: number
+}
+
+/** One group × sigalg pair of execute_tls_benchmark_matrix. */
+export interface TLSBenchmarkMatrixRow
+  extends Omit<TLSBenchmarkResult, 'iterations' | 'completed'> {
+  sigalg: string
+  negotiated_group?: string
+  signature_scheme?: string
+  hrr?: boolean
+  round_trips?: number
+  /** The server's certificate flight against the initial congestion window;
+   * extra_rtts come on top of round_trips. */
+  server_flight?: {
+    bytes: number
+    segments: number
+    cwnd: number
+    over_initcwnd: boolean
+    extra_rtts: number
+  }
+}
+
+/** Document returned by execute_tls_benchmark_matrix. */
+export interface TLSBenchmarkMatrixResult {
+  status: 'success' | 'failed'
+  iterations?: number
+  rows?: TLSBenchmarkMatrixRow[]
+  error?: string
+}
+
+/** One group × sigalg pair of execute_tls_quic_matrix: the matrix row plus
+ * the QUIC wire figures of the last handshake. */
+export interface TLSQuicMatrixRow extends TLSBenchmarkMatrixRow {
+  quic?: {
+    datagrams: { client: number; server: number }
+    packets: {
+      client: { initial: number; handshake: number; one_rtt: number }
+      server: { initial: number; handshake: number; one_rtt: number }
+    }
+    /** Datagrams the client's first flight (ClientHello) took. */
+    initial_datagrams: number
+    /** Server flights cut short by the 3× anti-amplification limit. */
+    amplification_stalls: number
+    extra_round_trips: number
+  }
+}
+
+/** Document returned by execute_tls_quic_matrix. */
+export interface TLSQuicMatrixResult extends Omit<TLSBenchmarkMatrixResult, 'rows'> {
+  transport?: 'quic'
+  rows?: TLSQuicMatrixRow[]
+}
+
+/** Document returned by execute_tls_load. latency_ms is each handshake's
+ * completion time measured from the start of the burst. */
+export interface TLSLoadResult
+  extends Omit<TLSBenchmarkResult, 'iterations' | 'bytes_per_handshake'> {
+  connections?: number
+  makespan_ms?: number
+  server_cpu_ms?: { total: number; per_connection: number }
+  /** null on native builds whose C library lacks mallinfo. */
+  peak_heap_bytes?: number | null
+  heap_bytes_per_connection?: number | null
+  bytes_per_connection?: { client: number; server: number }
+}
+
+/** execute_tls_benchmark flags (TLS_SIM_BENCH_* in tls_simulation.h). */
+export const TLS_BENCH_WARMUP = 0x1
+export const TLS_BENCH_NEW_CTX = 0x2
+/** Matrix only: the client sends an X25519 key share, so other groups HRR. */
+export const TLS_BENCH_MATRIX_HRR = 0x4
+
 class OpenSSLService {
   private worker: Worker | null = null
   private pendingRequests: Map<
@@ -16,6 +112,7 @@ class OpenSSLService {
       resolve: (value: OpenSSLCommandResult) => void
       reject: (reason?: unknown) => void
       result: OpenSSLCommandResult
+      onTraceBatch?: (events: TLSTraceEvent[]) => void
     }
   > = new Map()
   private isReady: boolean = false
@@ -130,6 +227,15 @@ class OpenSSLService {
           request.result.stderr += event.data.message + '\n'
         }
         break
+      case 'TRACE_BATCH':
+        if (request.onTraceBatch) {
+          try {
+            request.onTraceBatch(JSON.parse(event.data.events) as TLSTraceEvent[])
+          } catch (error) {
+            console.warn('[OpenSSLService] Dropped malformed trace batch:', error)
+          }
+        }
+        break
       case 'FILE_CREATED':
         request.result.files.push({
           name: event.data.name,
@@ -266,7 +372,21 @@ class OpenSSLService {
     serverConfig: string,
     files: { name: string; data: Uint8Array }[] = [],
     commands: string[] = [],
-    options: { hsmMode?: boolean } = {}
+    options: {
+      hsmMode?: boolean
+      /** Destroy the cached HSM keypairs first, forcing a fresh keygen. */
+      hsmReset?: boolean
+      /** Run untraced handshakes and resolve with the statistics JSON instead. */
+      benchmark?: TLSBenchmarkRequest
+      /**
+       * Resume the first connection's session on a second one and add a
+       * resumption_summary event; EARLY_DATA:<text> commands are sent as 0-RTT.
+       */
+      resumption?: 'psk_dhe_ke' | 'psk_ke'
+      /** Run a connection burst and resolve with the load statistics JSON instead. */
+      load?: { connections: number }
+      onTraceBatch?: (events: TLSTraceEvent[]) => void
+    } = {}
   ): Promise<string> {
     try {
       await this.init()
@@ -308,6 +428,7 @@ class OpenSSLService {
           reject(error)
         },
         result: { stdout: '', stderr: '', error: '', files: [] },
+        onTraceBatch: options.onTraceBatch,
       })
 
       this.worker!.postMessage({
@@ -317,12 +438,93 @@ class OpenSSLService {
         files,
         commands,
         hsmMode: options.hsmMode === true,
+        hsmReset: options.hsmReset === true,
+        benchmark: options.benchmark,
+        resumption: options.resumption,
+        load: options.load,
+        streamTrace: Boolean(options.onTraceBatch),
         requestId,
         // eslint-disable-next-line @typescript-eslint/no-explicit-any
       } as any)
     })
   }
 
+  /** Run `iterations` back-to-back handshakes with tracing off. */
+  public async benchmarkTLS(
+    clientConfig: string,
+    serverConfig: string,
+    iterations: number,
+    options: {
+      files?: { name: string; data: Uint8Array }[]
+      hsmMode?: boolean
+      flags?: number
+    } = {}
+  ): Promise<TLSBenchmarkResult> {
+    const json = await this.simulateTLS(clientConfig, serverConfig, options.files ?? [], [], {
+      hsmMode: options.hsmMode,
+      benchmark: { iterations, flags: options.flags ?? 0 },
+    })
+    return JSON.parse(json) as TLSBenchmarkResult
+  }
+
+  /** Connect `connections` clients at once to one server context. */
+  public async loadTestTLS(
+    clientConfig: string,
+    serverConfig: string,
+    connections: number,
+    options: { files?: { name: string; data: Uint8Array }[]; hsmMode?: boolean } = {}
+  ): Promise<TLSLoadResult> {
+    const json = await this.simulateTLS(clientConfig, serverConfig, options.files ?? [], [], {
+      hsmMode: options.hsmMode,
+      load: { connections },
+    })
+    return JSON.parse(json) as TLSLoadResult
+  }
+
+  /**
+   * Benchmark every key exchange group × server signature scheme pair with
+   * tracing off; one row per pair, sigalg-major.
+   */
+  public async benchmarkTLSMatrix(
+    groups: string[],
+    sigalgs: string[],
+    iterations: number,
+    options: { flags?: number } = {}
+  ): Promise<TLSBenchmarkMatrixResult> {
+    const json = await this.simulateTLS('', '', [], [], {
+      benchmark: {
+        iterations,
+        flags: options.flags ?? 0,
+        groups: groups.join(':'),
+        sigalgs: sigalgs.join(':'),
+      },
+    })
+    return JSON.parse(json) as TLSBenchmarkMatrixResult
+  }
+
+  /**
+   * The same matrix as QUIC handshakes (needs a QUIC-capable OpenSSL 3.5+
+   * build); rows add datagram/packet counts, amplification stalls and extra
+   * round trips.
+   */
+  public async benchmarkQUICMatrix(
+    groups: string[],
+    sigalgs: string[],
+    iterations: number,
+    options: { flags?: number } = {}
+  ): Promise<TLSQuicMatrixResult> {
+    const json = await this.simulateTLS('', '', [], [], {
+      benchmark: {
+        iterations,
+        flags: options.flags ?? 0,
+        groups: groups.join(':'),
+        sigalgs: sigalgs.join(':'),
+        quic: true,
+      },
+    })
+    return JSON.parse(json) as TLSQuicMatrixResult
+  }
+
   public async executeSkey(
     opType: 'create' | 'derive',
     params: Record<string, unknown>
@@ -0,0 +1,320 @@
+/*
+ * tls_sim_bench.c — multi-threaded native handshake load generator.
+ *
+ * Runs the simulator's untraced benchmark on one worker thread per core,
+ * each with its own tls_sim_ctx (log arena, latency buffer), and sweeps the
+ * worker count 1, 2, 4, ... up to -t to show how far handshake throughput
+ * scales:
+ *
+ *   tls_sim_bench [-d DIR] [-t THREADS] [-n ITERS] [-B FLAGS] client.cnf
+ *                 server.cnf
+ *
+ * Per step it reports handshakes/sec, speedup and parallel efficiency over
+ * one worker, the merged latency percentiles and histogram, and the workers'
+ * CPU time per handshake and CPU utilisation. Scaling stops at the first step
+ * whose efficiency drops below 80%, and the CPU figures say why:
+ *   - utilisation well below 1: workers sleep on locks (OpenSSL's provider
+ *     and property-query stores, SSL_CTX locks, the simulator's context
+ *     cache);
+ *   - utilisation near 1 but more CPU per handshake: contended atomics and
+ *     cache lines (refcounts on the shared SSL_CTX, keys and certs) or the
+ *     allocator;
+ *   - more workers than online CPUs: oversubscribed.
+ * -B 8 (TLS_SIM_BENCH_OWN_CTX) gives every worker private contexts, which
+ * separates SSL_CTX sharing from library-wide contention.
+ *
+ * The JSON document goes to stdout; the exit status is 0 when every step
+ * reports "success".
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tls_simulation.h"
+
+#define BENCH_MAX_THREADS 256
+#define HIST_BUCKETS 16    // 1/16 ms doubling up to 1 s, then overflow
+#define HIST_FIRST_LE 0.0625
+#define EFFICIENCY_KNEE 0.8
+
+typedef struct {
+  tls_sim_ctx *sim;
+  pthread_barrier_t *start;
+  const char *client_conf;
+  const char *server_conf;
+  int iterations;
+  unsigned int flags;
+  const char *result; // owned by sim
+  double cpu_ms;
+} worker;
+
+typedef struct {
+  int threads;
+  int handshakes;
+  double wall_ms;
+  double rate;
+  double cpu_ms;
+  char distribution[1024]; // "latency_ms":{...},"histogram_ms":[...]
+} step_stats;
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options] client.cnf server.cnf\n"
+          "  -d DIR    credential directory (default /ssl)\n"
+          "  -t COUNT  largest worker count (default: online CPUs)\n"
+          "  -n ITERS  handshakes per worker per step (default 200)\n"
+          "  -B FLAGS  benchmark flags (8 = private contexts per worker)\n",
+          argv0);
+}
+
+static double clock_ms(clockid_t id) {
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int succeeded(const char *result) {
+  return strstr(result, "\"status\":\"success\"") != NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void *worker_main(void *arg) {
+  worker *w = arg;
+  // Untimed warm-up: fills the context cache and the provider's lazily
+  // initialised algorithm tables before the clock starts.
+  w->result = tls_sim_ctx_benchmark(w->sim, w->client_conf, w->server_conf, 1,
+                                    w->flags);
+  pthread_barrier_wait(w->start);
+  if (!succeeded(w->result))
+    return NULL;
+  double cpu0 = clock_ms(CLOCK_THREAD_CPUTIME_ID);
+  w->result = tls_sim_ctx_benchmark(w->sim, w->client_conf, w->server_conf,
+                                    w->iterations, w->flags);
+  w->cpu_ms = clock_ms(CLOCK_THREAD_CPUTIME_ID) - cpu0;
+  return NULL;
+}
+
+// Latency percentiles and a log2 histogram of the merged, sorted samples.
+static void format_distribution(char *out, size_t len, const double *lat,
+                                int n) {
+  double sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += lat[i];
+  int p99 = (99 * n + 99) / 100 - 1; // nearest rank
+  size_t off = (size_t)snprintf(
+      out, len,
+      "\"latency_ms\":{\"min\":%.4f,\"median\":%.4f,\"p99\":%.4f,"
+      "\"max\":%.4f,\"mean\":%.4f},\"histogram_ms\":[",
+      lat[0], lat[n / 2], lat[p99], lat[n - 1], sum / n);
+
+  int count[HIST_BUCKETS] = {0};
+  for (int i = 0, b = 0; i < n; i++) {
+    while (b < HIST_BUCKETS - 1 && lat[i] > HIST_FIRST_LE * (1 << b))
+      b++;
+    count[b]++;
+  }
+  int first = 0, last = HIST_BUCKETS - 1;
+  while (count[first] == 0)
+    first++;
+  while (count[last] == 0)
+    last--;
+  for (int b = first; b <= last && off < len; b++) {
+    const char *sep = b > first ? "," : "";
+    if (b == HIST_BUCKETS - 1)
+      off += (size_t)snprintf(out + off, len - off,
+                              "%s{\"le\":null,\"count\":%d}", sep, count[b]);
+    else
+      off += (size_t)snprintf(out + off, len - off,
+                              "%s{\"le\":%g,\"count\":%d}", sep,
+                              HIST_FIRST_LE * (1 << b), count[b]);
+  }
+  if (off < len)
+    snprintf(out + off, len - off, "]");
+}
+
+// One step: `threads` workers released together. Returns -1, after printing
+// a failure document, if any of them failed.
+static int run_step(int threads, const char *client_conf,
+                    const char *server_conf, int iterations,
+                    unsigned int flags, step_stats *st) {
+  worker w[BENCH_MAX_THREADS];
+  pthread_t tid[BENCH_MAX_THREADS];
+  pthread_barrier_t start;
+  int started = 0, rc = -1;
+
+  memset(w, 0, sizeof(w[0]) * (size_t)threads);
+  pthread_barrier_init(&start, NULL, (unsigned)threads + 1);
+  for (; started < threads; started++) {
+    w[started] = (worker){tls_sim_ctx_new(), &start, client_conf,
+                          server_conf, iterations, flags, NULL, 0};
+    if (!w[started].sim ||
+        pthread_create(&tid[started], NULL, worker_main, &w[started]) != 0) {
+      tls_sim_ctx_free(w[started].sim);
+      break;
+    }
+  }
+  if (started < threads) {
+    // The barrier can't open for the workers already waiting on it.
+    printf("{\"status\":\"failed\",\"threads\":%d,"
+           "\"error\":\"could not start workers\"}\n",
+           threads);
+    exit(1);
+  }
+  pthread_barrier_wait(&start);
+  double t0 = clock_ms(CLOCK_MONOTONIC);
+  for (int i = 0; i < threads; i++)
+    pthread_join(tid[i], NULL);
+  double wall = clock_ms(CLOCK_MONOTONIC) - t0;
+  pthread_barrier_destroy(&start);
+
+  int total = 0;
+  for (int i = 0; i < threads; i++) {
+    if (!succeeded(w[i].result)) {
+      printf("{\"status\":\"failed\",\"threads\":%d,\"worker\":%d,"
+             "\"result\":%s}\n",
+             threads, i, w[i].result);
+      goto out;
+    }
+    int n;
+    tls_sim_ctx_latencies(w[i].sim, &n);
+    total += n;
+  }
+
+  double *lat = malloc((size_t)total * sizeof(double));
+  if (!lat) {
+    printf("{\"status\":\"failed\",\"threads\":%d,"
+           "\"error\":\"out of memory\"}\n",
+           threads);
+    goto out;
+  }
+  *st = (step_stats){threads, 0, wall, 0, 0};
+  for (int i = 0; i < threads; i++) {
+    int n;
+    const double *l = tls_sim_ctx_latencies(w[i].sim, &n);
+    memcpy(lat + st->handshakes, l, (size_t)n * sizeof(double));
+    st->handshakes += n;
+    st->cpu_ms += w[i].cpu_ms;
+  }
+  st->rate = wall > 0 ? st->handshakes * 1000.0 / wall : 0;
+  qsort(lat, (size_t)total, sizeof(double), cmp_double);
+  format_distribution(st->distribution, sizeof(st->distribution), lat, total);
+  free(lat);
+  rc = 0;
+
+out:
+  for (int i = 0; i < threads; i++)
+    tls_sim_ctx_free(w[i].sim);
+  return rc;
+}
+
+// Why the step `s` scaled worse than the single-worker step `base`.
+static const char *scaling_cause(const step_stats *s, const step_stats *base,
+                                 long cpus) {
+  double util = s->cpu_ms / (s->wall_ms * s->threads);
+  double cpu_growth = (s->cpu_ms / s->handshakes) /
+                      (base->cpu_ms / base->handshakes);
+  if (s->threads > cpus)
+    return "oversubscribed: more workers than online CPUs";
+  if (util < 0.85)
+    return "workers blocked off-CPU: lock contention (provider or "
+           "property-query store, SSL_CTX locks, context cache)";
+  if (cpu_growth > 1.2)
+    return "more CPU per handshake: contended atomics or cache lines on "
+           "shared objects, or the allocator";
+  return "throughput limited outside the workers (SMT siblings, frequency "
+         "scaling, memory bandwidth)";
+}
+
+int main(int argc, char **argv) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_threads = cpus > 0 ? (int)cpus : 1;
+  int iterations = 200;
+  unsigned int flags = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:t:n:B:h")) != -1) {
+    switch (opt) {
+    case 'd':
+      if (tls_simulation_set_cred_dir(optarg) != 0) {
+        fprintf(stderr, "credential directory path too long: %s\n", optarg);
+        return 2;
+      }
+      break;
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    case 'B':
+      flags = (unsigned int)strtoul(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 2;
+    }
+  }
+  if (argc - optind != 2 || max_threads < 1 ||
+      max_threads > BENCH_MAX_THREADS || iterations < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+  const char *client_conf = argv[optind];
+  const char *server_conf = argv[optind + 1];
+  // NEW_CTX would time context builds, WARMUP is done per worker already.
+  flags &= ~(unsigned int)(TLS_SIM_BENCH_NEW_CTX | TLS_SIM_BENCH_WARMUP);
+
+  step_stats steps[16];
+  int nsteps = 0;
+  for (int t = 1;; t = t * 2 < max_threads ? t * 2 : max_threads) {
+    if (run_step(t, client_conf, server_conf, iterations, flags,
+                 &steps[nsteps]) != 0)
+      return 1;
+    nsteps++;
+    if (t == max_threads)
+      break;
+  }
+
+  printf("{\"status\":\"success\",\"cpus\":%ld,\"iterations_per_worker\":%d,"
+         "\"steps\":[",
+         cpus, iterations);
+  for (int i = 0; i < nsteps; i++) {
+    const step_stats *s = &steps[i];
+    double speedup = s->rate / steps[0].rate;
+    printf("%s{\"threads\":%d,\"handshakes\":%d,\"wall_ms\":%.3f,"
+           "\"handshakes_per_sec\":%.1f,\"speedup\":%.2f,"
+           "\"efficiency\":%.2f,\"cpu_ms_per_handshake\":%.4f,"
+           "\"cpu_utilization\":%.2f,%s}",
+           i ? "," : "", s->threads, s->handshakes, s->wall_ms, s->rate,
+           speedup, speedup / s->threads, s->cpu_ms / s->handshakes,
+           s->cpu_ms / (s->wall_ms * s->threads), s->distribution);
+  }
+
+  // The knee: the last step before efficiency first fell below the mark.
+  int knee = nsteps;
+  for (int i = 1; i < nsteps; i++) {
+    if (steps[i].rate / steps[0].rate / steps[i].threads < EFFICIENCY_KNEE) {
+      knee = i;
+      break;
+    }
+  }
+  if (knee == nsteps) {
+    printf("],\"scaling_limit\":{\"threads\":%d,\"cause\":\"none: efficiency "
+           "stayed above %.0f%%\"}}\n",
+           steps[nsteps - 1].threads, EFFICIENCY_KNEE * 100);
+  } else {
+    printf("],\"scaling_limit\":{\"threads\":%d,\"first_below\":%d,"
+           "\"cause\":\"%s\"}}\n",
+           steps[knee - 1].threads, steps[knee].threads,
+           scaling_cause(&steps[knee], &steps[0], cpus));
+  }
+  return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * tls_sim_cli.c — native driver for the TLS 1.3 simulator.
+ *
+ * Runs the same code the browser runs (tls_simulation.c) against system
+ * OpenSSL, so it can be profiled with perf/valgrind and compared with the
+ * WASM numbers:
+ *
+ *   tls_sim_cli [options] client.cnf server.cnf [commands.txt]
+ *   tls_sim_cli -b ITERS -G groups -S sigalgs
+ *
+ * The JSON document goes to stdout; the exit status is 0 when the run (or
+ * benchmark) reports "success".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tls_simulation.h"
+
+// execute_tls_ktls() is declared for native Linux builds only.
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define CLI_KTLS 1
+#endif
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [options] client.cnf server.cnf [commands.txt]\n"
+          "       %s -b ITERS [-B FLAGS] [-Q] -G GROUPS -S SIGALGS\n"
+          "  -d DIR    credential directory (default /ssl): client.crt,\n"
+          "            client.key, client-ca.crt, server.crt, server.key,\n"
+          "            server-ca.crt\n"
+          "  -m MASK   event mask (default 0x%04X)\n"
+          "  -w MODE   wire capture: none, head or full (default head)\n"
+          "  -l BYTES  cap the trace document at BYTES\n"
+          "  -s        stream event batches to stderr as they are produced\n"
+          "  -n COUNT  run COUNT times, print the last document\n"
+          "  -T MODE   transport between the sides: mem, socketpair or tcp\n"
+          "            (default mem)\n"
+          "  -F SPEC   flight accounting (record events): MSS[:INITCWND],\n"
+          "            segment bytes and initial window (default 1460:10)\n"
+          "  -M        load configs, script and credential files into memory\n"
+          "            first (tls_simulation_set_input), off the timed path\n"
+          "  -r MODE   resume the session on a second connection: psk_dhe_ke\n"
+          "            or psk_ke (EARLY_DATA: script lines go out as 0-RTT)\n"
+          "  -b ITERS  benchmark ITERS untraced handshakes instead\n"
+          "  -k CONNS  load mode: CONNS simultaneous handshakes on one\n"
+          "            server context\n"
+#ifdef CLI_KTLS
+          "  -K BYTES  kTLS mode: stream BYTES (k/m suffix) over loopback TCP\n"
+          "            with kernel TLS offload, and again without\n"
+#endif
+          "  -B FLAGS  benchmark flags (1 = warm-up, 2 = new contexts,\n"
+          "            4 = matrix client offers an X25519 key share,\n"
+          "            8 = contexts built for the run, bypassing the cache)\n"
+          "  -G LIST   matrix mode: key exchange groups, e.g.\n"
+          "            X25519:X25519MLKEM768\n"
+          "  -S LIST   matrix mode: signature schemes, e.g.\n"
+          "            ecdsa_secp256r1_sha256:mldsa65\n"
+          "  -Q        matrix mode over QUIC (OpenSSL 3.5+)\n",
+          argv0, argv0, TLS_SIM_EV_ALL);
+}
+
+#ifdef CLI_KTLS
+// "16m", "64k" or a plain byte count; 0 when malformed.
+static size_t parse_bytes(const char *s) {
+  char *end;
+  unsigned long long n = strtoull(s, &end, 0);
+  if (*end == 'k' || *end == 'K')
+    n <<= 10, end++;
+  else if (*end == 'm' || *end == 'M')
+    n <<= 20, end++;
+  return *end ? 0 : (size_t)n;
+}
+#endif
+
+// Register `path` as an in-memory input; missing files are left to the run.
+static int preload(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return 0;
+  char *data = NULL;
+  size_t len = 0, cap = 0, n;
+  do {
+    if (len == cap) {
+      char *grown = realloc(data, cap = cap ? cap * 2 : 8192);
+      if (!grown) {
+        free(data);
+        fclose(f);
+        return -1;
+      }
+      data = grown;
+    }
+    n = fread(data + len, 1, cap - len, f);
+    len += n;
+  } while (n > 0);
+  fclose(f);
+  int rc = tls_simulation_set_input(path, data, len);
+  free(data);
+  return rc;
+}
+
+static int preload_inputs(const char *cred_dir, char **paths, int n) {
+  static const char *const names[] = {"client.crt", "client.key",
+                                      "client-ca.crt", "server.crt",
+                                      "server.key", "server-ca.crt"};
+  char path[1024];
+  // The same paths tls_simulation_set_cred_dir() builds.
+  size_t len = strlen(cred_dir);
+  while (len > 1 && cred_dir[len - 1] == '/')
+    len--;
+  for (int i = 0; i < 6; i++) {
+    snprintf(path, sizeof(path), "%.*s/%s", (int)len, cred_dir, names[i]);
+    if (preload(path) != 0)
+      return -1;
+  }
+  for (int i = 0; i < n; i++)
+    if (preload(paths[i]) != 0)
+      return -1;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int repeat = 1, bench = 0, load = 0, in_memory = 0, quic = 0;
+#ifdef CLI_KTLS
+  size_t ktls_bytes = 0;
+#endif
+  const char *cred_dir = "/ssl";
+  unsigned int bench_flags = 0;
+  const char *groups = NULL, *sigalgs = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:m:w:l:sn:T:F:Mr:b:k:K:B:G:S:Qh")) != -1) {
+    switch (opt) {
+    case 'd':
+      if (tls_simulation_set_cred_dir(optarg) != 0) {
+        fprintf(stderr, "credential directory path too long: %s\n", optarg);
+        return 2;
+      }
+      cred_dir = optarg;
+      break;
+    case 'm':
+      tls_simulation_set_event_mask((unsigned int)strtoul(optarg, NULL, 0));
+      break;
+    case 'w':
+      if (strcmp(optarg, "none") == 0)
+        tls_simulation_set_wire_capture(WIRE_CAPTURE_NONE, 0);
+      else if (strcmp(optarg, "full") == 0)
+        tls_simulation_set_wire_capture(WIRE_CAPTURE_FULL, 0);
+      else
+        tls_simulation_set_wire_capture(WIRE_CAPTURE_HEAD, 0);
+      break;
+    case 'l':
+      tls_simulation_set_log_limit((size_t)strtoull(optarg, NULL, 0));
+      break;
+    case 's':
+      tls_simulation_set_event_sink(STDERR_FILENO, 1, 0);
+      break;
+    case 'n':
+      repeat = atoi(optarg);
+      break;
+    case 'T': {
+      int kind = strcmp(optarg, "mem") == 0 ? TLS_SIM_TRANSPORT_MEM
+                 : strcmp(optarg, "socketpair") == 0
+                     ? TLS_SIM_TRANSPORT_SOCKETPAIR
+                 : strcmp(optarg, "tcp") == 0 ? TLS_SIM_TRANSPORT_TCP
+                                              : -1;
+      if (tls_simulation_set_transport(kind) != 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    }
+    case 'F': {
+      char *end;
+      unsigned long mss = strtoul(optarg, &end, 0), initcwnd = 0;
+      if (*end == ':')
+        initcwnd = strtoul(end + 1, &end, 0);
+      if (*end || mss == 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      tls_simulation_set_flight_params((unsigned int)mss,
+                                       (unsigned int)initcwnd);
+      break;
+    }
+    case 'M':
+      in_memory = 1;
+      break;
+    case 'r':
+      if (strcmp(optarg, "psk_ke") == 0)
+        tls_simulation_set_resumption(TLS_SIM_RESUME_PSK);
+      else if (strcmp(optarg, "psk_dhe_ke") == 0)
+        tls_simulation_set_resumption(TLS_SIM_RESUME_PSK_DHE);
+      else {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+    case 'b':
+      bench = atoi(optarg);
+      break;
+    case 'k':
+      load = atoi(optarg);
+      break;
+    case 'K':
+#ifdef CLI_KTLS
+      if ((ktls_bytes = parse_bytes(optarg)) == 0) {
+        usage(argv[0]);
+        return 2;
+      }
+      break;
+#else
+      fprintf(stderr, "kTLS mode (-K) is only available on Linux\n");
+      return 2;
+#endif
+    case 'B':
+      bench_flags = (unsigned int)strtoul(optarg, NULL, 0);
+      break;
+    case 'G':
+      groups = optarg;
+      break;
+    case 'S':
+      sigalgs = optarg;
+      break;
+    case 'Q':
+      quic = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 2;
+    }
+  }
+  if (groups || sigalgs) {
+    if (!groups || !sigalgs || bench <= 0 || optind != argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    const char *result =
+        quic ? execute_tls_quic_matrix(groups, sigalgs, bench, bench_flags)
+             : execute_tls_benchmark_matrix(groups, sigalgs, bench, bench_flags);
+    fputs(result, stdout);
+    fputc('\n', stdout);
+    return strstr(result, "\"status\":\"success\"") ? 0 : 1;
+  }
+  if (argc - optind < 2 || argc - optind > 3 || repeat < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  const char *client_conf = argv[optind];
+  const char *server_conf = argv[optind + 1];
+  const char *script = argc - optind == 3 ? argv[optind + 2] : NULL;
+  if (in_memory &&
+      preload_inputs(cred_dir, argv + optind, argc - optind) != 0) {
+    fprintf(stderr, "could not load the inputs into memory\n");
+    return 1;
+  }
+
+  const char *result;
+#ifdef CLI_KTLS
+  if (ktls_bytes > 0) {
+    result = execute_tls_ktls(client_conf, server_conf, ktls_bytes);
+  } else
+#endif
+  if (load > 0) {
+    result = execute_tls_load(client_conf, server_conf, load);
+  } else if (bench > 0) {
+    result = execute_tls_benchmark(client_conf, server_conf, bench, bench_flags);
+  } else {
+    result = NULL;
+    for (int i = 0; i < repeat; i++)
+      result = execute_tls_simulation(client_conf, server_conf, script);
+  }
+
+  fputs(result, stdout);
+  fputc('\n', stdout);
+  return strstr(result, "\"status\":\"success\"") ? 0 : 1;
+}
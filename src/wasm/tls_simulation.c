@@ -6,38 +6,394 @@
 #include <openssl/ssl.h>
 #include <openssl/trace.h> // For OSSL_trace calls
 #include <openssl/x509.h>  // For X509_get_signature_nid
+#include <stdint.h>
 #include <stdio.h>
+#include <pthread.h> // SSL_CTX cache lock, one-time init
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <strings.h> // For strcasecmp
+#include <sys/uio.h> // For writev (native event sink)
+#include <time.h>    // For clock_gettime (timestamps, benchmark timing)
 #include <unistd.h>
 
+#include "tls_simulation.h"
+
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #else
 #define EMSCRIPTEN_KEEPALIVE
 #endif
 
-/* HSM mode hooks — defined in tls_simulation_hsm.c. When enabled, the server
- * private key is generated inside the WASM-linked softhsmv3 token and the
- * CertificateVerify sign operation routes through pkcs11-provider during the
- * handshake. Returns 0 on no-op / success; non-zero on error. */
-extern int hsm_mode_enabled(void);
-extern int hsm_setup_server_credentials(SSL_CTX *s_ctx);
-
-// Helper to append to valid JSON buffer
-// Real implementation would use dynamic buffer resizing
-#define LOG_BUFFER_SIZE                                                        \
-  (10 * 1024 * 1024) // 10MB buffer for PQC keys (McEliece etc)
-char log_buffer[LOG_BUFFER_SIZE];
-int log_offset = 0;
-static const char *current_side = "system"; // Global context for callbacks
-
-// Ex data index to store SSL side identifier
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h> // JSON escape fast path (-msimd128)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30500000L && !defined(OPENSSL_NO_QUIC)
+#define TLS_SIM_QUIC 1 // QUIC handshake matrix
+#include <netinet/in.h> // For the client's initial peer address
+#include <openssl/quic.h>
+#endif
+
+#if defined(__GLIBC__) || defined(__EMSCRIPTEN__)
+#define TLS_SIM_HEAP_STATS 1 // mallinfo() for the load mode's peak heap
+#include <malloc.h>
+#endif
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define TLS_SIM_SOCKETS 1 // socket transports and kTLS mode
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h> // For blocking SIGPIPE during kTLS transfers
+#include <sys/socket.h>
+#endif
+
+/* HSM mode hook — defined in tls_simulation_hsm.c. Called when the run's
+ * context has HSM mode on: the server private key is generated inside the
+ * WASM-linked softhsmv3 token and the CertificateVerify sign operation routes
+ * through pkcs11-provider during the handshake. Returns 0 on success;
+ * non-zero on error. */
+extern int hsm_setup_server_credentials(tls_sim_ctx *sim, SSL_CTX *s_ctx);
+
+/* ── Event log arena ───────────────────────────────────────────────────────
+ * The JSON trace is built in a chunked arena. The first chunk is small and
+ * further (geometrically larger) chunks are only allocated when a run needs
+ * them, so a classical handshake never grows the heap past LOG_CHUNK_MIN while
+ * a McEliece-sized trace can still grow as far as memory allows. close_log()
+ * coalesces the chunks into one contiguous NUL-terminated document for JS.
+ *
+ * An optional hard cap (tls_simulation_set_log_limit) bounds the total size.
+ * Events that do not fit are counted and reported in the footer as
+ * "truncated":true,"dropped_events":N rather than vanishing silently. */
+#define LOG_CHUNK_MIN (64 * 1024)
+#define LOG_CHUNK_MAX (4 * 1024 * 1024)
+#define LOG_FOOTER_RESERVE 256
+
+typedef struct log_chunk {
+  struct log_chunk *next;
+  size_t cap; // usable bytes in data[] (excludes the NUL slot)
+  size_t len;
+  char data[];
+} log_chunk;
+
+typedef struct {
+  log_chunk *head;
+  log_chunk *tail;
+  size_t total;          // bytes written across all chunks
+  size_t limit;          // hard cap in bytes, 0 = unbounded
+  unsigned long events;  // events written to the trace array
+  unsigned long dropped; // events rejected by the cap (or OOM)
+  char *result;          // coalesced document, valid until the next reset_log
+  size_t result_len;
+  double t0;             // now_ms() at reset_log; zero of every event's "t_us"
+} event_log;
+
+/* ── Streaming event sink ──────────────────────────────────────────────────
+ * When enabled, events are flushed to the host in batches as they are
+ * produced instead of only appearing in the document close_log() returns.
+ * Each batch is a JSON array of event objects. Under Emscripten it is passed
+ * as a string to Module.onTlsTraceBatch(batch); in a native build it is
+ * written to a file descriptor as one line per batch.
+ *
+ * With `retain` set the events also stay in the final document (the UI can
+ * render early and still parse the complete trace at the end). Without it
+ * the arena is rewound after every flush, so memory stays bounded on long
+ * scripted sessions and the final document only carries the status footer
+ * plus "streamed_events":N. */
+#define SINK_BATCH_DEFAULT (16 * 1024)
+
+typedef struct {
+  int enabled;
+  int fd;
+  int retain;
+  size_t batch_bytes;
+  log_chunk *mark;        // chunk holding the first unflushed byte
+  size_t mark_off;        // offset of that byte within `mark`
+  size_t mark_total;      // log.total at the mark
+  unsigned long streamed; // events handed to the sink this run
+  unsigned long pending;  // events written since the mark
+} event_sink;
+
+/* ── Simulation context ────────────────────────────────────────────────────
+ * Everything a simulation run reads or writes lives in a tls_sim_ctx, so
+ * several runs can proceed at once in one module or process (one context
+ * per thread). The SSL objects of a run carry their context in ex_data,
+ * which is how the msg/info/keylog callbacks find it; OpenSSL's trace
+ * callback gets it as its user data. The exported tls_simulation_* functions
+ * act on a default context, keeping the single-instance API unchanged.
+ *
+ * Shared by all contexts: the SSL_CTX cache, the ex_data indices, the HSM
+ * token and OpenSSL's trace channels. The trace channels are process-wide:
+ * a run that enables a TRACE_* category holds them until it ends, other
+ * such runs wait for it, and only lines from the owning thread are kept. */
+#define REC_MAX_HS 8
+
+typedef struct {
+  unsigned char hdr[5];
+  size_t hdr_len;
+  size_t body_left;
+  size_t offset; // capture offset of the current record's header
+  // Handshake message framing inside plaintext handshake records
+  unsigned char hs_hdr[4];
+  size_t hs_hdr_len;
+  size_t hs_body_left;
+  size_t hs_body_seen;
+  unsigned char hs_type;
+  unsigned char hs_random[32]; // ServerHello.random, to spot HRR
+  unsigned char hs_types[REC_MAX_HS];
+  int hs_count;
+  int hrr;
+  // Per-direction totals for the record_summary event
+  unsigned long records;
+  unsigned long record_bytes;
+} record_parser;
+
+#define PHASE_MAX 24
+
+typedef struct {
+  const char *state; // static string owned by OpenSSL
+  double ms;
+} phase_slot;
+
+typedef struct {
+  phase_slot slot[PHASE_MAX];
+  int n;
+  double mark;
+  double total;
+} phase_timer;
+
+#define CRED_PATH_MAX 512
+
+typedef struct {
+  char client_crt[CRED_PATH_MAX];
+  char client_key[CRED_PATH_MAX];
+  char client_ca[CRED_PATH_MAX];
+  char server_crt[CRED_PATH_MAX];
+  char server_key[CRED_PATH_MAX];
+  char server_ca[CRED_PATH_MAX];
+} cred_paths;
+
+// Handshake flights of the current run (see "Flight accounting").
+typedef struct {
+  size_t bytes;
+  unsigned long records;
+  size_t segments;
+  size_t cwnd;
+  int extra_rtts;
+} flight_stat;
+
+typedef struct {
+  unsigned int mss;      // setting: bytes per TCP segment
+  unsigned int initcwnd; // setting: initial congestion window, segments
+  struct {
+    int count;
+    int flights[2]; // [0] client, [1] server
+    size_t bytes[2];
+    size_t segments[2];
+    size_t cwnd[2]; // sender's window for its next flight
+    int over;       // flights beyond the sender's window
+    int extra_rtts;
+    flight_stat server_flight; // the largest: the certificate's
+  } run;
+} flight_log;
+
+#define INPUT_MAX 16
+
+// Buffer standing in for the file at `path` (tls_simulation_set_input).
+typedef struct {
+  char path[CRED_PATH_MAX];
+  char *data; // NUL-terminated copy
+  size_t len;
+} sim_input;
+
+#define EARLY_DATA_MAX 16384
+
+// EARLY_DATA: payloads of the script, NUL-separated.
+typedef struct {
+  char data[EARLY_DATA_MAX];
+  size_t len;
+  int count;
+} early_lines;
+
+struct tls_sim_ctx {
+  // Trace document
+  event_log log;
+  event_sink sink;
+  unsigned int event_mask;
+  const char *current_side; // side whose OpenSSL call is running
+  int trace_held;           // owns OpenSSL's trace channels (g_trace_lock)
+  pthread_t trace_thread;   // the thread that took them
+  // Settings
+  int wire_capture;
+  size_t wire_head_bytes;
+  int resume_mode;
+  int transport; // TLS_SIM_TRANSPORT_*
+  int hsm_mode;
+  cred_paths cred;
+  sim_input inputs[INPUT_MAX];
+  int input_count;
+  // Handshake state of the current run
+  int client_hello_count; // HRR detection: ClientHellos sent by the client
+  int hrr_detected;
+  record_parser rec[2]; // [0] client->server, [1] server->client
+  unsigned char *capture;
+  size_t capture_len;
+  size_t capture_cap;
+  phase_timer phase[2]; // [0] client, [1] server
+  flight_log flight;
+  early_lines early;
+  // Config-phase events recorded for the SSL_CTX cache
+  char *setup_rec;
+  size_t setup_rec_len;
+  size_t setup_rec_cap;
+  int setup_recording;
+  int setup_rec_failed;
+  // Benchmark documents
+  char bench_result[768];
+  double *bench_lat; // sorted latencies of the last successful benchmark
+  int bench_lat_n;
+  char *matrix_result;
+  size_t matrix_len;
+  size_t matrix_cap;
+  int matrix_oom;
+};
+
+static tls_sim_ctx *default_sim(void);
+
+#ifdef __EMSCRIPTEN__
+// Slices of one batch are gathered on the JS side; `last` hands it over.
+EM_JS(void, sink_emit_js, (const char *ptr, size_t len, int last), {
+  Module.tlsSinkBatch = (Module.tlsSinkBatch || '') + UTF8ToString(ptr, len);
+  if (!last)
+    return;
+  var batch = Module.tlsSinkBatch;
+  Module.tlsSinkBatch = '';
+  if (typeof Module.onTlsTraceBatch === 'function')
+    Module.onTlsTraceBatch('[' + batch + ']');
+});
+#else
+#define SINK_IOV_MAX 64
+#endif
+
+// Hand the comma-separated events written since the mark to the host as one
+// batch, however many arena chunks they span: a single onTlsTraceBatch()
+// call, or a single "[...]" line on the native fd. Events never straddle
+// chunks, so every slice holds whole events.
+static void sink_emit(tls_sim_ctx *sim) {
+#ifndef __EMSCRIPTEN__
+  if (sim->sink.fd < 0)
+    return;
+  struct iovec iov[SINK_IOV_MAX];
+  int n_iov = 0;
+  iov[n_iov++] = (struct iovec){(void *)"[", 1};
+#endif
+  size_t total = 0;
+  for (log_chunk *c = sim->sink.mark; c; c = c->next) {
+    size_t off = c == sim->sink.mark ? sim->sink.mark_off : 0;
+    const char *p = c->data + off;
+    size_t n = c->len - off;
+    if (total == 0 && n && *p == ',') { // the batch's first event
+      p++;
+      n--;
+    }
+    if (!n)
+      continue;
+    total += n;
+#ifdef __EMSCRIPTEN__
+    sink_emit_js(p, n, 0);
+#else
+    if (n_iov == SINK_IOV_MAX - 1) { // still one line: no separators added
+      ssize_t w = writev(sim->sink.fd, iov, n_iov);
+      (void)w;
+      n_iov = 0;
+    }
+    iov[n_iov++] = (struct iovec){(void *)p, n};
+#endif
+  }
+  if (!total)
+    return;
+#ifdef __EMSCRIPTEN__
+  sink_emit_js("", 0, 1);
+#else
+  iov[n_iov++] = (struct iovec){(void *)"]\n", 2};
+  ssize_t w = writev(sim->sink.fd, iov, n_iov);
+  (void)w;
+#endif
+}
+
+// Monotonic milliseconds (sub-ms resolution) for event timestamps and timing.
+static double now_ms(void) {
+#ifdef __EMSCRIPTEN__
+  return emscripten_get_now();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+}
+
+// CPU time of the calling thread in ms; wall time where there is no such
+// clock (Emscripten runs the simulator on a single worker thread anyway).
+static double cpu_now_ms(void) {
+#ifdef __EMSCRIPTEN__
+  return emscripten_get_now();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
+}
+
+/* ── Event categories ──────────────────────────────────────────────────────
+ * Bitmask selecting which verbose event types are produced. Disabled OpenSSL
+ * trace categories are not registered at all, and disabled callback events
+ * return before any formatting, so quiet benchmark runs pay nothing for them.
+ * Lifecycle, config, error and summary events are always emitted.
+ *
+ * TLS_SIM_COMPILED_EVENTS compiles categories out entirely, e.g.
+ * -DTLS_SIM_COMPILED_EVENTS=0x000F keeps the callback events but drops all
+ * OSSL_trace plumbing from the build. The bits are in tls_simulation.h. */
+#ifndef TLS_SIM_COMPILED_EVENTS
+#define TLS_SIM_COMPILED_EVENTS TLS_SIM_EV_ALL
+#endif
+
+// Constant-folds to 0 for categories compiled out of the build.
+#define EV_ON(sim, bit) \
+  ((TLS_SIM_COMPILED_EVENTS & (bit)) && ((sim)->event_mask & (bit)))
+
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_set_event_mask(unsigned int mask) {
+  tls_sim_ctx *sim = default_sim();
+  sim->event_mask = mask & TLS_SIM_EV_ALL;
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned int tls_simulation_get_event_mask(void) {
+  tls_sim_ctx *sim = default_sim();
+  return sim->event_mask & TLS_SIM_COMPILED_EVENTS;
+}
+
+// Ex data indices to store the SSL side identifier and its simulation context
 static int ssl_side_ex_data_idx = -1;
+static int ssl_sim_ex_data_idx = -1;
 
-// HRR detection: count ClientHello messages per simulation
-static int client_hello_count = 0;
-static int hrr_detected = 0;
+static pthread_once_t ex_data_once = PTHREAD_ONCE_INIT;
+
+static void ex_data_init(void) {
+  ssl_side_ex_data_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+  ssl_sim_ex_data_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+}
+
+// Context of the run an SSL object belongs to, for the OpenSSL callbacks.
+static tls_sim_ctx *sim_of(const SSL *ssl) {
+  return ssl_sim_ex_data_idx >= 0 ? SSL_get_ex_data(ssl, ssl_sim_ex_data_idx)
+                                  : NULL;
+}
 
 // Helper to translate X509 verification errors to clear educational messages
 const char *get_cert_verify_explanation(int verify_err) {
@@ -88,826 +444,4520 @@ const char *get_cert_verify_explanation(int verify_err) {
     return NULL; // Return NULL for unknown errors to use default message
   }
 }
-void reset_log() {
-  log_offset = 0;
-  strcpy(log_buffer, "{\"trace\":[");
-  log_offset = 10;
+static log_chunk *log_chunk_new(size_t cap) {
+  log_chunk *c = (log_chunk *)malloc(sizeof(log_chunk) + cap + 1);
+  if (!c)
+    return NULL;
+  c->next = NULL;
+  c->cap = cap;
+  c->len = 0;
+  c->data[0] = 0;
+  return c;
 }
 
-void log_event(const char *side, const char *event, const char *details) {
-  // 1. Check if we have enough space for this entry + the eventual footer
-  // Buffer can hold up to 16KB of escaped details + JSON overhead (~200 bytes)
-  // Footer needs ~128 bytes. Total entry max = ~17KB
-  size_t footer_reserve = 512;
-  size_t max_entry_size = 17000;
-  if (log_offset + max_entry_size >= LOG_BUFFER_SIZE - footer_reserve) {
-    // Buffer full, silently drop event to preserve footer space
-    return;
-  }
+// Release everything but the head chunk, which is kept for the next run.
+static void log_release(tls_sim_ctx *sim) {
+  if (sim->log.result &&
+      (!sim->log.head || sim->log.result != sim->log.head->data))
+    free(sim->log.result);
+  sim->log.result = NULL;
+  sim->log.result_len = 0;
 
-  // 2. Add comma if not first item
-  if (log_offset > 10) {
-    log_buffer[log_offset++] = ',';
-    log_buffer[log_offset] = 0;
-  }
-
-  // 3. Escape special characters (16KB buffer for PQC keys/traces)
-  char safe_details[16384];
-  if (details) {
-    const char *src = details;
-    char *dst = safe_details;
-    int len = 0;
-    while (*src && len < 16370) {
-      unsigned char c = (unsigned char)*src;
-      // Escape JSON control chars
-      if (c == '"' || c == '\\') {
-        *dst++ = '\\';
-        *dst++ = c;
-        len += 2;
-      } else if (c == '\n') {
-        *dst++ = '\\';
-        *dst++ = 'n';
-        len += 2;
-      } else if (c == '\r') {
-        *dst++ = '\\';
-        *dst++ = 'r';
-        len += 2;
-      } else if (c == '\t') {
-        *dst++ = '\\';
-        *dst++ = 't';
-        len += 2;
-      } else if (c < 32 || c > 126) {
-        *dst++ = '?';
-        len++; // Replace non-printables
-      } else {
-        *dst++ = c;
-        len++;
-      }
-      src++;
-    }
-    *dst = 0;
-  } else {
-    safe_details[0] = 0;
+  log_chunk *c = sim->log.head ? sim->log.head->next : NULL;
+  while (c) {
+    log_chunk *next = c->next;
+    free(c);
+    c = next;
   }
+  if (sim->log.head) {
+    sim->log.head->next = NULL;
+    sim->log.head->len = 0;
+  }
+  sim->log.tail = sim->log.head;
+  sim->log.total = 0;
+}
 
-  // 4. Write directly to buffer at offset (O(1))
-  int written = snprintf(
-      log_buffer + log_offset, LOG_BUFFER_SIZE - log_offset - footer_reserve,
-      "{\"side\":\"%s\",\"event\":\"%s\",\"details\":\"%s\"}", side, event,
-      safe_details);
+// Return space for `n` bytes plus a NUL terminator, growing the arena when
+// the tail chunk is full. The caller must follow up with log_commit().
+static char *log_reserve(tls_sim_ctx *sim, size_t n) {
+  log_chunk *t = sim->log.tail;
+  if (t && t->cap - t->len >= n)
+    return t->data + t->len;
 
-  if (written > 0) {
-    log_offset += written;
-  }
+  size_t cap = t ? t->cap * 2 : LOG_CHUNK_MIN;
+  if (cap > LOG_CHUNK_MAX)
+    cap = LOG_CHUNK_MAX;
+  if (cap < n)
+    cap = n;
+
+  log_chunk *c = log_chunk_new(cap);
+  if (!c)
+    return NULL;
+  if (t)
+    t->next = c;
+  else
+    sim->log.head = c;
+  sim->log.tail = c;
+  return c->data;
 }
 
-void close_log(const char *status, const char *error) {
-  // 5. Append Footer - We guaranteed space in log_event
-  // But strictly ensure we don't overflow
-  size_t remaining = LOG_BUFFER_SIZE - log_offset;
+static void log_commit(tls_sim_ctx *sim, size_t n) {
+  sim->log.tail->len += n;
+  sim->log.tail->data[sim->log.tail->len] = 0;
+  sim->log.total += n;
+}
 
-  // Basic footer
-  snprintf(log_buffer + log_offset, remaining,
-           "],\"status\":\"%s\",\"error\":\"%s\"}", status, error ? error : "");
+// Append a raw string to the document, bypassing the cap (used for the
+// header and footer, whose space is always reserved).
+static int log_append_raw(tls_sim_ctx *sim, const char *s, size_t n) {
+  char *p = log_reserve(sim, n);
+  if (!p)
+    return -1;
+  memcpy(p, s, n);
+  log_commit(sim, n);
+  return 0;
 }
 
-// Helper: Inspect CA file and log its key type
-void log_ca_details(const char *side, const char *caFile) {
-  BIO *b = BIO_new_file(caFile, "r");
-  if (!b)
-    return;
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_set_log_limit(size_t max_bytes) {
+  default_sim()->log.limit = max_bytes;
+}
 
-  X509 *cert = PEM_read_bio_X509(b, NULL, NULL, NULL);
-  if (cert) {
-    EVP_PKEY *pkey = X509_get_pubkey(cert);
-    if (pkey) {
-      // EVP_PKEY_get0_type_name() works for all OpenSSL 3.x key types
-      // including PQC (ML-DSA, SLH-DSA). EVP_PKEY_base_id()/OBJ_nid2sn()
-      // returns NID_undef for provider-based keys.
-      const char *name = EVP_PKEY_get0_type_name(pkey);
-      char details[256];
-      snprintf(details, sizeof(details), "CA Key Type: %s",
-               (name && name[0]) ? name : "Unknown");
-      log_event(side, "config_ca_details", details);
+static void sink_set_mark(tls_sim_ctx *sim) {
+  sim->sink.mark = sim->log.tail;
+  sim->sink.mark_off = sim->log.tail ? sim->log.tail->len : 0;
+  sim->sink.mark_total = sim->log.total;
+  sim->sink.pending = 0;
+}
 
-      EVP_PKEY_free(pkey);
-    }
-    X509_free(cert);
-  }
-  BIO_free(b);
+void reset_log(tls_sim_ctx *sim) {
+  log_release(sim);
+  sim->log.events = 0;
+  sim->log.dropped = 0;
+  sim->log.t0 = now_ms();
+  log_append_raw(sim, "{\"trace\":[", 10);
+  sim->sink.streamed = 0;
+  sink_set_mark(sim);
 }
 
-// CONFIGURATION PARSER
-void apply_config(SSL_CTX *ctx, const char *path, const char *side) {
-  if (!path || access(path, F_OK) != 0)
+// Flush everything written since the mark. Without `retain`, rewind the
+// arena to just the document header so the memory is reused.
+static void sink_flush(tls_sim_ctx *sim) {
+  if (!sim->sink.enabled || !sim->sink.pending)
     return;
+  sink_emit(sim);
+  sim->sink.streamed += sim->sink.pending;
 
-  CONF *conf = NCONF_new(NULL);
-  if (!NCONF_load(conf, path, NULL)) {
-    char err[128];
-    snprintf(err, sizeof(err), "Failed to load config: %s", path);
-    log_event(side, "warning", err);
-    NCONF_free(conf);
-    return;
+  if (!sim->sink.retain) {
+    log_chunk *head = sim->log.head;
+    log_chunk *c = head->next;
+    while (c) {
+      log_chunk *next = c->next;
+      free(c);
+      c = next;
+    }
+    head->next = NULL;
+    head->len = 10; // keep "{\"trace\":["
+    head->data[head->len] = 0;
+    sim->log.tail = head;
+    sim->log.total = head->len;
+    sim->log.events = 0;
   }
+  sink_set_mark(sim);
+}
 
-  log_event(side, "config", "Loaded configuration file");
+/* Route trace events to the host as they are produced. `fd` < 0 disables
+ * streaming. Under Emscripten any fd >= 0 enables the Module.onTlsTraceBatch
+ * callback; natively batches are written to `fd`. `batch_bytes` = 0 selects
+ * the 16 KB default. Takes effect from the next simulation run. */
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_set_event_sink(int fd, int retain, size_t batch_bytes) {
+  tls_sim_ctx *sim = default_sim();
+  sim->sink.enabled = fd >= 0;
+  sim->sink.fd = fd;
+  sim->sink.retain = retain ? 1 : 0;
+  sim->sink.batch_bytes = batch_bytes ? batch_bytes : SINK_BATCH_DEFAULT;
+}
 
-  char *section = "system_default_sect";
+/* ── JSON escaping ─────────────────────────────────────────────────────────
+ * Details are escaped in one pass straight into the arena. json_escape_map
+ * gives, per input byte, 0 (copy as-is), '?' (non-printable, replaced) or the
+ * character to emit after a backslash. Runs of bytes that need no escaping
+ * (the bulk of hex dumps and PEM traces) are found 16 at a time with SIMD
+ * where available and copied with memcpy. */
+#define Q '?'
+static const unsigned char json_escape_map[256] = {
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, 't', 'n', Q, Q, 'r', Q, Q, // 0x00
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,   Q,   Q, Q, Q,   Q, Q, // 0x10
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,     // 0x20
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,       // 0x30
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,       // 0x40
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,    // 0x50
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,       // 0x60
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, Q,       // 0x70
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,       // 0x80
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,       // 0x90
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,       // 0xA0
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,       // 0xB0
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,       // 0xC0
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,       // 0xD0
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,       // 0xE0
+    Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q, Q,       // 0xF0
+};
+#undef Q
 
-  // 1. Cipher Suites
-  char *ciphers = NCONF_get_string(conf, section, "Ciphersuites");
-  if (ciphers && strlen(ciphers) > 0) {
-    if (SSL_CTX_set_ciphersuites(ctx, ciphers) == 1) {
-      char msg[256];
-      snprintf(msg, sizeof(msg), "Set Ciphers: %s", ciphers);
-      log_event(side, "config_ciphers", msg);
-    } else {
-      log_event(side, "error", "Failed to set Ciphersuites");
-    }
+// Length of the leading run of bytes in s[0..n) that need no escaping.
+// Only whole 16-byte blocks are scanned here; the scalar loop does the rest.
+static size_t json_clean_run(const unsigned char *s, size_t n) {
+  size_t i = 0;
+#if defined(__wasm_simd128__)
+  const v128_t lo = wasm_i8x16_splat(0x20), del = wasm_i8x16_splat(0x7f);
+  const v128_t quote = wasm_i8x16_splat('"'), bslash = wasm_i8x16_splat('\\');
+  for (; i + 16 <= n; i += 16) {
+    v128_t v = wasm_v128_load(s + i);
+    // Signed compare: < 0x20 also catches 0x80..0xFF
+    v128_t bad = wasm_v128_or(
+        wasm_v128_or(wasm_i8x16_lt(v, lo), wasm_i8x16_eq(v, del)),
+        wasm_v128_or(wasm_i8x16_eq(v, quote), wasm_i8x16_eq(v, bslash)));
+    uint32_t m = wasm_i8x16_bitmask(bad);
+    if (m)
+      return i + (size_t)__builtin_ctz(m);
+  }
+#elif defined(__SSE2__)
+  const __m128i lo = _mm_set1_epi8(0x20), del = _mm_set1_epi8(0x7f);
+  const __m128i quote = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\');
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    // Signed compare: < 0x20 also catches 0x80..0xFF
+    __m128i bad = _mm_or_si128(
+        _mm_or_si128(_mm_cmplt_epi8(v, lo), _mm_cmpeq_epi8(v, del)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)));
+    int m = _mm_movemask_epi8(bad);
+    if (m)
+      return i + (size_t)__builtin_ctz((unsigned)m);
   }
+#endif
+  return i;
+}
 
-  // 2. Groups
-  char *groups = NCONF_get_string(conf, section, "Groups");
-  if (groups && strlen(groups) > 0) {
-    if (SSL_CTX_set1_groups_list(ctx, groups) == 1) {
-      log_event(side, "config_groups", groups);
+// Escape n bytes of src into dst (at most 2n bytes); returns bytes written.
+static size_t json_escape(char *dst, const char *src, size_t n) {
+  const unsigned char *s = (const unsigned char *)src;
+  char *d = dst;
+  size_t i = 0;
+  while (i < n) {
+    size_t run = json_clean_run(s + i, n - i);
+    if (run) {
+      memcpy(d, s + i, run);
+      d += run;
+      i += run;
+      if (i == n)
+        break;
+    }
+    unsigned char c = s[i++];
+    unsigned char e = json_escape_map[c];
+    if (!e) {
+      *d++ = (char)c;
+    } else if (e == '?') {
+      *d++ = '?';
+    } else {
+      *d++ = '\\';
+      *d++ = (char)e;
     }
   }
+  return (size_t)(d - dst);
+}
 
-  // 3. Signature Algorithms
-  char *sigalgs = NCONF_get_string(conf, section, "SignatureAlgorithms");
-  if (sigalgs && strlen(sigalgs) > 0) {
-    if (SSL_CTX_set1_sigalgs_list(ctx, sigalgs) == 1) {
-      log_event(side, "config_sigalgs", sigalgs);
-    }
+/* ── Event writer ──────────────────────────────────────────────────────────
+ * ev_begin() reserves arena space for one event and writes everything up to
+ * the opening quote of "details", including the event's "t_us" timestamp
+ * (microseconds since reset_log). The caller then writes the details text
+ * directly at w.p (at most `details_max` bytes) and ev_end() closes the
+ * object, enforces the hard cap and commits it. ev_end() can append extra
+ * structured members (a preformatted `"key":value,...` fragment of at most
+ * `fields_max` bytes, as passed to ev_begin) after "details". */
+#define EV_FIELDS_MAX 256 // fragment buffer size for the fixed-shape events
+
+typedef struct {
+  char *start;
+  char *p;
+} event_writer;
+
+static char *put_u64(char *p, uint64_t v) {
+  char tmp[20];
+  int n = 0;
+  do {
+    tmp[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v);
+  while (n)
+    *p++ = tmp[--n];
+  return p;
+}
+
+static int ev_begin(tls_sim_ctx *sim, event_writer *w, const char *side,
+                    const char *event, size_t details_max, size_t fields_max) {
+  size_t side_len = strlen(side), event_len = strlen(event);
+  size_t need = side_len + event_len + details_max + fields_max + 72;
+  char *p = log_reserve(sim, need);
+  if (!p) {
+    sim->log.dropped++;
+    return -1;
   }
+  w->start = p;
+  if (sim->log.events)
+    *p++ = ',';
+  memcpy(p, "{\"side\":\"", 9);
+  p += 9;
+  memcpy(p, side, side_len);
+  p += side_len;
+  memcpy(p, "\",\"event\":\"", 11);
+  p += 11;
+  memcpy(p, event, event_len);
+  p += event_len;
+  memcpy(p, "\",\"t_us\":", 9);
+  p = put_u64(p + 9, (uint64_t)((now_ms() - sim->log.t0) * 1000.0));
+  memcpy(p, ",\"details\":\"", 12);
+  p += 12;
+  w->p = p;
+  return 0;
+}
 
-  // 4. Verify Mode
-  char *verify = NCONF_get_string(conf, section, "VerifyMode");
-  if (verify) {
-    int mode = SSL_VERIFY_NONE;
-    if (strstr(verify, "Peer"))
-      mode |= SSL_VERIFY_PEER;
-    if (strstr(verify, "Request"))
-      mode |= SSL_VERIFY_FAIL_IF_NO_PEER_CERT;
+static void ev_end(tls_sim_ctx *sim, event_writer *w, const char *fields) {
+  *w->p++ = '"';
+  if (fields && *fields) {
+    size_t n = strlen(fields); // fits: the caller reserved it in ev_begin
+    *w->p++ = ',';
+    memcpy(w->p, fields, n);
+    w->p += n;
+  }
+  *w->p++ = '}';
+  size_t n = (size_t)(w->p - w->start);
 
-    if (mode != SSL_VERIFY_NONE) {
-      SSL_CTX_set_verify(ctx, mode, NULL);
-      log_event(side, "config_verify", "Enabled Client Verification");
-    }
+  // Enforce the optional hard cap, keeping room for the footer so close_log
+  // can always terminate the document
+  if (sim->log.limit &&
+      sim->log.total + n + LOG_FOOTER_RESERVE > sim->log.limit) {
+    sim->log.dropped++;
+    return;
+  }
+  log_commit(sim, n);
+  sim->log.events++;
+  if (sim->sink.enabled) {
+    sim->sink.pending++;
+    if (sim->log.total - sim->sink.mark_total >= sim->sink.batch_bytes)
+      sink_flush(sim);
   }
+}
 
-  // 5. CA File (Critical for Verify)
-  char *caFile = NCONF_get_string(conf, section, "VerifyCAFile");
-  if (caFile) {
-    if (SSL_CTX_load_verify_locations(ctx, caFile, NULL) == 1) {
-      log_event(side, "config_ca", "Loaded CA File");
+// Log an event whose details are `len` bytes (not necessarily NUL-terminated).
+static void log_event_n(tls_sim_ctx *sim, const char *side, const char *event,
+                        const char *details, size_t len) {
+  event_writer w;
+  if (ev_begin(sim, &w, side, event, 2 * len, 0) != 0)
+    return;
+  w.p += json_escape(w.p, details, len);
+  ev_end(sim, &w, NULL);
+}
+
+// Log an event carrying extra structured members after "details".
+static void log_event_fields(tls_sim_ctx *sim, const char *side,
+                             const char *event, const char *details,
+                             const char *fields) {
+  size_t len = strlen(details);
+  event_writer w;
+  if (ev_begin(sim, &w, side, event, 2 * len, strlen(fields) + 1) != 0)
+    return;
+  w.p += json_escape(w.p, details, len);
+  ev_end(sim, &w, fields);
+}
 
-      // INSPECT CA CERTIFICATE TYPE
-      log_ca_details(side, caFile);
+/* While a context is being built, every log_event() is also recorded as
+ * "side\0event\0details\0" so a later cache hit can replay the config-phase
+ * trace (including events logged by the HSM module) without rebuilding. */
 
-      // Set Client CA List for server to request correct certs
-      STACK_OF(X509_NAME) *list = SSL_load_client_CA_file(caFile);
-      if (list)
-        SSL_CTX_set_client_CA_list(ctx, list);
+static void setup_record(tls_sim_ctx *sim, const char *side, const char *event,
+                         const char *details) {
+  size_t ls = strlen(side) + 1, le = strlen(event) + 1, ld = strlen(details) + 1;
+  size_t need = sim->setup_rec_len + ls + le + ld;
+  if (need > sim->setup_rec_cap) {
+    size_t cap = sim->setup_rec_cap ? sim->setup_rec_cap * 2 : 1024;
+    while (cap < need)
+      cap *= 2;
+    char *p = realloc(sim->setup_rec, cap);
+    if (!p) {
+      sim->setup_rec_failed = 1; // an incomplete replay must not be cached
+      return;
     }
+    sim->setup_rec = p;
+    sim->setup_rec_cap = cap;
   }
+  memcpy(sim->setup_rec + sim->setup_rec_len, side, ls);
+  memcpy(sim->setup_rec + sim->setup_rec_len + ls, event, le);
+  memcpy(sim->setup_rec + sim->setup_rec_len + ls + le, details, ld);
+  sim->setup_rec_len = need;
+}
 
-  NCONF_free(conf);
+void log_event(tls_sim_ctx *sim, const char *side, const char *event,
+               const char *details) {
+  if (!details)
+    details = "";
+  if (sim->setup_recording)
+    setup_record(sim, side, event, details);
+  log_event_n(sim, side, event, details, strlen(details));
 }
 
-// Helper: Process pending reads
-int process_reads(SSL *ssl, const char *side) {
-  current_side = side; // Set context for decryption traces
-  char buf[4096];
-  int read_bytes = SSL_read(ssl, buf, sizeof(buf) - 1);
-  if (read_bytes > 0) {
-    buf[read_bytes] = 0; // Null terminate
-    char msg[4200];
-    snprintf(msg, sizeof(msg), "Received: %s", buf);
-    log_event(side, "message_received", msg);
-    return 1;
-  }
+void close_log(tls_sim_ctx *sim, const char *status, const char *error) {
+  // 4. Hand the final batch to the streaming sink before the footer
+  sink_flush(sim);
 
-  int err = SSL_get_error(ssl, read_bytes);
-  if (err == SSL_ERROR_ZERO_RETURN) {
-    log_event(side, "connection_closed",
-              "Peer closed connection (close_notify)");
-    return -1; // Closed
+  // 5. Append the footer, flagging any events the cap forced us to drop
+  char dropped[64] = "";
+  char streamed[48] = "";
+  if (sim->log.dropped)
+    snprintf(dropped, sizeof(dropped), ",\"truncated\":true,\"dropped_events\":%lu",
+             sim->log.dropped);
+  if (sim->sink.enabled)
+    snprintf(streamed, sizeof(streamed), ",\"streamed_events\":%lu",
+             sim->sink.streamed);
+  char footer[LOG_FOOTER_RESERVE];
+  int n = snprintf(footer, sizeof(footer),
+                   "],\"status\":\"%s\",\"error\":\"%s\"%s%s}", status,
+                   error ? error : "", dropped, streamed);
+  if (n < 0 || (size_t)n >= sizeof(footer) ||
+      log_append_raw(sim, footer, (size_t)n) != 0) {
+    sim->log.result = NULL;
+    return;
   }
-  // SSL_ERROR_WANT_READ is normal if no data
-  return 0;
-}
 
-// Helper: Flush BIOs (move data between memory buffers)
-// KEYLOG CALLBACK - logs secrets with proper side attribution
-void keylog_callback(const SSL *ssl, const char *line) {
-  // Retrieve the side from ex_data
-  const char *side = "system";
-  if (ssl_side_ex_data_idx >= 0) {
-    side = (const char *)SSL_get_ex_data(ssl, ssl_side_ex_data_idx);
-    if (!side)
-      side = "system";
+  // 6. Coalesce the arena into one contiguous string. Single-chunk runs (the
+  // common case) hand out the head chunk directly without copying.
+  if (sim->log.head == sim->log.tail) {
+    sim->log.result = sim->log.head->data;
+    sim->log.result_len = sim->log.head->len;
+    return;
+  }
+  char *doc = (char *)malloc(sim->log.total + 1);
+  if (!doc) {
+    sim->log.result = NULL;
+    return;
+  }
+  size_t off = 0;
+  for (log_chunk *c = sim->log.head; c; c = c->next) {
+    memcpy(doc + off, c->data, c->len);
+    off += c->len;
   }
-  log_event(side, "keylog", line);
+  doc[off] = 0;
+  sim->log.result = doc;
+  sim->log.result_len = off;
 }
 
-// TRACE CALLBACK
-size_t trace_callback(const char *buffer, size_t count, int category, int cmd,
-                      void *data) {
-  if (cmd != OSSL_TRACE_CTRL_WRITE)
-    return 0;
+// The finished document, or a static error document if the arena could not
+// be allocated. Valid until the next reset_log().
+static char log_oom_result[] =
+    "{\"trace\":[],\"status\":\"error\",\"error\":\"Out of memory\"}";
 
-  const char *side = current_side; // Use global context
+static char *log_result(tls_sim_ctx *sim) {
+  return sim->log.result ? sim->log.result : log_oom_result;
+}
 
-  if (count > 0 && buffer) {
-    char msg[16384];
-    size_t len = count < 16383 ? count : 16383;
-    memcpy(msg, buffer, len);
-    msg[len] = 0;
+/* Zero-copy result export. JS reads the last document straight out of the
+ * WASM heap (HEAPU8.subarray(ptr, ptr + len)) instead of letting cwrap's
+ * 'string' return type scan for the NUL and decode a copy of the whole trace.
+ * Both stay valid until the next simulation run. */
+EMSCRIPTEN_KEEPALIVE
+const char *tls_simulation_result_ptr(void) {
+  return log_result(default_sim());
+}
 
-    // Remove trailing newlines
-    while (len > 0 && (msg[len - 1] == '\n' || msg[len - 1] == '\r')) {
-      msg[--len] = 0;
-    }
+EMSCRIPTEN_KEEPALIVE
+size_t tls_simulation_result_len(void) {
+  tls_sim_ctx *sim = default_sim();
+  return sim->log.result ? sim->log.result_len : sizeof(log_oom_result) - 1;
+}
 
-    if (len == 0)
-      return count;
+/* ── TLS record parser ─────────────────────────────────────────────────────
+ * Splits each direction's byte stream into TLS records as it is pumped and
+ * emits one tls_record event per complete record, e.g.
+ *   {"side":"server","event":"tls_record","details":"Handshake 122 B: ServerHello",
+ *    "record":{"type":22,"length":122,"offset":207,"hs":[2]}}
+ * `offset` indexes the raw capture buffer (tls_simulation_capture_ptr/len),
+ * which holds every wire byte of the run in pump order, so the UI can slice
+ * records out without re-parsing hex. `length` excludes the 5-byte header.
+ * Plaintext handshake records also list the handshake message types they
+ * carry (messages spanning records are tracked). TLS 1.3 encrypted records
+ * show up as ApplicationData; the messages inside them are reported with
+ * exact sizes by msg_callback's handshake_message events instead. */
 
-    const char *event_type = "crypto_trace_other";
-    if (category == OSSL_TRACE_CATEGORY_TLS_CIPHER) {
-      event_type = "crypto_trace_data";
-    } else if (category == OSSL_TRACE_CATEGORY_TLS) {
-      event_type = "crypto_trace_state";
-    } else if (category == OSSL_TRACE_CATEGORY_INIT) {
-      event_type = "crypto_trace_init";
-    } else if (category == OSSL_TRACE_CATEGORY_PROVIDER) {
-      event_type = "crypto_trace_provider";
-    } else if (category == OSSL_TRACE_CATEGORY_QUERY ||
-               category == OSSL_TRACE_CATEGORY_STORE) {
-      event_type = "crypto_trace_evp";
-    } else if (category == OSSL_TRACE_CATEGORY_DECODER ||
-               category == OSSL_TRACE_CATEGORY_ENCODER) {
-      event_type = "crypto_trace_coder";
-    }
+// SHA-256("HelloRetryRequest"), the ServerHello.random of an HRR (RFC 8446)
+static const unsigned char hrr_random[32] = {
+    0xCF, 0x21, 0xAD, 0x74, 0xE5, 0x9A, 0x61, 0x11, 0xBE, 0x1D, 0x8C,
+    0x02, 0x1E, 0x65, 0xB8, 0x91, 0xC2, 0xA2, 0x11, 0x16, 0x7A, 0xBB,
+    0x8C, 0x5E, 0x07, 0x9E, 0x09, 0xE2, 0xC8, 0xA8, 0x33, 0x9C};
 
-    log_event(side, event_type, msg);
-  }
-  return count;
+EMSCRIPTEN_KEEPALIVE
+const unsigned char *tls_simulation_capture_ptr(void) {
+  return default_sim()->capture;
 }
 
-// MSG CALLBACK — detects individual handshake messages including HRR
-void msg_callback(int write_p, int version, int content_type,
-                  const void *buf, size_t len, SSL *ssl, void *arg) {
-  // Only process handshake messages (content_type 22)
-  if (content_type != SSL3_RT_HANDSHAKE || len < 1)
-    return;
+EMSCRIPTEN_KEEPALIVE
+size_t tls_simulation_capture_len(void) { return default_sim()->capture_len; }
 
-  const char *side = "system";
-  if (ssl_side_ex_data_idx >= 0) {
-    side = (const char *)SSL_get_ex_data(ssl, ssl_side_ex_data_idx);
-    if (!side)
-      side = "system";
+static void record_reset(tls_sim_ctx *sim) {
+  memset(sim->rec, 0, sizeof(sim->rec));
+  sim->capture_len = 0;
+}
+
+static const char *content_type_name(int type) {
+  switch (type) {
+  case SSL3_RT_CHANGE_CIPHER_SPEC:
+    return "ChangeCipherSpec";
+  case SSL3_RT_ALERT:
+    return "Alert";
+  case SSL3_RT_HANDSHAKE:
+    return "Handshake";
+  case SSL3_RT_APPLICATION_DATA:
+    return "ApplicationData";
+  default:
+    return "Unknown";
   }
+}
 
-  unsigned char msg_type = ((const unsigned char *)buf)[0];
+static const char *handshake_type_name(int type) {
+  switch (type) {
+  case SSL3_MT_CLIENT_HELLO:
+    return "ClientHello";
+  case SSL3_MT_SERVER_HELLO:
+    return "ServerHello";
+  case SSL3_MT_NEWSESSION_TICKET:
+    return "NewSessionTicket";
+  case SSL3_MT_END_OF_EARLY_DATA:
+    return "EndOfEarlyData";
+  case SSL3_MT_ENCRYPTED_EXTENSIONS:
+    return "EncryptedExtensions";
+  case SSL3_MT_CERTIFICATE:
+    return "Certificate";
+  case SSL3_MT_CERTIFICATE_REQUEST:
+    return "CertificateRequest";
+  case SSL3_MT_CERTIFICATE_VERIFY:
+    return "CertificateVerify";
+  case SSL3_MT_FINISHED:
+    return "Finished";
+  case SSL3_MT_KEY_UPDATE:
+    return "KeyUpdate";
+  case SSL3_MT_MESSAGE_HASH:
+    return "MessageHash";
+  default:
+    return "Unknown";
+  }
+}
 
-  // Track ClientHello sends from the client side
-  // msg_type 1 = ClientHello, write_p = 1 means sending
-  if (msg_type == 1 && write_p && strcmp(side, "client") == 0) {
-    client_hello_count++;
-    if (client_hello_count == 1) {
-      log_event("client", "handshake_msg", "ClientHello sent (initial)");
-    } else if (client_hello_count == 2) {
-      hrr_detected = 1;
-      log_event("client", "hello_retry",
-                "HelloRetryRequest: Server requested different key exchange "
-                "group. Client sending second ClientHello with updated "
-                "key_share. Handshake is now 2-RTT instead of 1-RTT.");
-    }
+static int capture_append(tls_sim_ctx *sim, const unsigned char *buf,
+                          size_t n) {
+  if (sim->capture_len + n > sim->capture_cap) {
+    size_t cap = sim->capture_cap ? sim->capture_cap : 64 * 1024;
+    while (cap < sim->capture_len + n)
+      cap *= 2;
+    unsigned char *p = (unsigned char *)realloc(sim->capture, cap);
+    if (!p)
+      return -1;
+    sim->capture = p;
+    sim->capture_cap = cap;
   }
+  memcpy(sim->capture + sim->capture_len, buf, n);
+  sim->capture_len += n;
+  return 0;
+}
 
-  // Detect ServerHello (msg_type 2) received by client
-  // In TLS 1.3, HelloRetryRequest is a ServerHello with a special random
-  // OpenSSL state machine handles this internally; we detect it via the
-  // client_hello_count (if a second ClientHello follows, HRR happened)
-  if (msg_type == 2 && !write_p && strcmp(side, "client") == 0) {
-    if (client_hello_count == 1 && !hrr_detected) {
-      // First ServerHello — could be HRR or real ServerHello
-      // We'll know after the next message (if client sends another CH)
-      log_event("client", "handshake_msg", "ServerHello received");
+// Track handshake message boundaries through a plaintext handshake body.
+static void record_feed_handshake(record_parser *r, const unsigned char *p,
+                                  size_t n) {
+  while (n > 0) {
+    if (r->hs_body_left == 0) {
+      r->hs_hdr[r->hs_hdr_len++] = *p++;
+      n--;
+      if (r->hs_hdr_len < 4)
+        continue;
+      r->hs_hdr_len = 0;
+      r->hs_type = r->hs_hdr[0];
+      r->hs_body_left = ((size_t)r->hs_hdr[1] << 16) |
+                        ((size_t)r->hs_hdr[2] << 8) | r->hs_hdr[3];
+      r->hs_body_seen = 0;
+      if (r->hs_count < REC_MAX_HS)
+        r->hs_types[r->hs_count++] = r->hs_type;
+      continue;
     }
+    size_t take = n < r->hs_body_left ? n : r->hs_body_left;
+    // ServerHello body: legacy_version(2) then random(32)
+    if (r->hs_type == SSL3_MT_SERVER_HELLO && r->hs_body_seen < 34) {
+      for (size_t i = 0; i < take && r->hs_body_seen + i < 34; i++) {
+        size_t at = r->hs_body_seen + i;
+        if (at >= 2)
+          r->hs_random[at - 2] = p[i];
+      }
+      if (r->hs_body_seen + take >= 34 &&
+          memcmp(r->hs_random, hrr_random, sizeof(hrr_random)) == 0)
+        r->hrr = 1;
+    }
+    r->hs_body_seen += take;
+    r->hs_body_left -= take;
+    p += take;
+    n -= take;
   }
+}
 
-  // CertificateVerify (msg_type 15) sent by server — when HSM mode is active
-  // the private key lives in softhsmv3 and pkcs11-provider routes sign through
-  // C_SignInit + C_Sign.  We synthesise those log events here so the PKCS#11
-  // log panel shows the sign operation that happened in the HSM.
-  if (msg_type == 15 && write_p && strcmp(side, "server") == 0 &&
-      hsm_mode_enabled()) {
-    log_event("server", "pkcs11_call",
-              "C_SignInit(CKM_ML_DSA) — CertificateVerify: ML-DSA sign over TLS transcript hash");
-    char sig_msg[128];
-    snprintf(sig_msg, sizeof(sig_msg),
-             "C_Sign → ML-DSA signature (%zu B) over TLS 1.3 transcript hash (private key never exposed)",
-             len);
-    log_event("server", "pkcs11_call", sig_msg);
-    log_event("server", "pkcs11_call",
-              "CertificateVerify routed through pkcs11-provider → softhsmv3");
+static void record_emit(tls_sim_ctx *sim, const char *sender,
+                        record_parser *r) {
+  int type = r->hdr[0];
+  size_t length = ((size_t)r->hdr[3] << 8) | r->hdr[4];
+  r->records++;
+  r->record_bytes += length + 5;
+
+  char details[256];
+  size_t n = (size_t)snprintf(details, sizeof(details), "%s %zu B",
+                              content_type_name(type), length);
+  for (int i = 0; i < r->hs_count && n < sizeof(details); i++) {
+    const char *name = r->hs_types[i] == SSL3_MT_SERVER_HELLO && r->hrr
+                           ? "HelloRetryRequest"
+                           : handshake_type_name(r->hs_types[i]);
+    n += (size_t)snprintf(details + n, sizeof(details) - n, "%s%s",
+                          i ? ", " : ": ", name);
   }
-}
+  if (type == SSL3_RT_APPLICATION_DATA && n < sizeof(details))
+    snprintf(details + n, sizeof(details) - n, " (encrypted)");
 
-// INFO CALLBACK - logs TLS handshake state transitions
-void info_callback(const SSL *ssl, int where, int ret) {
+  char fields[EV_FIELDS_MAX];
+  n = (size_t)snprintf(
+      fields, sizeof(fields),
+      "\"record\":{\"type\":%d,\"length\":%zu,\"offset\":%zu,\"hs\":[", type,
+      length, r->offset);
+  for (int i = 0; i < r->hs_count; i++)
+    n += (size_t)snprintf(fields + n, sizeof(fields) - n, "%s%d",
+                          i ? "," : "", r->hs_types[i]);
+  snprintf(fields + n, sizeof(fields) - n, "]}");
+
+  log_event_fields(sim, sender, "tls_record", details, fields);
+  r->hs_count = 0;
+  r->hrr = 0;
+}
+
+// Feed `n` bytes just pumped by `sender`; they start at capture offset `base`.
+static void record_feed(tls_sim_ctx *sim, const char *sender,
+                        const unsigned char *p, size_t n, size_t base) {
+  record_parser *r = &sim->rec[strcmp(sender, "client") == 0 ? 0 : 1];
+  size_t pos = 0;
+  while (pos < n) {
+    if (r->hdr_len < 5) {
+      if (r->hdr_len == 0)
+        r->offset = base + pos;
+      r->hdr[r->hdr_len++] = p[pos++];
+      if (r->hdr_len == 5) {
+        r->body_left = ((size_t)r->hdr[3] << 8) | r->hdr[4];
+        if (r->body_left == 0) {
+          record_emit(sim, sender, r);
+          r->hdr_len = 0;
+        }
+      }
+      continue;
+    }
+    size_t take = n - pos < r->body_left ? n - pos : r->body_left;
+    if (r->hdr[0] == SSL3_RT_HANDSHAKE)
+      record_feed_handshake(r, p + pos, take);
+    r->body_left -= take;
+    pos += take;
+    if (r->body_left == 0) {
+      record_emit(sim, sender, r);
+      r->hdr_len = 0;
+    }
+  }
+}
+
+static void log_record_summary(tls_sim_ctx *sim) {
+  if (!EV_ON(sim, TLS_SIM_EV_RECORD))
+    return;
+  char msg[160];
+  char fields[EV_FIELDS_MAX];
+  snprintf(msg, sizeof(msg),
+           "Client sent %lu records (%lu B), server sent %lu records (%lu B)",
+           sim->rec[0].records, sim->rec[0].record_bytes, sim->rec[1].records,
+           sim->rec[1].record_bytes);
+  snprintf(fields, sizeof(fields),
+           "\"records\":{\"client\":{\"count\":%lu,\"bytes\":%lu},"
+           "\"server\":{\"count\":%lu,\"bytes\":%lu}}",
+           sim->rec[0].records, sim->rec[0].record_bytes, sim->rec[1].records,
+           sim->rec[1].record_bytes);
+  log_event_fields(sim, "connection", "record_summary", msg, fields);
+}
+
+/* ── In-memory inputs ──────────────────────────────────────────────────────
+ * Configs, credentials and the command script are named by path. A buffer
+ * registered under one of those paths with tls_simulation_set_input() stands
+ * in for the file, so the worker can hand them over without writing MEMFS
+ * first and the run never touches the filesystem for them: every loader (the
+ * configs, the VerifyCAFile they name, the credential files, the script and
+ * the SSL_CTX cache key) goes through input_open(). Certificates and keys may
+ * be PEM or DER; DER skips the PEM decode. */
+
+typedef struct {
+  const char *data; // NUL-terminated
+  size_t len;
+  char *owned; // file contents, freed by input_close()
+} input_buf;
+
+// Whole file in a NUL-terminated heap buffer, or NULL if it can't be read.
+static char *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return NULL;
+  char *data = NULL;
+  long size;
+  if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+      fseek(f, 0, SEEK_SET) == 0 && (data = malloc((size_t)size + 1))) {
+    *len = fread(data, 1, (size_t)size, f);
+    data[*len] = 0;
+  }
+  fclose(f);
+  return data;
+}
+
+static sim_input *find_input(tls_sim_ctx *sim, const char *path) {
+  for (int i = 0; i < sim->input_count; i++)
+    if (strcmp(sim->inputs[i].path, path) == 0)
+      return &sim->inputs[i];
+  return NULL;
+}
+
+// Contents of `path`: the registered buffer, else the file. -1 if neither.
+static int input_open(tls_sim_ctx *sim, const char *path, input_buf *in) {
+  const sim_input *mem = find_input(sim, path);
+  if (mem) {
+    in->data = mem->data;
+    in->len = mem->len;
+    in->owned = NULL;
+    return 0;
+  }
+  in->len = 0;
+  in->owned = read_file(path, &in->len);
+  in->data = in->owned;
+  return in->owned ? 0 : -1;
+}
+
+static void input_close(input_buf *in) { free(in->owned); }
+
+static int input_exists(tls_sim_ctx *sim, const char *path) {
+  return find_input(sim, path) || access(path, F_OK) == 0;
+}
+
+// DER has no "-----BEGIN" line, and its first NUL ends the search early.
+static int input_is_pem(const input_buf *in) {
+  return strstr(in->data, "-----BEGIN") != NULL;
+}
+
+// First certificate of a PEM or DER input; NULL if missing or unreadable.
+// Also used by tls_simulation_hsm.c to size the HSM key to the chosen cert.
+X509 *sim_load_cert(tls_sim_ctx *sim, const char *path) {
+  input_buf in;
+  if (input_open(sim, path, &in) != 0)
+    return NULL;
+  X509 *cert = NULL;
+  if (input_is_pem(&in)) {
+    BIO *b = BIO_new_mem_buf(in.data, (int)in.len);
+    cert = b ? PEM_read_bio_X509(b, NULL, NULL, NULL) : NULL;
+    BIO_free(b);
+  } else {
+    const unsigned char *p = (const unsigned char *)in.data;
+    cert = d2i_X509(NULL, &p, (long)in.len);
+  }
+  input_close(&in);
+  return cert;
+}
+
+static EVP_PKEY *load_key(tls_sim_ctx *sim, const char *path) {
+  input_buf in;
+  if (input_open(sim, path, &in) != 0)
+    return NULL;
+  EVP_PKEY *pkey = NULL;
+  if (input_is_pem(&in)) {
+    BIO *b = BIO_new_mem_buf(in.data, (int)in.len);
+    pkey = b ? PEM_read_bio_PrivateKey(b, NULL, NULL, NULL) : NULL;
+    BIO_free(b);
+  } else {
+    const unsigned char *p = (const unsigned char *)in.data;
+    pkey = d2i_AutoPrivateKey(NULL, &p, (long)in.len);
+  }
+  input_close(&in);
+  return pkey;
+}
+
+// SSL_CTX_use_certificate_file() / SSL_CTX_use_PrivateKey_file() for inputs.
+static int use_cert_input(tls_sim_ctx *sim, SSL_CTX *ctx, const char *path) {
+  X509 *cert = sim_load_cert(sim, path);
+  int ok = cert && SSL_CTX_use_certificate(ctx, cert) == 1;
+  X509_free(cert);
+  return ok ? 0 : -1;
+}
+
+static int use_key_input(tls_sim_ctx *sim, SSL_CTX *ctx, const char *path) {
+  EVP_PKEY *pkey = load_key(sim, path);
+  int ok = pkey && SSL_CTX_use_PrivateKey(ctx, pkey) == 1;
+  EVP_PKEY_free(pkey);
+  return ok ? 0 : -1;
+}
+
+// Register (or with NULL data, remove) the buffer that stands in for the file
+// at `path`. The bytes are copied. Returns -1 if the path is too long, all
+// INPUT_MAX slots are taken or memory runs out.
+EMSCRIPTEN_KEEPALIVE
+int tls_sim_ctx_set_input(tls_sim_ctx *sim, const char *path, const void *data,
+                          size_t len) {
+  if (!path || strlen(path) >= CRED_PATH_MAX)
+    return -1;
+  sim_input *slot = find_input(sim, path);
+  if (!data) {
+    if (slot) {
+      free(slot->data);
+      *slot = sim->inputs[--sim->input_count];
+    }
+    return 0;
+  }
+  if (!slot && sim->input_count == INPUT_MAX)
+    return -1;
+  char *copy = malloc(len + 1);
+  if (!copy)
+    return -1;
+  memcpy(copy, data, len);
+  copy[len] = 0;
+  if (!slot) {
+    slot = &sim->inputs[sim->input_count++];
+    strcpy(slot->path, path);
+  } else {
+    free(slot->data);
+  }
+  slot->data = copy;
+  slot->len = len;
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void tls_sim_ctx_clear_inputs(tls_sim_ctx *sim) {
+  for (int i = 0; i < sim->input_count; i++)
+    free(sim->inputs[i].data);
+  sim->input_count = 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int tls_simulation_set_input(const char *path, const void *data, size_t len) {
+  return tls_sim_ctx_set_input(default_sim(), path, data, len);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_clear_inputs(void) {
+  tls_sim_ctx_clear_inputs(default_sim());
+}
+
+/* ── CA cache ──────────────────────────────────────────────────────────────
+ * A VerifyCAFile used to be parsed three times per context build (trust
+ * store, key type for config_ca_details, client-CA list) and the credential
+ * CA files once more each. Every CA file is now decoded once per content,
+ * keyed on an FNV-1a hash of its path and bytes, and the X509_STORE built
+ * from a given list of files is shared, refcounted, by every context that
+ * trusts exactly that list. A shared store is never modified afterwards:
+ * trusting another file switches the context to the store for the longer
+ * list. The client-CA list is copied per context, since SSL_CTX owns it. */
+#define CA_FILE_SLOTS 8
+#define CA_STORE_SLOTS 8
+#define CA_SET_MAX 3 // VerifyCAFile, credential CA, HSM server cert
+#define FNV64_OFFSET 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+typedef struct {
+  uint64_t key;
+  unsigned long last_used; // 0 = empty slot
+  STACK_OF(X509) *certs;
+  STACK_OF(X509_CRL) *crls;
+  STACK_OF(X509_NAME) *names; // distinct subjects, as SSL_load_client_CA_file
+  char key_type[64];          // first certificate's key, "" if unreadable
+} ca_file_entry;
+
+typedef struct {
+  uint64_t key; // the file keys, in load order
+  unsigned long last_used;
+  X509_STORE *store;
+} ca_store_entry;
+
+// CA files one SSL_CTX trusts so far.
+typedef struct {
+  uint64_t key[CA_SET_MAX];
+  int n;
+} ca_files;
+
+static ca_file_entry g_ca_files[CA_FILE_SLOTS];
+static ca_store_entry g_ca_stores[CA_STORE_SLOTS];
+static unsigned long g_ca_cache_tick;
+static pthread_mutex_t g_ca_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t n) {
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= FNV64_PRIME;
+  }
+  return h;
+}
+
+static void ca_file_evict(ca_file_entry *e) {
+  sk_X509_pop_free(e->certs, X509_free);
+  sk_X509_CRL_pop_free(e->crls, X509_CRL_free);
+  sk_X509_NAME_pop_free(e->names, X509_NAME_free);
+  memset(e, 0, sizeof(*e));
+}
+
+static void ca_store_evict(ca_store_entry *e) {
+  X509_STORE_free(e->store);
+  memset(e, 0, sizeof(*e));
+}
+
+static ca_file_entry *ca_file_lookup(uint64_t key) {
+  for (int i = 0; i < CA_FILE_SLOTS; i++) {
+    ca_file_entry *e = &g_ca_files[i];
+    if (e->last_used && e->key == key) {
+      e->last_used = ++g_ca_cache_tick;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+// Decode the certificates and CRLs of a PEM file into a free slot, the way
+// SSL_CTX_load_verify_locations() and SSL_load_client_CA_file() read it. A
+// DER input holds a single certificate.
+static ca_file_entry *ca_file_parse(uint64_t key, const input_buf *in) {
+  STACK_OF(X509_INFO) *infos = NULL;
+  if (input_is_pem(in)) {
+    BIO *b = BIO_new_mem_buf(in->data, (int)in->len);
+    infos = b ? PEM_X509_INFO_read_bio(b, NULL, NULL, NULL) : NULL;
+    BIO_free(b);
+  } else {
+    const unsigned char *p = (const unsigned char *)in->data;
+    X509_INFO *info = X509_INFO_new();
+    infos = sk_X509_INFO_new_null();
+    if (info && infos && (info->x509 = d2i_X509(NULL, &p, (long)in->len)) &&
+        sk_X509_INFO_push(infos, info) > 0) {
+      info = NULL;
+    } else {
+      sk_X509_INFO_free(infos);
+      infos = NULL;
+    }
+    X509_INFO_free(info);
+  }
+  if (!infos)
+    return NULL;
+
+  ca_file_entry fresh = {0};
+  fresh.certs = sk_X509_new_null();
+  fresh.crls = sk_X509_CRL_new_null();
+  fresh.names = sk_X509_NAME_new_null();
+  int ok = fresh.certs && fresh.crls && fresh.names;
+  for (int i = 0; ok && i < sk_X509_INFO_num(infos); i++) {
+    X509_INFO *info = sk_X509_INFO_value(infos, i);
+    if (info->x509) {
+      X509_NAME *subject = X509_get_subject_name(info->x509);
+      int seen = 0;
+      for (int j = 0; !seen && j < sk_X509_NAME_num(fresh.names); j++)
+        seen = X509_NAME_cmp(sk_X509_NAME_value(fresh.names, j), subject) == 0;
+      X509_NAME *name = seen ? NULL : X509_NAME_dup(subject);
+      ok = sk_X509_push(fresh.certs, info->x509) > 0 &&
+           (seen || (name && sk_X509_NAME_push(fresh.names, name) > 0));
+      if (ok)
+        info->x509 = NULL;
+      else if (name)
+        X509_NAME_free(name);
+    }
+    if (ok && info->crl) {
+      ok = sk_X509_CRL_push(fresh.crls, info->crl) > 0;
+      if (ok)
+        info->crl = NULL;
+    }
+  }
+  sk_X509_INFO_pop_free(infos, X509_INFO_free);
+  if (!ok || sk_X509_num(fresh.certs) + sk_X509_CRL_num(fresh.crls) == 0) {
+    ca_file_evict(&fresh);
+    return NULL;
+  }
+
+  EVP_PKEY *pkey = sk_X509_num(fresh.certs)
+                       ? X509_get0_pubkey(sk_X509_value(fresh.certs, 0))
+                       : NULL;
+  if (pkey) {
+    // EVP_PKEY_get0_type_name() works for all OpenSSL 3.x key types
+    // including PQC (ML-DSA, SLH-DSA). EVP_PKEY_base_id()/OBJ_nid2sn()
+    // returns NID_undef for provider-based keys.
+    const char *name = EVP_PKEY_get0_type_name(pkey);
+    snprintf(fresh.key_type, sizeof(fresh.key_type), "%s",
+             (name && name[0]) ? name : "Unknown");
+  }
+
+  ca_file_entry *victim = &g_ca_files[0];
+  for (int i = 1; i < CA_FILE_SLOTS && victim->last_used; i++)
+    if (g_ca_files[i].last_used < victim->last_used)
+      victim = &g_ca_files[i];
+  if (victim->last_used)
+    ca_file_evict(victim);
+  *victim = fresh;
+  victim->key = key;
+  victim->last_used = ++g_ca_cache_tick;
+  return victim;
+}
+
+// The store for the file keys in `cas`, built from their cached contents on a
+// miss. Returns a borrowed pointer, NULL if a file has been evicted.
+static X509_STORE *ca_store_get(const ca_files *cas) {
+  uint64_t key = fnv1a(FNV64_OFFSET, cas->key, cas->n * sizeof(cas->key[0]));
+  for (int i = 0; i < CA_STORE_SLOTS; i++) {
+    ca_store_entry *e = &g_ca_stores[i];
+    if (e->last_used && e->key == key) {
+      e->last_used = ++g_ca_cache_tick;
+      return e->store;
+    }
+  }
+
+  X509_STORE *store = X509_STORE_new();
+  for (int i = 0; store && i < cas->n; i++) {
+    ca_file_entry *f = ca_file_lookup(cas->key[i]);
+    int ok = f != NULL;
+    for (int j = 0; ok && j < sk_X509_num(f->certs); j++)
+      ok = X509_STORE_add_cert(store, sk_X509_value(f->certs, j));
+    for (int j = 0; ok && j < sk_X509_CRL_num(f->crls); j++)
+      ok = X509_STORE_add_crl(store, sk_X509_CRL_value(f->crls, j));
+    if (!ok) {
+      X509_STORE_free(store);
+      store = NULL;
+    }
+  }
+  if (!store)
+    return NULL;
+
+  ca_store_entry *victim = &g_ca_stores[0];
+  for (int i = 1; i < CA_STORE_SLOTS && victim->last_used; i++)
+    if (g_ca_stores[i].last_used < victim->last_used)
+      victim = &g_ca_stores[i];
+  if (victim->last_used)
+    ca_store_evict(victim);
+  victim->key = key;
+  victim->last_used = ++g_ca_cache_tick;
+  victim->store = store;
+  return store;
+}
+
+// Make `ctx` trust the CA file at `path` on top of the files already in `cas`
+// (the SSL_CTX_load_verify_locations() equivalent). With `client_ca_list`,
+// also sets its subjects as the client-CA list. `key_type` receives the first
+// certificate's key type, "" if there is none. Returns -1 if the file is
+// missing or holds no certificates or CRLs.
+static int ca_cache_attach(tls_sim_ctx *sim, SSL_CTX *ctx, ca_files *cas,
+                           const char *path, int client_ca_list,
+                           char *key_type, size_t key_type_len) {
+  input_buf in;
+  if (cas->n == CA_SET_MAX || input_open(sim, path, &in) != 0)
+    return -1;
+  uint64_t key = fnv1a(FNV64_OFFSET, path, strlen(path) + 1);
+  key = fnv1a(key, in.data, in.len);
+
+  int rc = -1;
+  pthread_mutex_lock(&g_ca_cache_lock);
+  ca_file_entry *f = ca_file_lookup(key);
+  if (!f)
+    f = ca_file_parse(key, &in);
+  if (f) {
+    cas->key[cas->n++] = key;
+    X509_STORE *store = ca_store_get(cas);
+    int want_names = client_ca_list && sk_X509_NAME_num(f->names) > 0;
+    STACK_OF(X509_NAME) *names = want_names ? SSL_dup_CA_list(f->names) : NULL;
+    if (store && (!want_names || names)) {
+      SSL_CTX_set1_cert_store(ctx, store);
+      if (names)
+        SSL_CTX_set_client_CA_list(ctx, names);
+      if (key_type)
+        snprintf(key_type, key_type_len, "%s", f->key_type);
+      rc = 0;
+    } else {
+      sk_X509_NAME_pop_free(names, X509_NAME_free);
+      cas->n--;
+    }
+  }
+  pthread_mutex_unlock(&g_ca_cache_lock);
+  input_close(&in);
+  return rc;
+}
+
+static void ca_cache_flush(void) {
+  pthread_mutex_lock(&g_ca_cache_lock);
+  for (int i = 0; i < CA_STORE_SLOTS; i++)
+    if (g_ca_stores[i].last_used)
+      ca_store_evict(&g_ca_stores[i]);
+  for (int i = 0; i < CA_FILE_SLOTS; i++)
+    if (g_ca_files[i].last_used)
+      ca_file_evict(&g_ca_files[i]);
+  pthread_mutex_unlock(&g_ca_cache_lock);
+}
+
+// CONFIGURATION PARSER
+#define CONFIG_SECTION "system_default_sect"
+
+// Parse a config file's bytes; NULL when NCONF rejects them.
+static CONF *config_parse(const input_buf *in) {
+  CONF *conf = NCONF_new(NULL);
+  BIO *b = BIO_new_mem_buf(in->data, (int)in->len);
+  int loaded = conf && b && NCONF_load_bio(conf, b, NULL);
+  BIO_free(b);
+  if (!loaded) {
+    NCONF_free(conf);
+    return NULL;
+  }
+  return conf;
+}
+
+void apply_config(tls_sim_ctx *sim, SSL_CTX *ctx, ca_files *cas,
+                  const char *path, const char *side) {
+  input_buf in;
+  if (!path || input_open(sim, path, &in) != 0)
+    return;
+
+  CONF *conf = config_parse(&in);
+  input_close(&in);
+  if (!conf) {
+    char err[128];
+    snprintf(err, sizeof(err), "Failed to load config: %s", path);
+    log_event(sim, side, "warning", err);
+    return;
+  }
+
+  log_event(sim, side, "config", "Loaded configuration file");
+
+  char *section = CONFIG_SECTION;
+
+  // 1. Cipher Suites
+  char *ciphers = NCONF_get_string(conf, section, "Ciphersuites");
+  if (ciphers && strlen(ciphers) > 0) {
+    if (SSL_CTX_set_ciphersuites(ctx, ciphers) == 1) {
+      char msg[256];
+      snprintf(msg, sizeof(msg), "Set Ciphers: %s", ciphers);
+      log_event(sim, side, "config_ciphers", msg);
+    } else {
+      log_event(sim, side, "error", "Failed to set Ciphersuites");
+    }
+  }
+
+  // 2. Groups
+  char *groups = NCONF_get_string(conf, section, "Groups");
+  if (groups && strlen(groups) > 0) {
+    if (SSL_CTX_set1_groups_list(ctx, groups) == 1) {
+      log_event(sim, side, "config_groups", groups);
+    }
+  }
+
+  // 3. Signature Algorithms
+  char *sigalgs = NCONF_get_string(conf, section, "SignatureAlgorithms");
+  if (sigalgs && strlen(sigalgs) > 0) {
+    if (SSL_CTX_set1_sigalgs_list(ctx, sigalgs) == 1) {
+      log_event(sim, side, "config_sigalgs", sigalgs);
+    }
+  }
+
+  // 4. Verify Mode
+  char *verify = NCONF_get_string(conf, section, "VerifyMode");
+  if (verify) {
+    int mode = SSL_VERIFY_NONE;
+    if (strstr(verify, "Peer"))
+      mode |= SSL_VERIFY_PEER;
+    if (strstr(verify, "Request"))
+      mode |= SSL_VERIFY_FAIL_IF_NO_PEER_CERT;
+
+    if (mode != SSL_VERIFY_NONE) {
+      SSL_CTX_set_verify(ctx, mode, NULL);
+      log_event(sim, side, "config_verify", "Enabled Client Verification");
+    }
+  }
+
+  // 5. CA File (Critical for Verify)
+  char *caFile = NCONF_get_string(conf, section, "VerifyCAFile");
+  // The client-CA list lets the server request the correct certs.
+  char key_type[64];
+  if (caFile && ca_cache_attach(sim, ctx, cas, caFile, 1, key_type,
+                                sizeof(key_type)) == 0) {
+    log_event(sim, side, "config_ca", "Loaded CA File");
+
+    // INSPECT CA CERTIFICATE TYPE
+    if (key_type[0]) {
+      char details[256];
+      snprintf(details, sizeof(details), "CA Key Type: %s", key_type);
+      log_event(sim, side, "config_ca_details", details);
+    }
+  }
+
+  NCONF_free(conf);
+}
+
+#define RECV_PREVIEW_MAX 1024 // payload bytes quoted in message_received
+
+typedef struct {
+  size_t bytes;
+  size_t records; // reads; each returns at most one record's plaintext
+  size_t preview_len;
+} recv_stats;
+
+// Read application data with SSL_read_ex() until `ssl` has none left,
+// keeping only the first `preview_cap` bytes (in `preview`). Returns the
+// SSL_get_error() code that ended the loop: SSL_ERROR_WANT_READ once the
+// buffered records are used up, SSL_ERROR_ZERO_RETURN after close_notify.
+static int drain_app_data(SSL *ssl, unsigned char *preview,
+                          size_t preview_cap, recv_stats *st) {
+  unsigned char buf[SSL3_RT_MAX_PLAIN_LENGTH];
+  size_t n = 0;
+  int ok;
+  while ((ok = SSL_read_ex(ssl, buf, sizeof(buf), &n)) == 1) {
+    if (st->preview_len < preview_cap) {
+      size_t take = preview_cap - st->preview_len;
+      if (take > n)
+        take = n;
+      memcpy(preview + st->preview_len, buf, take);
+      st->preview_len += take;
+    }
+    st->bytes += n;
+    st->records++;
+  }
+  return SSL_get_error(ssl, ok);
+}
+
+// message_received: "Received: <text>" with the text capped at
+// RECV_PREVIEW_MAX bytes, or just the size for binary payloads.
+static void log_received(tls_sim_ctx *sim, const char *side,
+                         const unsigned char *preview, const recv_stats *st) {
+  int binary = 0;
+  for (size_t i = 0; i < st->preview_len && !binary; i++)
+    binary = (preview[i] < 0x20 && preview[i] != '\t' && preview[i] != '\n' &&
+              preview[i] != '\r') ||
+             preview[i] == 0x7f;
+  char fields[160];
+  snprintf(fields, sizeof(fields),
+           "\"payload\":{\"bytes\":%zu,\"records\":%zu,\"preview_bytes\":%zu,"
+           "\"binary\":%s}",
+           st->bytes, st->records, binary ? 0 : st->preview_len,
+           binary ? "true" : "false");
+
+  event_writer w;
+  if (ev_begin(sim, &w, side, "message_received", 2 * st->preview_len + 64,
+               strlen(fields) + 1) != 0)
+    return;
+  if (binary) {
+    w.p += sprintf(w.p, "Received: %zu bytes (binary)", st->bytes);
+  } else {
+    memcpy(w.p, "Received: ", 10);
+    w.p += 10;
+    w.p += json_escape(w.p, (const char *)preview, st->preview_len);
+    if (st->bytes > st->preview_len)
+      w.p += sprintf(w.p, "... (%zu bytes)", st->bytes);
+  }
+  ev_end(sim, &w, fields);
+}
+
+// Helper: Process pending reads. Drains every record that has arrived and
+// logs them as one message; returns 1 if data arrived, 0 if none, -1 once the
+// peer has sent close_notify.
+int process_reads(tls_sim_ctx *sim, SSL *ssl, const char *side) {
+  sim->current_side = side; // Set context for decryption traces
+  unsigned char preview[RECV_PREVIEW_MAX];
+  recv_stats st = {0, 0, 0};
+  int err = drain_app_data(ssl, preview, sizeof(preview), &st);
+  if (st.bytes > 0)
+    log_received(sim, side, preview, &st);
+
+  if (err == SSL_ERROR_ZERO_RETURN) {
+    log_event(sim, side, "connection_closed",
+              "Peer closed connection (close_notify)");
+    return -1; // Closed
+  }
+  // SSL_ERROR_WANT_READ is normal once the input is drained
+  return st.bytes > 0;
+}
+
+// Helper: Flush BIOs (move data between memory buffers)
+// KEYLOG CALLBACK - logs secrets with proper side attribution. Installed once
+// by build_contexts(); the running context's mask decides, so cached contexts
+// shared between threads are never written to.
+void keylog_callback(const SSL *ssl, const char *line) {
+  tls_sim_ctx *sim = sim_of(ssl);
+  if (!sim || !EV_ON(sim, TLS_SIM_EV_KEYLOG))
+    return;
+  // Retrieve the side from ex_data
   const char *side = "system";
   if (ssl_side_ex_data_idx >= 0) {
     side = (const char *)SSL_get_ex_data(ssl, ssl_side_ex_data_idx);
     if (!side)
       side = "system";
   }
+  log_event(sim, side, "keylog", line);
+}
 
-  // Log handshake lifecycle events
-  if (where & SSL_CB_HANDSHAKE_START) {
-    log_event(side, "handshake_start", "TLS handshake initiated");
-  }
-  if (where & SSL_CB_HANDSHAKE_DONE) {
-    log_event(side, "handshake_done", "TLS handshake completed");
-  }
+// TRACE CALLBACK
+size_t trace_callback(const char *buffer, size_t count, int category, int cmd,
+                      void *data) {
+  tls_sim_ctx *sim = data; // registered by apply_trace_mask()
+  if (cmd != OSSL_TRACE_CTRL_WRITE || !sim)
+    return 0;
+  // The channels see every thread's OpenSSL calls; other runs' lines would
+  // land in this context's arena from a foreign thread.
+  if (!pthread_equal(pthread_self(), sim->trace_thread))
+    return count;
 
-  // Log specific TLS 1.3 state transitions
-  if (where & SSL_CB_LOOP) {
-    const char *state = SSL_state_string_long(ssl);
-    if (state && strlen(state) > 0) {
-      log_event(side, "handshake_state", state);
+  const char *side = sim->current_side;
+
+  if (count > 0 && buffer) {
+    // Trim trailing newlines in place of copying; log_event_n escapes the
+    // bytes straight from OpenSSL's buffer.
+    size_t len = count;
+    while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r'))
+      len--;
+
+    if (len == 0)
+      return count;
+
+    const char *event_type = "crypto_trace_other";
+    if (category == OSSL_TRACE_CATEGORY_TLS_CIPHER) {
+      event_type = "crypto_trace_data";
+    } else if (category == OSSL_TRACE_CATEGORY_TLS) {
+      event_type = "crypto_trace_state";
+    } else if (category == OSSL_TRACE_CATEGORY_INIT) {
+      event_type = "crypto_trace_init";
+#ifdef OSSL_TRACE_CATEGORY_PROVIDER
+    } else if (category == OSSL_TRACE_CATEGORY_PROVIDER) {
+      event_type = "crypto_trace_provider";
+#endif
+#ifdef OSSL_TRACE_CATEGORY_QUERY
+    } else if (category == OSSL_TRACE_CATEGORY_QUERY) {
+      event_type = "crypto_trace_evp";
+#endif
+    } else if (category == OSSL_TRACE_CATEGORY_STORE) {
+      event_type = "crypto_trace_evp";
+    } else if (category == OSSL_TRACE_CATEGORY_DECODER ||
+               category == OSSL_TRACE_CATEGORY_ENCODER) {
+      event_type = "crypto_trace_coder";
     }
+
+    log_event_n(sim, side, event_type, buffer, len);
   }
+  return count;
+}
 
-  // Log alerts
-  if (where & SSL_CB_ALERT) {
-    char msg[256];
-    const char *alert_type = (where & SSL_CB_READ) ? "received" : "sending";
-    snprintf(msg, sizeof(msg), "Alert %s: %s %s", alert_type,
-             SSL_alert_type_string_long(ret), SSL_alert_desc_string_long(ret));
-    log_event(side, "alert", msg);
+// (Un)register trace_callback per category to match the event mask. The
+// trace channels are process-global, so categories disabled since the last
+// run are explicitly detached. INIT stays off: too verbose to be useful.
+static const struct {
+  int category;
+  unsigned int bit;
+} trace_channels[] = {
+    {OSSL_TRACE_CATEGORY_TLS, TLS_SIM_EV_TRACE_TLS},
+    {OSSL_TRACE_CATEGORY_TLS_CIPHER, TLS_SIM_EV_TRACE_CIPHER},
+    {OSSL_TRACE_CATEGORY_DECODER, TLS_SIM_EV_TRACE_CODER},
+    {OSSL_TRACE_CATEGORY_ENCODER, TLS_SIM_EV_TRACE_CODER},
+#ifdef OSSL_TRACE_CATEGORY_PROVIDER // OpenSSL 3.2+
+    {OSSL_TRACE_CATEGORY_PROVIDER, TLS_SIM_EV_TRACE_PROVIDER},
+#endif
+#ifdef OSSL_TRACE_CATEGORY_QUERY // OpenSSL 3.2+
+    {OSSL_TRACE_CATEGORY_QUERY, TLS_SIM_EV_TRACE_EVP},
+#endif
+    {OSSL_TRACE_CATEGORY_STORE, TLS_SIM_EV_TRACE_EVP},
+    {OSSL_TRACE_CATEGORY_X509V3_POLICY, TLS_SIM_EV_TRACE_POLICY},
+};
+
+#define TRACE_EV_BITS                                                          \
+  (TLS_SIM_EV_TRACE_TLS | TLS_SIM_EV_TRACE_CIPHER |                            \
+   TLS_SIM_EV_TRACE_PROVIDER | TLS_SIM_EV_TRACE_EVP |                          \
+   TLS_SIM_EV_TRACE_CODER | TLS_SIM_EV_TRACE_POLICY)
+
+// OpenSSL's trace channels are process-wide; they report to one context at
+// a time, which holds this lock until its run ends (trace_release()).
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void set_trace_channels(tls_sim_ctx *sim) {
+  for (size_t i = 0; i < sizeof(trace_channels) / sizeof(trace_channels[0]);
+       i++)
+    OSSL_trace_set_callback(trace_channels[i].category,
+                            sim && EV_ON(sim, trace_channels[i].bit)
+                                ? trace_callback
+                                : NULL,
+                            sim);
+}
+
+// A run with tracing enabled takes the channels over, waiting for any other
+// context's traced run to finish; once it owns them, the callbacks follow its
+// mask (bulk transfers mute them mid-run) until trace_release().
+static void apply_trace_mask(tls_sim_ctx *sim) {
+  if (EV_ON(sim, TRACE_EV_BITS) && !sim->trace_held) {
+    pthread_mutex_lock(&g_trace_lock);
+    sim->trace_held = 1;
+    sim->trace_thread = pthread_self();
   }
+  if (sim->trace_held)
+    set_trace_channels(sim);
 }
 
-// Helper to pump data between BIOs and log wire format
-int pump_flash_drive(BIO *from, BIO *to, const char *sender) {
-  char buf[16384];
-  int total = 0;
-  int pending = BIO_pending(from);
+static void trace_release(tls_sim_ctx *sim) {
+  if (!sim->trace_held)
+    return;
+  set_trace_channels(NULL);
+  sim->trace_held = 0;
+  pthread_mutex_unlock(&g_trace_lock);
+}
 
-  while (pending > 0) {
-    int read = BIO_read(from, buf, sizeof(buf));
-    if (read <= 0)
-      break;
+// MSG CALLBACK — detects individual handshake messages including HRR
+void msg_callback(int write_p, int version, int content_type,
+                  const void *buf, size_t len, SSL *ssl, void *arg) {
+  tls_sim_ctx *sim = sim_of(ssl);
+  // Only process handshake messages (content_type 22)
+  if (!sim || content_type != SSL3_RT_HANDSHAKE || len < 1)
+    return;
+
+  const char *side = "system";
+  if (ssl_side_ex_data_idx >= 0) {
+    side = (const char *)SSL_get_ex_data(ssl, ssl_side_ex_data_idx);
+    if (!side)
+      side = "system";
+  }
+
+  unsigned char msg_type = ((const unsigned char *)buf)[0];
+
+  // Exact per-message size accounting (decrypted, header included), part of
+  // the record view. Only the sender reports each message so totals are not
+  // double counted.
+  if (write_p && EV_ON(sim, TLS_SIM_EV_RECORD)) {
+    const unsigned char *b = (const unsigned char *)buf;
+    const char *name = handshake_type_name(msg_type);
+    if (msg_type == SSL3_MT_SERVER_HELLO && len >= 38 &&
+        memcmp(b + 6, hrr_random, sizeof(hrr_random)) == 0)
+      name = "HelloRetryRequest";
+    char details[96];
+    char fields[96];
+    snprintf(details, sizeof(details), "%s sent (%zu B)", name, len);
+    snprintf(fields, sizeof(fields), "\"message\":{\"type\":%d,\"length\":%zu}",
+             msg_type, len);
+    log_event_fields(sim, side, "handshake_message", details, fields);
+  }
+
+  // Track ClientHello sends from the client side
+  // msg_type 1 = ClientHello, write_p = 1 means sending
+  if (msg_type == 1 && write_p && strcmp(side, "client") == 0) {
+    sim->client_hello_count++;
+    if (sim->client_hello_count == 1) {
+      if (EV_ON(sim, TLS_SIM_EV_MSG))
+        log_event(sim, "client", "handshake_msg", "ClientHello sent (initial)");
+    } else if (sim->client_hello_count == 2) {
+      sim->hrr_detected = 1;
+      log_event(sim, "client", "hello_retry",
+                "HelloRetryRequest: Server requested different key exchange "
+                "group. Client sending second ClientHello with updated "
+                "key_share. Handshake is now 2-RTT instead of 1-RTT.");
+    }
+  }
+
+  // Detect ServerHello (msg_type 2) received by client
+  // In TLS 1.3, HelloRetryRequest is a ServerHello with a special random
+  // OpenSSL state machine handles this internally; we detect it via the
+  // sim->client_hello_count (if a second ClientHello follows, HRR happened)
+  if (msg_type == 2 && !write_p && strcmp(side, "client") == 0) {
+    if (sim->client_hello_count == 1 && !sim->hrr_detected &&
+        EV_ON(sim, TLS_SIM_EV_MSG)) {
+      // First ServerHello — could be HRR or real ServerHello
+      // We'll know after the next message (if client sends another CH)
+      log_event(sim, "client", "handshake_msg", "ServerHello received");
+    }
+  }
+
+  // CertificateVerify (msg_type 15) sent by server — when HSM mode is active
+  // the private key lives in softhsmv3 and pkcs11-provider routes sign through
+  // C_SignInit + C_Sign.  We synthesise those log events here so the PKCS#11
+  // log panel shows the sign operation that happened in the HSM.
+  if (msg_type == 15 && write_p && strcmp(side, "server") == 0 &&
+      sim->hsm_mode) {
+    log_event(sim, "server", "pkcs11_call",
+              "C_SignInit(CKM_ML_DSA) — CertificateVerify: ML-DSA sign over TLS transcript hash");
+    char sig_msg[128];
+    snprintf(sig_msg, sizeof(sig_msg),
+             "C_Sign → ML-DSA signature (%zu B) over TLS 1.3 transcript hash (private key never exposed)",
+             len);
+    log_event(sim, "server", "pkcs11_call", sig_msg);
+    log_event(sim, "server", "pkcs11_call",
+              "CertificateVerify routed through pkcs11-provider → softhsmv3");
+  }
+}
+
+/* ── Per-phase handshake timing ────────────────────────────────────────────
+ * Both peers run on one thread, so wall time between two state transitions of
+ * one side includes the other side's work. Time is therefore only counted
+ * while a side is inside SSL_do_handshake: phase_enter() starts the clock,
+ * each SSL_CB_LOOP transition charges the time since the last mark to the
+ * state being left (SSL_state_string_long still names it when the callback
+ * fires), and phase_leave() charges the remainder when the call returns.
+ * Enabled trace categories run inside the same calls and are included. */
+
+static phase_timer *phase_for(tls_sim_ctx *sim, const char *side) {
+  return strcmp(side, "client") == 0 ? &sim->phase[0] : &sim->phase[1];
+}
+
+static void phase_charge(phase_timer *pt, const char *state, double now) {
+  double ms = now - pt->mark;
+  pt->mark = now;
+  pt->total += ms;
+  for (int i = 0; i < pt->n; i++) {
+    if (pt->slot[i].state == state || strcmp(pt->slot[i].state, state) == 0) {
+      pt->slot[i].ms += ms;
+      return;
+    }
+  }
+  if (pt->n < PHASE_MAX) {
+    pt->slot[pt->n].state = state;
+    pt->slot[pt->n++].ms = ms;
+  } else {
+    pt->slot[PHASE_MAX - 1].ms += ms; // unreachable for TLS 1.3 in practice
+  }
+}
+
+static void phase_enter(tls_sim_ctx *sim, phase_timer *pt) {
+  if (EV_ON(sim, TLS_SIM_EV_TIMING))
+    pt->mark = now_ms();
+}
+
+static void phase_leave(tls_sim_ctx *sim, phase_timer *pt, const SSL *ssl) {
+  if (EV_ON(sim, TLS_SIM_EV_TIMING))
+    phase_charge(pt, SSL_state_string_long(ssl), now_ms());
+}
+
+// handshake_timing: totals in the details, per-state breakdown as "timing".
+static void log_phase_timing(tls_sim_ctx *sim) {
+  if (!EV_ON(sim, TLS_SIM_EV_TIMING))
+    return;
+  static const char *const sides[2] = {"client", "server"};
+  char fields[4096];
+  size_t off = (size_t)snprintf(fields, sizeof(fields), "\"timing\":{");
+  const phase_slot *slowest = NULL;
+  int slowest_side = 0;
+  for (int s = 0; s < 2; s++) {
+    const phase_timer *pt = &sim->phase[s];
+    off += (size_t)snprintf(fields + off, sizeof(fields) - off,
+                            "%s\"%s\":{\"total_us\":%.0f,\"phases\":[",
+                            s ? "," : "", sides[s], pt->total * 1000.0);
+    for (int i = 0; i < pt->n && off < sizeof(fields); i++) {
+      off += (size_t)snprintf(fields + off, sizeof(fields) - off,
+                              "%s{\"state\":\"%s\",\"us\":%.0f}", i ? "," : "",
+                              pt->slot[i].state, pt->slot[i].ms * 1000.0);
+      if (!slowest || pt->slot[i].ms > slowest->ms) {
+        slowest = &pt->slot[i];
+        slowest_side = s;
+      }
+    }
+    if (off < sizeof(fields))
+      off += (size_t)snprintf(fields + off, sizeof(fields) - off, "]}");
+  }
+  if (off + 2 > sizeof(fields))
+    return; // can't happen with PHASE_MAX states, but never emit broken JSON
+  fields[off++] = '}';
+  fields[off] = 0;
+
+  char details[256];
+  snprintf(details, sizeof(details),
+           "In SSL_do_handshake: client %.3f ms, server %.3f ms; slowest phase: "
+           "%s %s (%.3f ms)",
+           sim->phase[0].total, sim->phase[1].total, sides[slowest_side],
+           slowest ? slowest->state : "none", slowest ? slowest->ms : 0.0);
+  log_event_fields(sim, "connection", "handshake_timing", details, fields);
+}
+
+// INFO CALLBACK - logs TLS handshake state transitions
+void info_callback(const SSL *ssl, int where, int ret) {
+  tls_sim_ctx *sim = sim_of(ssl);
+  if (!sim)
+    return;
+  const char *side = "system";
+  if (ssl_side_ex_data_idx >= 0) {
+    side = (const char *)SSL_get_ex_data(ssl, ssl_side_ex_data_idx);
+    if (!side)
+      side = "system";
+  }
+
+  // Log handshake lifecycle events
+  if ((where & SSL_CB_HANDSHAKE_START) && EV_ON(sim, TLS_SIM_EV_STATE)) {
+    log_event(sim, side, "handshake_start", "TLS handshake initiated");
+  }
+  if ((where & SSL_CB_HANDSHAKE_DONE) && EV_ON(sim, TLS_SIM_EV_STATE)) {
+    log_event(sim, side, "handshake_done", "TLS handshake completed");
+  }
+
+  // The state being left has finished its work: charge it
+  if ((where & SSL_CB_LOOP) && EV_ON(sim, TLS_SIM_EV_TIMING))
+    phase_charge(phase_for(sim, side), SSL_state_string_long(ssl), now_ms());
+
+  // Log specific TLS 1.3 state transitions
+  if ((where & SSL_CB_LOOP) && EV_ON(sim, TLS_SIM_EV_STATE)) {
+    const char *state = SSL_state_string_long(ssl);
+    if (state && strlen(state) > 0) {
+      log_event(sim, side, "handshake_state", state);
+    }
+  }
+
+  // Log alerts
+  if (where & SSL_CB_ALERT) {
+    char msg[256];
+    const char *alert_type = (where & SSL_CB_READ) ? "received" : "sending";
+    snprintf(msg, sizeof(msg), "Alert %s: %s %s", alert_type,
+             SSL_alert_type_string_long(ret), SSL_alert_desc_string_long(ret));
+    log_event(sim, side, "alert", msg);
+  }
+}
+
+/* ── Wire capture ──────────────────────────────────────────────────────────
+ * How much of each wire read is logged as a wire_data hex dump:
+ *   NONE — nothing (no formatting cost at all)
+ *   HEAD — the first `head_bytes` of each read, then "... (N bytes)"
+ *   FULL — every byte, so complete ML-KEM key shares and ML-DSA certificate
+ *          flights are visible */
+
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_set_wire_capture(int mode, size_t head_bytes) {
+  tls_sim_ctx *sim = default_sim();
+  if (mode < WIRE_CAPTURE_NONE || mode > WIRE_CAPTURE_FULL)
+    mode = WIRE_CAPTURE_HEAD;
+  sim->wire_capture = mode;
+  sim->wire_head_bytes = head_bytes ? head_bytes : 1024;
+}
+
+// Uppercase "XX " per byte (the format the UI's wire view parses); returns
+// bytes written, always 3n.
+static size_t hex_encode_spaced(char *dst, const unsigned char *src, size_t n) {
+  static const char digits[] = "0123456789ABCDEF";
+  char *d = dst;
+  for (size_t i = 0; i < n; i++) {
+    d[0] = digits[src[i] >> 4];
+    d[1] = digits[src[i] & 0x0F];
+    d[2] = ' ';
+    d += 3;
+  }
+  return (size_t)(d - dst);
+}
+
+static void log_wire_data(tls_sim_ctx *sim, const char *sender,
+                          const unsigned char *buf, size_t len) {
+  size_t limit = len;
+  if (sim->wire_capture == WIRE_CAPTURE_HEAD && limit > sim->wire_head_bytes)
+    limit = sim->wire_head_bytes;
+
+  event_writer w;
+  if (ev_begin(sim, &w, sender, "wire_data", limit * 3 + 32, 0) != 0)
+    return;
+  w.p += hex_encode_spaced(w.p, buf, limit);
+  if (len > limit)
+    w.p += sprintf(w.p, "... (%zu bytes)", len);
+  ev_end(sim, &w, NULL);
+}
+
+/* ── Transport ─────────────────────────────────────────────────────────────
+ * Both SSL objects read and write memory BIOs; pump_flash_drive() moves what
+ * one side wrote to the other side's read BIO, tapping it on the way for the
+ * wire view and the record parser. The transport decides how the bytes
+ * cross: straight from BIO to BIO (memory, the default and the only choice
+ * under Emscripten), or, on native Linux, through a connected socket pair
+ * (AF_UNIX or loopback TCP). Over sockets the handshake latency includes the
+ * send/recv syscalls and socket buffering, and over TCP also Nagle and the
+ * segmentation of large flights. Sockets are non-blocking and driven with
+ * poll(); a carry returns once every byte sent has reached the peer's end. */
+#define TRANSPORT_POLL_MS 1000
+
+typedef struct {
+  int kind;     // TLS_SIM_TRANSPORT_*
+  int fd[2];    // client end, server end; -1 for memory
+  BIO *rbio[2]; // client and server read BIOs, where carried bytes land
+  size_t sends; // send()/recv() calls; more recvs than sends = segmentation
+  size_t recvs;
+  size_t bytes;
+  int failed;
+} sim_transport;
+
+static const char *transport_name(int kind) {
+  switch (kind) {
+  case TLS_SIM_TRANSPORT_SOCKETPAIR:
+    return "socketpair";
+  case TLS_SIM_TRANSPORT_TCP:
+    return "tcp";
+  }
+  return "memory";
+}
+
+// Carry the wire bytes over `kind`; returns -1, leaving the setting alone,
+// for a socket transport in a build without them.
+EMSCRIPTEN_KEEPALIVE
+int tls_simulation_set_transport(int kind) {
+#ifdef TLS_SIM_SOCKETS
+  if (kind < TLS_SIM_TRANSPORT_MEM || kind > TLS_SIM_TRANSPORT_TCP)
+    return -1;
+#else
+  if (kind != TLS_SIM_TRANSPORT_MEM)
+    return -1;
+#endif
+  default_sim()->transport = kind;
+  return 0;
+}
+
+#ifdef TLS_SIM_SOCKETS
+// A connected loopback TCP pair: fd[0] the client end, fd[1] the server's.
+static int tcp_loopback_pair(int fd[2]) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  fd[0] = fd[1] = -1;
+  int lfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (lfd >= 0 && bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+      listen(lfd, 1) == 0 &&
+      getsockname(lfd, (struct sockaddr *)&addr, &len) == 0 &&
+      (fd[0] = socket(AF_INET, SOCK_STREAM, 0)) >= 0 &&
+      connect(fd[0], (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    fd[1] = accept(lfd, NULL, NULL);
+  if (lfd >= 0)
+    close(lfd);
+  if (fd[1] < 0) {
+    if (fd[0] >= 0)
+      close(fd[0]);
+    fd[0] = -1;
+    return -1;
+  }
+  return 0;
+}
+
+static void set_blocking(int fd, int blocking) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags >= 0)
+    fcntl(fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+}
+
+#endif
+
+static int transport_open(sim_transport *t, int kind, BIO *c_rbio,
+                          BIO *s_rbio) {
+  memset(t, 0, sizeof(*t));
+  t->kind = kind;
+  t->fd[0] = t->fd[1] = -1;
+  t->rbio[0] = c_rbio;
+  t->rbio[1] = s_rbio;
+#ifdef TLS_SIM_SOCKETS
+  if (kind == TLS_SIM_TRANSPORT_SOCKETPAIR &&
+      socketpair(AF_UNIX, SOCK_STREAM, 0, t->fd) != 0) {
+    t->fd[0] = t->fd[1] = -1;
+    return -1;
+  }
+  if (kind == TLS_SIM_TRANSPORT_TCP && tcp_loopback_pair(t->fd) != 0)
+    return -1;
+  for (int side = 0; side < 2; side++)
+    if (t->fd[side] >= 0)
+      set_blocking(t->fd[side], 0);
+#endif
+  return 0;
+}
+
+static void transport_close(sim_transport *t) {
+#ifdef TLS_SIM_SOCKETS
+  for (int side = 0; side < 2; side++) {
+    if (t->fd[side] < 0)
+      continue;
+    if (t->kind == TLS_SIM_TRANSPORT_TCP) {
+      // Reset rather than linger in TIME_WAIT: a benchmark opens a
+      // connection per handshake and would run out of ephemeral ports
+      struct linger lg = {1, 0};
+      setsockopt(t->fd[side], SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(t->fd[side]);
+    t->fd[side] = -1;
+  }
+#endif
+}
+
+// Deliver `n` bytes to the read BIO `to`; a NULL transport is memory.
+static int transport_carry(sim_transport *t, const char *buf, size_t n,
+                           BIO *to) {
+  if (!t || t->kind == TLS_SIM_TRANSPORT_MEM) {
+    BIO_write(to, buf, (int)n);
+    return 0;
+  }
+#ifdef TLS_SIM_SOCKETS
+  int dst = to == t->rbio[1]; // end that receives
+  int wfd = t->fd[!dst], rfd = t->fd[dst];
+  char in[16384];
+  size_t sent = 0, got = 0;
+  while (got < n) {
+    struct pollfd pfd[2] = {{wfd, sent < n ? POLLOUT : 0, 0},
+                            {rfd, POLLIN, 0}};
+    if (poll(pfd, 2, TRANSPORT_POLL_MS) <= 0 ||
+        ((pfd[0].revents | pfd[1].revents) & (POLLERR | POLLNVAL)))
+      break;
+    if (pfd[0].revents & POLLOUT) {
+      ssize_t w = send(wfd, buf + sent, n - sent, MSG_NOSIGNAL);
+      if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        break;
+      if (w > 0) {
+        sent += (size_t)w;
+        t->sends++;
+      }
+    }
+    if (pfd[1].revents & (POLLIN | POLLHUP)) {
+      ssize_t r = recv(rfd, in, sizeof(in), 0);
+      if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        break;
+      if (r > 0) {
+        BIO_write(to, in, (int)r);
+        got += (size_t)r;
+        t->recvs++;
+      }
+    }
+  }
+  t->bytes += got;
+  if (got == n)
+    return 0;
+#endif
+  t->failed = 1;
+  return -1;
+}
+
+// Syscall counts of a socket transport after the handshake.
+static void log_transport(tls_sim_ctx *sim, const sim_transport *t) {
+  if (t->kind == TLS_SIM_TRANSPORT_MEM)
+    return;
+  char details[160];
+  snprintf(details, sizeof(details),
+           "%s: %zu B in %zu sends, %zu recvs",
+           t->kind == TLS_SIM_TRANSPORT_TCP ? "Loopback TCP" : "socketpair",
+           t->bytes, t->sends, t->recvs);
+  char fields[160];
+  snprintf(fields, sizeof(fields),
+           "\"transport\":{\"kind\":\"%s\",\"bytes\":%zu,\"sends\":%zu,"
+           "\"recvs\":%zu}",
+           transport_name(t->kind), t->bytes, t->sends, t->recvs);
+  log_event_fields(sim, "connection", "transport", details, fields);
+}
+
+// Helper to pump data between BIOs and log wire format
+int pump_flash_drive(tls_sim_ctx *sim, sim_transport *link, BIO *from, BIO *to,
+                     const char *sender) {
+  char buf[16384];
+  int total = 0;
+  int pending = BIO_pending(from);
+  int capture =
+      EV_ON(sim, TLS_SIM_EV_WIRE) && sim->wire_capture != WIRE_CAPTURE_NONE;
+  int records = EV_ON(sim, TLS_SIM_EV_RECORD);
+
+  while (pending > 0) {
+    int read = BIO_read(from, buf, sizeof(buf));
+    if (read <= 0)
+      break;
+
+    if (capture)
+      log_wire_data(sim, sender, (const unsigned char *)buf, (size_t)read);
+    if (records) {
+      size_t base = sim->capture_len;
+      if (capture_append(sim, (const unsigned char *)buf, (size_t)read) == 0)
+        record_feed(sim, sender, (const unsigned char *)buf, (size_t)read,
+                    base);
+    }
+
+    if (link && link->failed)
+      break; // already reported; the connection is lost
+    if (transport_carry(link, buf, (size_t)read, to) != 0) {
+      log_event(sim, sender, "error", "Transport failed: bytes not delivered");
+      break;
+    }
+    total += read;
+    pending = BIO_pending(from);
+  }
+  return total;
+}
+
+/* ── Flight accounting ─────────────────────────────────────────────────────
+ * A flight is what one side puts on the wire before its peer's next turn:
+ * one pump_flash_drive() call in the handshake loop. With record events on,
+ * each flight is logged with its bytes, TLS records and TCP segments at the
+ * configured MSS. It is also checked against the sender's congestion window,
+ * which starts at initcwnd segments (RFC 6928: 10) and, as in slow start,
+ * grows by every segment the peer has acknowledged. A flight beyond the
+ * window waits for ACKs: one extra round trip per doubling. The
+ * flight_summary after the handshake singles out the server's largest
+ * flight, where the certificate chain meets the initial window. */
+#define FLIGHT_MSS_DEFAULT 1460
+#define FLIGHT_INITCWND_DEFAULT 10
+
+// MSS and initial window (segments) for flight accounting; 0 keeps the
+// default (1460 B, 10 segments).
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_set_flight_params(unsigned int mss,
+                                      unsigned int initcwnd) {
+  tls_sim_ctx *sim = default_sim();
+  sim->flight.mss = mss ? mss : FLIGHT_MSS_DEFAULT;
+  sim->flight.initcwnd = initcwnd ? initcwnd : FLIGHT_INITCWND_DEFAULT;
+}
+
+static size_t flight_segments(const flight_log *fl, size_t bytes) {
+  return (bytes + fl->mss - 1) / fl->mss;
+}
+
+// Round trips beyond the first that `segments` need from a `cwnd` window
+// doubling every round trip.
+static int flight_extra_rtts(size_t segments, size_t cwnd) {
+  int rtts = 0;
+  for (size_t sent = cwnd; sent < segments; sent += cwnd)
+    cwnd *= 2, rtts++;
+  return rtts;
+}
+
+static void flight_reset(flight_log *fl) {
+  memset(&fl->run, 0, sizeof(fl->run));
+  fl->run.cwnd[0] = fl->run.cwnd[1] = fl->initcwnd;
+}
+
+static void flight_record(tls_sim_ctx *sim, int side, size_t bytes,
+                          unsigned long records) {
+  flight_log *fl = &sim->flight;
+  if (bytes == 0 || !EV_ON(sim, TLS_SIM_EV_RECORD))
+    return;
+  size_t segments = flight_segments(fl, bytes);
+  size_t cwnd = fl->run.cwnd[side];
+  int extra = flight_extra_rtts(segments, cwnd);
+  int seq = ++fl->run.flights[side];
+  fl->run.count++;
+  fl->run.bytes[side] += bytes;
+  fl->run.segments[side] += segments;
+  fl->run.cwnd[side] += segments;
+  if (extra) {
+    fl->run.over++;
+    fl->run.extra_rtts += extra;
+  }
+  if (side == 1 && bytes > fl->run.server_flight.bytes) {
+    fl->run.server_flight.bytes = bytes;
+    fl->run.server_flight.records = records;
+    fl->run.server_flight.segments = segments;
+    fl->run.server_flight.cwnd = cwnd;
+    fl->run.server_flight.extra_rtts = extra;
+  }
+
+  const char *from = side ? "server" : "client";
+  char details[192];
+  int n = snprintf(details, sizeof(details),
+                   "%s flight %d: %zu B in %lu records, %zu segments (cwnd "
+                   "%zu)",
+                   side ? "Server" : "Client", seq, bytes, records, segments,
+                   cwnd);
+  if (extra && n > 0 && (size_t)n < sizeof(details))
+    snprintf(details + n, sizeof(details) - (size_t)n,
+             ": exceeds the window, +%d RTT", extra);
+  char fields[EV_FIELDS_MAX];
+  snprintf(fields, sizeof(fields),
+           "\"flight\":{\"n\":%d,\"from\":\"%s\",\"seq\":%d,\"bytes\":%zu,"
+           "\"records\":%lu,\"segments\":%zu,\"cwnd\":%zu,\"over_cwnd\":%s,"
+           "\"extra_rtts\":%d}",
+           fl->run.count, from, seq, bytes, records, segments, cwnd,
+           extra ? "true" : "false", extra);
+  log_event_fields(sim, from, "flight", details, fields);
+}
+
+// Pump one handshake flight and account for it.
+static int pump_flight(tls_sim_ctx *sim, sim_transport *link, BIO *from,
+                       BIO *to, int side) {
+  unsigned long records = sim->rec[side].records;
+  int n = pump_flash_drive(sim, link, from, to, side ? "server" : "client");
+  if (n > 0)
+    flight_record(sim, side, (size_t)n, sim->rec[side].records - records);
+  return n;
+}
+
+static void log_flight_summary(tls_sim_ctx *sim) {
+  const flight_log *fl = &sim->flight;
+  if (!EV_ON(sim, TLS_SIM_EV_RECORD) || fl->run.count == 0)
+    return;
+  const flight_stat *sf = &fl->run.server_flight;
+  char details[256];
+  snprintf(details, sizeof(details),
+           "%d flights; server certificate flight %zu B = %zu segments of "
+           "%u B vs cwnd %zu: %s",
+           fl->run.count, sf->bytes, sf->segments, fl->mss, sf->cwnd,
+           sf->extra_rtts ? "exceeds it" : "fits");
+  char fields[EV_FIELDS_MAX * 2];
+  snprintf(fields, sizeof(fields),
+           "\"flights\":{\"mss\":%u,\"initcwnd\":%u,\"count\":%d,"
+           "\"client\":{\"flights\":%d,\"bytes\":%zu,\"segments\":%zu},"
+           "\"server\":{\"flights\":%d,\"bytes\":%zu,\"segments\":%zu},"
+           "\"over_cwnd\":%d,\"extra_rtts\":%d,"
+           "\"server_flight\":{\"bytes\":%zu,\"records\":%lu,"
+           "\"segments\":%zu,\"cwnd\":%zu,\"over_initcwnd\":%s,"
+           "\"extra_rtts\":%d}}",
+           fl->mss, fl->initcwnd, fl->run.count, fl->run.flights[0],
+           fl->run.bytes[0], fl->run.segments[0], fl->run.flights[1],
+           fl->run.bytes[1], fl->run.segments[1], fl->run.over,
+           fl->run.extra_rtts, sf->bytes, sf->records, sf->segments, sf->cwnd,
+           sf->extra_rtts ? "true" : "false", sf->extra_rtts);
+  log_event_fields(sim, "connection", "flight_summary", details, fields);
+}
+
+/* ── Credential files ──────────────────────────────────────────────────────
+ * Certs and keys are picked up by fixed name from the credential directory:
+ * "/ssl" in the WASM build, where the worker registers them as in-memory
+ * inputs (or writes them, with older workers), and any real directory for
+ * native builds (tls_sim_cli -d). The HSM module keeps using
+ * /ssl, as HSM mode only exists under Emscripten. */
+
+static const cred_paths default_cred = {
+    "/ssl/client.crt", "/ssl/client.key", "/ssl/client-ca.crt",
+    "/ssl/server.crt", "/ssl/server.key", "/ssl/server-ca.crt"};
+
+// Point the credential lookups at `dir`; returns -1 (and changes nothing)
+// if a resulting path would not fit.
+EMSCRIPTEN_KEEPALIVE
+int tls_simulation_set_cred_dir(const char *dir) {
+  tls_sim_ctx *sim = default_sim();
+  static const char *const names[] = {"client.crt", "client.key",
+                                      "client-ca.crt", "server.crt",
+                                      "server.key", "server-ca.crt"};
+  cred_paths next;
+  char *fields[] = {next.client_crt, next.client_key, next.client_ca,
+                    next.server_crt, next.server_key, next.server_ca};
+  size_t len = strlen(dir);
+  while (len > 1 && dir[len - 1] == '/')
+    len--;
+  for (int i = 0; i < 6; i++) {
+    int n = snprintf(fields[i], CRED_PATH_MAX, "%.*s/%s", (int)len, dir,
+                     names[i]);
+    if (n < 0 || n >= CRED_PATH_MAX)
+      return -1;
+  }
+  sim->cred = next;
+  return 0;
+}
+
+/* ── Context lifecycle ─────────────────────────────────────────────────────
+ * Explicit contexts for callers that run several simulations at once, and
+ * the default context behind the tls_simulation_* / execute_tls_* API. */
+
+static void sim_init(tls_sim_ctx *sim) {
+  memset(sim, 0, sizeof(*sim));
+  sim->event_mask = TLS_SIM_EV_ALL;
+  sim->current_side = "system";
+  sim->sink.fd = -1;
+  sim->sink.retain = 1;
+  sim->sink.batch_bytes = SINK_BATCH_DEFAULT;
+  sim->wire_capture = WIRE_CAPTURE_HEAD;
+  sim->wire_head_bytes = 1024;
+  sim->resume_mode = TLS_SIM_RESUME_OFF;
+  sim->transport = TLS_SIM_TRANSPORT_MEM;
+  sim->flight.mss = FLIGHT_MSS_DEFAULT;
+  sim->flight.initcwnd = FLIGHT_INITCWND_DEFAULT;
+  sim->cred = default_cred;
+}
+
+// The context behind the single-instance tls_simulation_* / execute_tls_*
+// API.
+static tls_sim_ctx g_default_sim;
+static pthread_once_t default_sim_once = PTHREAD_ONCE_INIT;
+
+static void default_sim_init(void) { sim_init(&g_default_sim); }
+
+static tls_sim_ctx *default_sim(void) {
+  pthread_once(&default_sim_once, default_sim_init);
+  return &g_default_sim;
+}
+
+// A new context starts from the default context's settings (event mask, log
+// limit, wire capture, resumption, transport, credentials, HSM mode) but never shares
+// its event sink.
+EMSCRIPTEN_KEEPALIVE
+tls_sim_ctx *tls_sim_ctx_new(void) {
+  tls_sim_ctx *sim = malloc(sizeof(*sim));
+  if (!sim)
+    return NULL;
+  const tls_sim_ctx *def = default_sim();
+  sim_init(sim);
+  sim->event_mask = def->event_mask;
+  sim->log.limit = def->log.limit;
+  sim->wire_capture = def->wire_capture;
+  sim->wire_head_bytes = def->wire_head_bytes;
+  sim->resume_mode = def->resume_mode;
+  sim->transport = def->transport;
+  sim->flight.mss = def->flight.mss;
+  sim->flight.initcwnd = def->flight.initcwnd;
+  sim->hsm_mode = def->hsm_mode;
+  sim->cred = def->cred;
+  return sim;
+}
+
+#ifdef __EMSCRIPTEN__
+// HSM mode of the default context (see tls_simulation_hsm.c).
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_set_hsm_mode(int enabled) {
+  default_sim()->hsm_mode = enabled ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int tls_simulation_get_hsm_mode(void) { return default_sim()->hsm_mode; }
+#endif
+
+EMSCRIPTEN_KEEPALIVE
+void tls_sim_ctx_free(tls_sim_ctx *sim) {
+  if (!sim || sim == default_sim())
+    return;
+  trace_release(sim);
+  log_release(sim);
+  tls_sim_ctx_clear_inputs(sim);
+  free(sim->log.head);
+  free(sim->capture);
+  free(sim->setup_rec);
+  free(sim->matrix_result);
+  free(sim->bench_lat);
+  free(sim);
+}
+
+/* ── SSL_CTX cache ─────────────────────────────────────────────────────────
+ * Building the two contexts (NCONF parse, PEM decode of certs and keys, CA
+ * stores, HSM keygen) dominates a short classical handshake, and most runs
+ * repeat the previous configuration. Configured contexts are kept in a small
+ * LRU keyed on an FNV-1a hash of everything they are built from: both config
+ * files, the credential files, the VerifyCAFile each config names
+ * and the HSM mode. Settings that vary per run (msg/info callbacks) are
+ * applied to the SSL objects; the keylog callback is installed at build time
+ * and checks the running context's mask. A cached context is never written
+ * to after it is built, since other threads may be using it. */
+#define CTX_CACHE_SLOTS 4
+
+typedef struct {
+  uint64_t key;
+  unsigned long last_used; // 0 = empty slot
+  SSL_CTX *c_ctx;
+  SSL_CTX *s_ctx;
+  char *setup_events; // recorded log_event() triples, replayed on a hit
+  size_t setup_len;
+} ctx_cache_entry;
+
+static ctx_cache_entry g_ctx_cache[CTX_CACHE_SLOTS];
+static unsigned long g_ctx_cache_tick;
+static int g_ctx_cache_enabled = 1;
+// Contexts running on several threads share the cache; builds run unlocked.
+static pthread_mutex_t g_ctx_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t hash_contents(uint64_t h, const char *path, const char *data,
+                              size_t len) {
+  size_t n = data ? len : (size_t)-1; // a missing file differs from an empty one
+  h = fnv1a(h, path, strlen(path) + 1);
+  h = fnv1a(h, &n, sizeof(n));
+  return data ? fnv1a(h, data, len) : h;
+}
+
+static uint64_t hash_file(tls_sim_ctx *sim, uint64_t h, const char *path) {
+  input_buf in;
+  if (input_open(sim, path, &in) != 0)
+    return hash_contents(h, path, NULL, 0);
+  h = hash_contents(h, path, in.data, in.len);
+  input_close(&in);
+  return h;
+}
+
+// A config file plus the CA file apply_config() loads for it, resolved the
+// same way (NCONF, so comments, sections and $var expansion all agree).
+static uint64_t hash_config(tls_sim_ctx *sim, uint64_t h, const char *path) {
+  if (!path)
+    return fnv1a(h, "", 1);
+  input_buf in;
+  if (input_open(sim, path, &in) != 0)
+    return hash_contents(h, path, NULL, 0);
+  h = hash_contents(h, path, in.data, in.len);
+  ERR_set_mark(); // a missing key queues an error the run must not see
+  CONF *conf = config_parse(&in);
+  input_close(&in);
+  const char *ca =
+      conf ? NCONF_get_string(conf, CONFIG_SECTION, "VerifyCAFile") : NULL;
+  if (ca)
+    h = hash_file(sim, h, ca);
+  NCONF_free(conf);
+  ERR_pop_to_mark();
+  return h;
+}
+
+static uint64_t ctx_cache_key(tls_sim_ctx *sim, const char *client_conf_path,
+                              const char *server_conf_path) {
+  const char *const cred_files[] = {
+      sim->cred.client_crt, sim->cred.client_key, sim->cred.client_ca,
+      sim->cred.server_crt, sim->cred.server_key, sim->cred.server_ca};
+  uint64_t h = FNV64_OFFSET;
+  h = hash_config(sim, h, client_conf_path);
+  h = hash_config(sim, h, server_conf_path);
+  for (size_t i = 0; i < sizeof(cred_files) / sizeof(cred_files[0]); i++)
+    h = hash_file(sim, h, cred_files[i]);
+  int hsm = sim->hsm_mode;
+  return fnv1a(h, &hsm, sizeof(hsm));
+}
+
+static ctx_cache_entry *ctx_cache_lookup(uint64_t key) {
+  for (int i = 0; i < CTX_CACHE_SLOTS; i++) {
+    ctx_cache_entry *e = &g_ctx_cache[i];
+    if (e->last_used && e->key == key) {
+      e->last_used = ++g_ctx_cache_tick;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void ctx_cache_evict(ctx_cache_entry *e) {
+  SSL_CTX_free(e->c_ctx);
+  SSL_CTX_free(e->s_ctx);
+  free(e->setup_events);
+  memset(e, 0, sizeof(*e));
+}
+
+// Keep a reference to freshly built contexts together with the events that
+// were logged while building them.
+static void ctx_cache_store(tls_sim_ctx *sim, uint64_t key, SSL_CTX *c_ctx,
+                            SSL_CTX *s_ctx) {
+  if (sim->setup_rec_failed)
+    return;
+  ctx_cache_entry *victim = &g_ctx_cache[0];
+  for (int i = 1; i < CTX_CACHE_SLOTS && victim->last_used; i++)
+    if (g_ctx_cache[i].last_used < victim->last_used)
+      victim = &g_ctx_cache[i];
+  if (victim->last_used)
+    ctx_cache_evict(victim);
+
+  char *events = malloc(sim->setup_rec_len ? sim->setup_rec_len : 1);
+  if (!events)
+    return;
+  memcpy(events, sim->setup_rec, sim->setup_rec_len);
+  SSL_CTX_up_ref(c_ctx);
+  SSL_CTX_up_ref(s_ctx);
+  victim->key = key;
+  victim->last_used = ++g_ctx_cache_tick;
+  victim->c_ctx = c_ctx;
+  victim->s_ctx = s_ctx;
+  victim->setup_events = events;
+  victim->setup_len = sim->setup_rec_len;
+}
+
+static void ctx_cache_replay(tls_sim_ctx *sim, const ctx_cache_entry *e) {
+  const char *p = e->setup_events;
+  const char *end = p + e->setup_len;
+  while (p < end) {
+    const char *side = p;
+    const char *event = side + strlen(side) + 1;
+    const char *details = event + strlen(event) + 1;
+    log_event(sim, side, event, details);
+    p = details + strlen(details) + 1;
+  }
+}
+
+// Drop every cached context and parsed CA file (e.g. after the HSM token was
+// reset).
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_ctx_cache_flush(void) {
+  pthread_mutex_lock(&g_ctx_cache_lock);
+  for (int i = 0; i < CTX_CACHE_SLOTS; i++)
+    if (g_ctx_cache[i].last_used)
+      ctx_cache_evict(&g_ctx_cache[i]);
+  pthread_mutex_unlock(&g_ctx_cache_lock);
+  ca_cache_flush();
+}
+
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_set_ctx_cache(int enabled) {
+  g_ctx_cache_enabled = enabled != 0;
+  if (!g_ctx_cache_enabled)
+    tls_simulation_ctx_cache_flush();
+}
+
+// Build and configure the client and server contexts from the config files
+// and the credential directory.
+static int build_contexts(tls_sim_ctx *sim, const char *client_conf_path,
+                          const char *server_conf_path, SSL_CTX **c_out,
+                          SSL_CTX **s_out) {
+  // 1. Initialize Contexts
+  SSL_CTX *c_ctx = SSL_CTX_new(TLS_client_method());
+  SSL_CTX *s_ctx = SSL_CTX_new(TLS_server_method());
+  ca_files c_cas = {0}, s_cas = {0};
+
+  if (!c_ctx || !s_ctx) {
+    SSL_CTX_free(c_ctx);
+    SSL_CTX_free(s_ctx);
+    return -1;
+  }
+
+  SSL_CTX_set_keylog_callback(c_ctx, keylog_callback);
+  SSL_CTX_set_keylog_callback(s_ctx, keylog_callback);
+
+  // 2. Configure Client
+  SSL_CTX_set_min_proto_version(c_ctx, TLS1_3_VERSION);
+  SSL_CTX_set_max_proto_version(c_ctx, TLS1_3_VERSION);
+
+  if (client_conf_path)
+    apply_config(sim, c_ctx, &c_cas, client_conf_path, "client");
+
+  if (input_exists(sim, sim->cred.client_crt)) {
+    use_cert_input(sim, c_ctx, sim->cred.client_crt);
+    if (input_exists(sim, sim->cred.client_key))
+      use_key_input(sim, c_ctx, sim->cred.client_key);
+  }
+  // Load CA to verify server certificate
+  if (ca_cache_attach(sim, c_ctx, &c_cas, sim->cred.client_ca, 0, NULL,
+                      0) == 0)
+    SSL_CTX_set_verify(c_ctx, SSL_VERIFY_PEER, NULL);
+  log_event(sim, "client", "init", "Created TLS 1.3 Client Context");
+
+  // 3. Configure Server
+  SSL_CTX_set_min_proto_version(s_ctx, TLS1_3_VERSION);
+  SSL_CTX_set_max_proto_version(s_ctx, TLS1_3_VERSION);
+
+  if (server_conf_path)
+    apply_config(sim, s_ctx, &s_cas, server_conf_path, "server");
+
+  if (sim->hsm_mode) {
+    /* HSM mode: server private key is generated inside softhsmv3 and
+     * referenced via a pkcs11: URI loaded through pkcs11-provider. The PEM
+     * server.key on disk (if any) is intentionally ignored. */
+    if (hsm_setup_server_credentials(sim, s_ctx) != 0) {
+      log_event(sim, "server", "warning",
+                "HSM setup failed; falling back to PEM server cert/key");
+      if (input_exists(sim, sim->cred.server_crt))
+        use_cert_input(sim, s_ctx, sim->cred.server_crt);
+      if (input_exists(sim, sim->cred.server_key))
+        use_key_input(sim, s_ctx, sim->cred.server_key);
+    } else if (access("/ssl/hsm-server.crt", F_OK) == 0) {
+      /* HSM succeeded: the server cert is self-signed with ML-DSA-65.
+       * Add it to the client's trust store so the chain-of-trust check passes. */
+      ca_cache_attach(sim, c_ctx, &c_cas, "/ssl/hsm-server.crt", 0, NULL, 0);
+      SSL_CTX_set_verify(c_ctx, SSL_VERIFY_PEER, NULL);
+      log_event(sim, "client", "hsm_ca_loaded",
+                "HSM self-signed cert added to client trust store");
+    }
+  } else {
+    if (input_exists(sim, sim->cred.server_crt)) {
+      use_cert_input(sim, s_ctx, sim->cred.server_crt);
+    }
+    if (input_exists(sim, sim->cred.server_key)) {
+      use_key_input(sim, s_ctx, sim->cred.server_key);
+    }
+  }
+  // Load CA to verify client certificate (mTLS)
+  ca_cache_attach(sim, s_ctx, &s_cas, sim->cred.server_ca, 1, NULL, 0);
+  log_event(sim, "server", "init", "Created TLS 1.3 Server Context");
+
+  *c_out = c_ctx;
+  *s_out = s_ctx;
+  return 0;
+}
+
+// Client and server contexts, reused from the cache when nothing they are
+// built from has changed since an earlier run. With `trace`, a hit logs a
+// ctx_cache marker and replays the config-phase events of the original build.
+static int acquire_contexts(tls_sim_ctx *sim, const char *client_conf_path,
+                            const char *server_conf_path, SSL_CTX **c_ctx,
+                            SSL_CTX **s_ctx, int trace) {
+  uint64_t key = g_ctx_cache_enabled
+                     ? ctx_cache_key(sim, client_conf_path, server_conf_path)
+                     : 0;
+  pthread_mutex_lock(&g_ctx_cache_lock);
+  ctx_cache_entry *cached = g_ctx_cache_enabled ? ctx_cache_lookup(key) : NULL;
+  if (cached) {
+    *c_ctx = cached->c_ctx;
+    *s_ctx = cached->s_ctx;
+    SSL_CTX_up_ref(*c_ctx);
+    SSL_CTX_up_ref(*s_ctx);
+    if (trace) {
+      log_event(sim, "system", "ctx_cache",
+                "Reusing cached client/server contexts (configuration unchanged)");
+      ctx_cache_replay(sim, cached);
+    }
+    pthread_mutex_unlock(&g_ctx_cache_lock);
+    return 0;
+  }
+  pthread_mutex_unlock(&g_ctx_cache_lock);
+
+  sim->setup_rec_len = 0;
+  sim->setup_rec_failed = 0;
+  sim->setup_recording = g_ctx_cache_enabled;
+  int rc =
+      build_contexts(sim, client_conf_path, server_conf_path, c_ctx, s_ctx);
+  sim->setup_recording = 0;
+  if (rc != 0)
+    return -1;
+  pthread_mutex_lock(&g_ctx_cache_lock);
+  // Another thread may have built the same configuration meanwhile.
+  if (g_ctx_cache_enabled && !ctx_cache_lookup(key))
+    ctx_cache_store(sim, key, *c_ctx, *s_ctx);
+  pthread_mutex_unlock(&g_ctx_cache_lock);
+  return 0;
+}
+
+// The negotiated key exchange group (X25519, P-256, ML-KEM, Hybrid, etc.);
+// returns its NID, 0 when none was negotiated.
+static int negotiated_group_name(SSL *ssl, char *name, size_t len) {
+  int nid = SSL_get_negotiated_group(ssl);
+  // Use SSL_group_to_name (OpenSSL 3.x API) - works for PQC/Hybrid groups
+  const char *group = nid > 0 ? SSL_group_to_name(ssl, nid) : NULL;
+  if (group && group[0])
+    snprintf(name, len, "%s", group);
+  else
+    // Final fallback: raw NID (should rarely happen with SSL_group_to_name)
+    snprintf(name, len, "NID-%d", nid);
+  return nid > 0 ? nid : 0;
+}
+
+// The negotiated TLS 1.3 signature scheme as a human-readable name.
+static void signature_scheme_name(SSL *c_ssl, SSL *s_ssl, char *scheme,
+                                  size_t len) {
+  // SSL_get_peer_signature_nid() returns the HASH NID (e.g. NID_sha256=672),
+  // not the scheme.  We combine the hash NID with the key type NID and the
+  // peer cert pubkey type to reconstruct the full scheme name.
+  int hash_nid = 0, type_nid = 0;
+  SSL_get_peer_signature_nid(c_ssl, &hash_nid);
+  SSL_get_peer_signature_type_nid(c_ssl, &type_nid);
+
+  // Fallback: server's own sig nids
+  if (hash_nid == 0) SSL_get_signature_nid(s_ssl, &hash_nid);
+  if (type_nid == 0) SSL_get_signature_type_nid(s_ssl, &type_nid);
+
+  // Resolve peer public key type from the server cert (most reliable for PQC)
+  X509 *srv_cert = SSL_get_certificate(s_ssl); // non-owning
+  EVP_PKEY *srv_pkey = srv_cert ? X509_get0_pubkey(srv_cert) : NULL;
+  const char *pkey_type = srv_pkey ? EVP_PKEY_get0_type_name(srv_pkey) : NULL;
+
+  // Map hash NID → lowercase suffix
+  const char *hash_sfx = NULL;
+  if      (hash_nid == NID_sha224) hash_sfx = "sha224";
+  else if (hash_nid == NID_sha256) hash_sfx = "sha256";
+  else if (hash_nid == NID_sha384) hash_sfx = "sha384";
+  else if (hash_nid == NID_sha512) hash_sfx = "sha512";
+
+
+  // ML-DSA — pkey type name IS the algorithm, no hash suffix
+  if (pkey_type && (strstr(pkey_type, "ML-DSA") || strstr(pkey_type, "MLDSA"))) {
+    if      (strstr(pkey_type, "44")) snprintf(scheme, len, "mldsa44");
+    else if (strstr(pkey_type, "65")) snprintf(scheme, len, "mldsa65");
+    else if (strstr(pkey_type, "87")) snprintf(scheme, len, "mldsa87");
+    else snprintf(scheme, len, "%s", pkey_type);
+  }
+  // SLH-DSA — similarly no separate hash suffix in the scheme name
+  else if (pkey_type && strstr(pkey_type, "SLH-DSA")) {
+    snprintf(scheme, len, "%s", pkey_type);
+  }
+  // EdDSA — no hash suffix
+  else if (type_nid == EVP_PKEY_ED25519 ||
+           (pkey_type && strcmp(pkey_type, "ED25519") == 0)) {
+    snprintf(scheme, len, "ed25519");
+  }
+  else if (type_nid == EVP_PKEY_ED448 ||
+           (pkey_type && strcmp(pkey_type, "ED448") == 0)) {
+    snprintf(scheme, len, "ed448");
+  }
+  // RSA-PSS with an RSASSA-PSS key (the type NID alone can't tell these apart)
+  else if (pkey_type && strcmp(pkey_type, "RSA-PSS") == 0) {
+    if (hash_sfx)
+      snprintf(scheme, len, "rsa_pss_pss_%s", hash_sfx);
+    else
+      snprintf(scheme, len, "rsa_pss_pss_nid%d", hash_nid);
+  }
+  // RSA-PSS (TLS 1.3 always uses PSS for RSA)
+  else if (type_nid == EVP_PKEY_RSA_PSS ||
+           (pkey_type && strcmp(pkey_type, "RSA") == 0)) {
+    if (hash_sfx)
+      snprintf(scheme, len, "rsa_pss_rsae_%s", hash_sfx);
+    else
+      snprintf(scheme, len, "rsa_pss_rsae_nid%d", hash_nid);
+  }
+  // ECDSA — derive curve from key bits
+  else if (type_nid == EVP_PKEY_EC ||
+           (pkey_type && strcmp(pkey_type, "EC") == 0)) {
+    const char *curve = "secp256r1"; // default
+    if (srv_pkey) {
+      int bits = EVP_PKEY_get_bits(srv_pkey);
+      if (bits == 384) curve = "secp384r1";
+      else if (bits == 521) curve = "secp521r1";
+    }
+    if (hash_sfx)
+      snprintf(scheme, len, "ecdsa_%s_%s", curve, hash_sfx);
+    else
+      snprintf(scheme, len, "ecdsa_%s_nid%d", curve, hash_nid);
+  }
+  // Unknown — show type + hash NIDs
+  else {
+    snprintf(scheme, len, "type%d_hash%d", type_nid, hash_nid);
+  }
+}
+
+// A client/server SSL pair joined by memory BIOs and the context's
+// transport, with the side tags and the state/message callbacks attached.
+typedef struct {
+  SSL *c_ssl;
+  SSL *s_ssl;
+  BIO *c_wbio; // Client Writes -> Server Reads
+  BIO *c_rbio; // Client Reads <- Server Writes
+  BIO *s_wbio; // Server Writes -> Client Reads
+  BIO *s_rbio; // Server Reads <- Client Writes
+  sim_transport link;
+} sim_conn;
+
+// Returns -1 if the transport could not be set up; the SSL objects exist
+// either way, and sim_conn_close() releases everything.
+static int sim_conn_open(tls_sim_ctx *sim, sim_conn *conn, SSL_CTX *c_ctx,
+                         SSL_CTX *s_ctx) {
+  SSL *c_ssl = SSL_new(c_ctx);
+  SSL *s_ssl = SSL_new(s_ctx);
+
+  // Memory BIOs (Manual Pump to capture wire data)
+  BIO *c_wbio = BIO_new(BIO_s_mem());
+  BIO *c_rbio = BIO_new(BIO_s_mem());
+  BIO *s_wbio = BIO_new(BIO_s_mem());
+  BIO *s_rbio = BIO_new(BIO_s_mem());
+
+  SSL_set_bio(c_ssl, c_rbio, c_wbio);
+  SSL_set_bio(s_ssl, s_rbio, s_wbio);
+
+  BIO_set_mem_eof_return(c_rbio, -1);
+  BIO_set_mem_eof_return(s_rbio, -1);
+
+  // Initialize ex_data indices if not done
+  pthread_once(&ex_data_once, ex_data_init);
+
+  // Set side identifier and owning context on each SSL object
+  SSL_set_ex_data(c_ssl, ssl_side_ex_data_idx, (void *)"client");
+  SSL_set_ex_data(s_ssl, ssl_side_ex_data_idx, (void *)"server");
+  SSL_set_ex_data(c_ssl, ssl_sim_ex_data_idx, sim);
+  SSL_set_ex_data(s_ssl, ssl_sim_ex_data_idx, sim);
+
+  SSL_set_connect_state(c_ssl);
+  SSL_set_accept_state(s_ssl);
+
+  // Setup Info Callbacks for handshake state logging
+  SSL_set_info_callback(c_ssl, info_callback);
+  SSL_set_info_callback(s_ssl, info_callback);
+
+  // Setup Message Callback for HRR detection. Set on the SSL objects: SSL_new
+  // has already copied the (unset) context callback at this point.
+  SSL_set_msg_callback(c_ssl, msg_callback);
+  SSL_set_msg_callback(s_ssl, msg_callback);
+
+  conn->c_ssl = c_ssl;
+  conn->s_ssl = s_ssl;
+  conn->c_wbio = c_wbio;
+  conn->c_rbio = c_rbio;
+  conn->s_wbio = s_wbio;
+  conn->s_rbio = s_rbio;
+  return transport_open(&conn->link, sim->transport, c_rbio, s_rbio);
+}
+
+static void sim_conn_close(sim_conn *conn) {
+  SSL_free(conn->c_ssl);
+  SSL_free(conn->s_ssl);
+  transport_close(&conn->link);
+}
+
+/* ── Session resumption ────────────────────────────────────────────────────
+ * With a resumption mode set, the session from the first (full) handshake is
+ * resumed on a second connection over the same contexts, optionally sending
+ * the script's EARLY_DATA: lines as 0-RTT data, and the two handshakes are
+ * compared in a resumption_summary event. */
+
+// Wall time and wire bytes of one traced handshake.
+typedef struct {
+  double ms;
+  size_t c_bytes;
+  size_t s_bytes;
+} hs_cost;
+
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_set_resumption(int mode) {
+  tls_sim_ctx *sim = default_sim();
+  sim->resume_mode =
+      mode == TLS_SIM_RESUME_PSK_DHE || mode == TLS_SIM_RESUME_PSK
+          ? mode
+          : TLS_SIM_RESUME_OFF;
+}
+
+static void read_early_data(tls_sim_ctx *sim, const char *script_path,
+                            early_lines *e) {
+  e->len = 0;
+  e->count = 0;
+  input_buf in;
+  if (!script_path || input_open(sim, script_path, &in) != 0)
+    return;
+  BIO *f = BIO_new_mem_buf(in.data, (int)in.len);
+  char line[1024];
+  while (f && BIO_gets(f, line, sizeof(line)) > 0) {
+    line[strcspn(line, "\n")] = 0;
+    if (strncmp(line, "EARLY_DATA:", 11) != 0)
+      continue;
+    size_t n = strlen(line + 11) + 1;
+    if (n == 1 || e->len + n > sizeof(e->data))
+      continue;
+    memcpy(e->data + e->len, line + 11, n);
+    e->len += n;
+    e->count++;
+  }
+  BIO_free(f);
+  input_close(&in);
+}
+
+static void log_resume_error(tls_sim_ctx *sim, SSL *ssl, const char *side,
+                             int r) {
+  char ssl_err[256];
+  char msg[320];
+  ERR_error_string_n(ERR_get_error(), ssl_err, sizeof(ssl_err));
+  snprintf(msg, sizeof(msg), "Resumed handshake error: %d - %s",
+           SSL_get_error(ssl, r), ssl_err);
+  log_event(sim, side, "error", msg);
+}
+
+// Resume `sess` on a fresh connection; returns 0 once both sides finished,
+// -1 after logging the failure.
+static int resumed_handshake(tls_sim_ctx *sim, sim_conn *r, SSL_SESSION *sess,
+                             const early_lines *early, hs_cost *cost) {
+  SSL *c_ssl = r->c_ssl, *s_ssl = r->s_ssl;
+  SSL_set_session(c_ssl, sess);
+  if (sim->resume_mode == TLS_SIM_RESUME_PSK) {
+    // psk_ke: both peers allow a resumption without (EC)DHE; only servers
+    // with SSL_OP_PREFER_NO_DHE_KEX (OpenSSL 3.3+) pick it over psk_dhe_ke.
+    SSL_set_options(c_ssl, SSL_OP_ALLOW_NO_DHE_KEX);
+#ifdef SSL_OP_PREFER_NO_DHE_KEX
+    SSL_set_options(s_ssl, SSL_OP_ALLOW_NO_DHE_KEX | SSL_OP_PREFER_NO_DHE_KEX);
+#else
+    SSL_set_options(s_ssl, SSL_OP_ALLOW_NO_DHE_KEX);
+#endif
+  }
+
+  double start = now_ms();
+  int s_early = 0;
+  if (early->count > 0) {
+    if (SSL_SESSION_get_max_early_data(sess) == 0) {
+      log_event(sim, "connection", "early_data",
+                "Session ticket does not allow early data; sending none");
+    } else {
+      SSL_set_max_early_data(s_ssl, EARLY_DATA_MAX);
+      sim->current_side = "client";
+      for (const char *msg = early->data; msg < early->data + early->len;
+           msg += strlen(msg) + 1) {
+        char send_msg[1040];
+        snprintf(send_msg, sizeof(send_msg), "Sending: %.1013s", msg);
+        log_event(sim, "client", "early_data_sent", send_msg);
+        size_t written;
+        if (!SSL_write_early_data(c_ssl, msg, strlen(msg), &written)) {
+          log_resume_error(sim, c_ssl, "client", 0);
+          return -1;
+        }
+      }
+      s_early = 1;
+    }
+  }
+
+  for (int steps = 0; steps < 20; steps++) {
+    cost->c_bytes += (size_t)pump_flash_drive(sim, &r->link, r->c_wbio,
+                                              r->s_rbio, "client");
+    cost->s_bytes += (size_t)pump_flash_drive(sim, &r->link, r->s_wbio,
+                                              r->c_rbio, "server");
+    if (SSL_is_init_finished(c_ssl) && SSL_is_init_finished(s_ssl)) {
+      cost->ms = now_ms() - start;
+      return 0;
+    }
+
+    if (!SSL_is_init_finished(c_ssl)) {
+      sim->current_side = "client";
+      int ret = SSL_do_handshake(c_ssl);
+      if (ret <= 0 && SSL_get_error(c_ssl, ret) != SSL_ERROR_WANT_READ) {
+        log_resume_error(sim, c_ssl, "client", ret);
+        return -1;
+      }
+    }
+
+    sim->current_side = "server";
+    // The server reads 0-RTT data until EndOfEarlyData before it may
+    // continue with SSL_do_handshake.
+    while (s_early) {
+      char buf[1024];
+      size_t n = 0;
+      int st = SSL_read_early_data(s_ssl, buf, sizeof(buf) - 1, &n);
+      if (st == SSL_READ_EARLY_DATA_SUCCESS) {
+        buf[n] = 0;
+        char msg[1100];
+        snprintf(msg, sizeof(msg), "Received: %s", buf);
+        log_event(sim, "server", "early_data_received", msg);
+        continue;
+      }
+      if (st == SSL_READ_EARLY_DATA_FINISH)
+        s_early = 0;
+      else if (SSL_get_error(s_ssl, 0) != SSL_ERROR_WANT_READ) {
+        log_resume_error(sim, s_ssl, "server", 0);
+        return -1;
+      }
+      break;
+    }
+    if (!s_early && !SSL_is_init_finished(s_ssl)) {
+      int ret = SSL_do_handshake(s_ssl);
+      if (ret <= 0 && SSL_get_error(s_ssl, ret) != SSL_ERROR_WANT_READ) {
+        log_resume_error(sim, s_ssl, "server", ret);
+        return -1;
+      }
+    }
+  }
+  log_event(sim, "connection", "error",
+            "Resumed handshake not completed after max steps");
+  return -1;
+}
+
+// Run the resumption mode after the first connection: collect its session
+// (the NewSessionTicket may still sit unread in the client's BIO), resume it
+// and log both handshakes side by side. Returns -1 after logging a failure.
+static int run_resumption(tls_sim_ctx *sim, SSL_CTX *c_ctx, SSL_CTX *s_ctx,
+                          sim_conn *first, const hs_cost *full,
+                          const early_lines *early) {
+  if (!(SSL_get_shutdown(first->c_ssl) & SSL_RECEIVED_SHUTDOWN)) {
+    pump_flash_drive(sim, &first->link, first->s_wbio, first->c_rbio,
+                     "server");
+    process_reads(sim, first->c_ssl, "client");
+  }
+  SSL_SESSION *sess = SSL_get1_session(first->c_ssl);
+  if (!sess || !SSL_SESSION_is_resumable(sess)) {
+    SSL_SESSION_free(sess);
+    log_event(sim, "connection", "resumption",
+              "No resumable session: the server sent no NewSessionTicket");
+    return 0;
+  }
+
+  log_event(sim, "connection", "resumption_start",
+            sim->resume_mode == TLS_SIM_RESUME_PSK
+                ? "Resuming session on a new connection (psk_ke requested)"
+                : "Resuming session on a new connection (psk_dhe_ke)");
+  // The HRR tracker counts ClientHellos per connection
+  sim->client_hello_count = 0;
+  sim->hrr_detected = 0;
+
+  sim_conn r;
+  hs_cost resumed = {0, 0, 0};
+  int rc = -1;
+  if (sim_conn_open(sim, &r, c_ctx, s_ctx) != 0)
+    log_event(sim, "connection", "error", "Failed to open the transport");
+  else
+    rc = resumed_handshake(sim, &r, sess, early, &resumed);
+  SSL_SESSION_free(sess);
+  if (rc == 0) {
+    int reused = SSL_session_reused(r.c_ssl);
+    // A psk_ke server skips the key_share, leaving it without a group
+    const char *mode = !reused ? "full"
+                       : SSL_get_negotiated_group(r.s_ssl) > 0 ? "psk_dhe_ke"
+                                                               : "psk_ke";
+    const char *early_status = "not_sent";
+    switch (SSL_get_early_data_status(r.c_ssl)) {
+    case SSL_EARLY_DATA_ACCEPTED:
+      early_status = "accepted";
+      break;
+    case SSL_EARLY_DATA_REJECTED:
+      early_status = "rejected";
+      break;
+    }
+
+    char details[320];
+    snprintf(details, sizeof(details),
+             "%s in %.3f ms vs %.3f ms full; client %zu B vs %zu B, server "
+             "%zu B vs %zu B; early data %s",
+             reused ? (strcmp(mode, "psk_ke") == 0 ? "Resumed (psk_ke)"
+                                                   : "Resumed (psk_dhe_ke)")
+                    : "Session NOT resumed (full handshake)",
+             resumed.ms, full->ms, resumed.c_bytes, full->c_bytes,
+             resumed.s_bytes, full->s_bytes, early_status);
+    char fields[320];
+    snprintf(fields, sizeof(fields),
+             "\"resumption\":{\"mode\":\"%s\",\"resumed\":%s,"
+             "\"early_data\":\"%s\",\"full\":{\"ms\":%.3f,\"client_bytes\":%zu,"
+             "\"server_bytes\":%zu},\"resumed_handshake\":{\"ms\":%.3f,"
+             "\"client_bytes\":%zu,\"server_bytes\":%zu}}",
+             mode, reused ? "true" : "false", early_status, full->ms,
+             full->c_bytes, full->s_bytes, resumed.ms, resumed.c_bytes,
+             resumed.s_bytes);
+    log_event_fields(sim, "connection", "resumption_summary", details, fields);
+  }
+  sim_conn_close(&r);
+  return rc;
+}
+
+/* ── Bulk transfer ─────────────────────────────────────────────────────────
+ * CLIENT_SEND_BULK / SERVER_SEND_BULK script commands push a synthetic
+ * payload over the established connection to measure the record-layer
+ * throughput of the negotiated cipher suite:
+ *
+ *   CLIENT_SEND_BULK 16m 4k    16 MiB from the client in 4 KiB SSL_writes
+ *
+ * Sizes take an optional k/m (KiB/MiB) suffix; the chunk defaults to one
+ * full record. The receiver drains after every write, so the memory BIOs
+ * never hold more than a chunk. Per-record events (wire dumps, tls_record,
+ * cipher traces) are off for the transfer, which would otherwise measure the
+ * logging; one bulk_transfer event reports bytes, wire overhead, time and
+ * MB/s (10^6 bytes of payload per second). */
+#define BULK_MAX_BYTES (1ULL << 30)
+#define BULK_MAX_CHUNK (1U << 20)
+#define BULK_CHUNK_DEFAULT 16384 // SSL3_RT_MAX_PLAIN_LENGTH
+#define BULK_QUIET_EVENTS                                                      \
+  (TLS_SIM_EV_MSG | TLS_SIM_EV_WIRE | TLS_SIM_EV_RECORD | TRACE_EV_BITS)
+
+// "<digits>[k|m]" after optional blanks; advances *s, 0 if there is none.
+static unsigned long long parse_size(const char **s) {
+  const char *p = *s + strspn(*s, " \t:");
+  if (*p < '0' || *p > '9')
+    return 0;
+  char *end;
+  unsigned long long n = strtoull(p, &end, 10);
+  if (n > BULK_MAX_BYTES) // keep the shifts below from wrapping
+    n = BULK_MAX_BYTES + 1;
+  if (*end == 'k' || *end == 'K') {
+    n <<= 10;
+    end++;
+  } else if (*end == 'm' || *end == 'M') {
+    n <<= 20;
+    end++;
+  }
+  *s = end;
+  return n;
+}
+
+// Write `bytes` from `from` in `chunk`-sized SSL_write_ex() calls, draining
+// `to` after each one. Returns 0 when every byte arrived.
+static int bulk_transfer(tls_sim_ctx *sim, sim_transport *link, SSL *from,
+                         BIO *from_wbio, BIO *to_rbio, SSL *to,
+                         const char *side, const char *peer, size_t bytes,
+                         size_t chunk) {
+  unsigned char *payload = malloc(chunk);
+  if (!payload) {
+    log_event(sim, side, "error", "Bulk transfer: out of memory");
+    return -1;
+  }
+  for (size_t i = 0; i < chunk; i++)
+    payload[i] = (unsigned char)i;
+
+  unsigned int mask = sim->event_mask;
+  sim->event_mask &= ~BULK_QUIET_EVENTS;
+  apply_trace_mask(sim);
+
+  size_t sent = 0, received = 0, records = 0, wire = 0;
+  int failed = 0;
+  double t0 = now_ms();
+  double cpu0 = cpu_now_ms();
+  while (sent < bytes && !failed) {
+    size_t n = bytes - sent < chunk ? bytes - sent : chunk;
+    size_t w = 0;
+    sim->current_side = side;
+    if (!SSL_write_ex(from, payload, n, &w)) {
+      failed = 1;
+      break;
+    }
+    sent += w;
+    wire += (size_t)pump_flash_drive(sim, link, from_wbio, to_rbio, side);
+    sim->current_side = peer;
+    recv_stats st = {0, 0, 0};
+    if (drain_app_data(to, NULL, 0, &st) != SSL_ERROR_WANT_READ)
+      failed = 1;
+    received += st.bytes;
+    records += st.records;
+  }
+  double ms = now_ms() - t0;
+  double cpu_ms = cpu_now_ms() - cpu0;
+
+  sim->event_mask = mask;
+  apply_trace_mask(sim);
+  free(payload);
+
+  const char *cipher = SSL_CIPHER_get_name(SSL_get_current_cipher(from));
+  double mbps = ms > 0 ? (double)received / 1e3 / ms : 0;
+  char details[256];
+  snprintf(details, sizeof(details),
+           "%s sent %zu B in %zu B writes: %.3f ms, %.1f MB/s (%s)",
+           strcmp(side, "client") == 0 ? "Client" : "Server", received, chunk,
+           ms, mbps, cipher);
+  char fields[320];
+  snprintf(fields, sizeof(fields),
+           "\"bulk\":{\"from\":\"%s\",\"bytes\":%zu,\"chunk\":%zu,"
+           "\"received\":%zu,\"records\":%zu,\"wire_bytes\":%zu,\"ms\":%.3f,"
+           "\"cpu_ms\":%.3f,\"mb_per_sec\":%.2f,\"cipher\":\"%s\"}",
+           side, bytes, chunk, received, records, wire, ms, cpu_ms, mbps,
+           cipher);
+  log_event_fields(sim, "connection", "bulk_transfer", details, fields);
+
+  if (failed || received != bytes) {
+    char err[128];
+    snprintf(err, sizeof(err), "Bulk transfer stopped: %zu of %zu B delivered",
+             received, bytes);
+    log_event(sim, side, "error", err);
+    return -1;
+  }
+  return 0;
+}
+
+// CLIENT_SEND_BULK / SERVER_SEND_BULK arguments: "<bytes> [<chunk>]".
+static int bulk_command(tls_sim_ctx *sim, const char *args,
+                        sim_transport *link, SSL *from, BIO *from_wbio,
+                        BIO *to_rbio, SSL *to, const char *side,
+                        const char *peer) {
+  unsigned long long bytes = parse_size(&args);
+  const char *rest = args;
+  unsigned long long chunk = parse_size(&args);
+  if (args == rest)
+    chunk = BULK_CHUNK_DEFAULT;
+  if (bytes == 0 || bytes > BULK_MAX_BYTES || chunk == 0 ||
+      chunk > BULK_MAX_CHUNK || args[strspn(args, " \t\r")] != 0) {
+    log_event(sim, side, "error",
+              "Bad bulk command: expected <bytes>[k|m] [<chunk>[k|m]], up to "
+              "1 GiB in chunks of at most 1 MiB");
+    return -1;
+  }
+  return bulk_transfer(sim, link, from, from_wbio, to_rbio, to, side, peer,
+                       (size_t)bytes, (size_t)chunk);
+}
+
+static char *run_simulation(tls_sim_ctx *sim, const char *client_conf_path,
+                            const char *server_conf_path,
+                            const char *script_path) {
+  SSL_CTX *c_ctx = NULL;
+  SSL_CTX *s_ctx = NULL;
+  SSL *c_ssl = NULL;
+  SSL *s_ssl = NULL;
+
+  reset_log(sim);
+  sim->client_hello_count = 0;
+  sim->hrr_detected = 0;
+  record_reset(sim);
+  memset(sim->phase, 0, sizeof(sim->phase));
+  flight_reset(&sim->flight);
+
+  // 1-3. Client and server contexts
+  if (acquire_contexts(sim, client_conf_path, server_conf_path, &c_ctx, &s_ctx,
+                       1) != 0) {
+    close_log(sim, "error", "Failed to create SSL contexts");
+    return log_result(sim);
+  }
+
+  // 4. Connect BIOs
+  sim_conn conn;
+  int link_ok = sim_conn_open(sim, &conn, c_ctx, s_ctx) == 0;
+  c_ssl = conn.c_ssl;
+  s_ssl = conn.s_ssl;
+  BIO *c_wbio = conn.c_wbio, *c_rbio = conn.c_rbio;
+  BIO *s_wbio = conn.s_wbio, *s_rbio = conn.s_rbio;
+  if (!link_ok) {
+    close_log(sim, "error", "Failed to open the transport");
+    goto cleanup;
+  }
+
+  // Setup Tracing (process-wide channels, held until the end of the run;
+  // trace_callback attributes each line to this context's current_side)
+  apply_trace_mask(sim);
+
+  // A server only issues 0-RTT capable tickets when early data is enabled
+  sim->early.count = 0;
+  if (sim->resume_mode != TLS_SIM_RESUME_OFF)
+    read_early_data(sim, script_path, &sim->early);
+  if (sim->early.count > 0)
+    SSL_set_max_early_data(s_ssl, EARLY_DATA_MAX);
+
+  int steps = 0;
+  int handshake_done = 0;
+  hs_cost full = {0, 0, 0};
+  double hs_start = now_ms();
+  while (steps < 20 && !handshake_done) {
+    steps++;
+    // Pump data between BIOs
+    full.c_bytes += (size_t)pump_flight(sim, &conn.link, c_wbio, s_rbio, 0);
+    full.s_bytes += (size_t)pump_flight(sim, &conn.link, s_wbio, c_rbio, 1);
+
+    int c_done = SSL_is_init_finished(c_ssl);
+    int s_done = SSL_is_init_finished(s_ssl);
+
+    if (!c_done) {
+      sim->current_side = "client";
+      phase_enter(sim, &sim->phase[0]);
+      int r = SSL_do_handshake(c_ssl);
+      phase_leave(sim, &sim->phase[0], c_ssl);
+      if (r <= 0) {
+        int err = SSL_get_error(c_ssl, r);
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+          char msg[512];
+          char ssl_err[256];
+          ERR_error_string_n(ERR_get_error(), ssl_err, sizeof(ssl_err));
+          snprintf(msg, sizeof(msg), "Client handshake error: %d - %s", err,
+                   ssl_err);
+          log_event(sim, "client", "error", msg);
+
+          // Check for certificate verification error and log explanation
+          long verify_err = SSL_get_verify_result(c_ssl);
+          if (verify_err != X509_V_OK) {
+            const char *explanation = get_cert_verify_explanation(verify_err);
+            if (explanation) {
+              log_event(sim, "client", "cert_verify_error", explanation);
+            } else {
+              char verify_msg[256];
+              snprintf(verify_msg, sizeof(verify_msg),
+                       "Certificate verification failed: %s",
+                       X509_verify_cert_error_string(verify_err));
+              log_event(sim, "client", "cert_verify_error", verify_msg);
+            }
+          }
+
+          close_log(sim, "failed", "Client handshake failed");
+          goto cleanup;
+        }
+      }
+    }
+    if (!s_done) {
+      sim->current_side = "server";
+      phase_enter(sim, &sim->phase[1]);
+      int r = SSL_do_handshake(s_ssl);
+      phase_leave(sim, &sim->phase[1], s_ssl);
+      if (r <= 0) {
+        int err = SSL_get_error(s_ssl, r);
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+          char msg[512];
+          char ssl_err[256];
+          ERR_error_string_n(ERR_get_error(), ssl_err, sizeof(ssl_err));
+          snprintf(msg, sizeof(msg), "Server handshake error: %d - %s", err,
+                   ssl_err);
+          log_event(sim, "server", "error", msg);
+
+          // Check for certificate verification error (mTLS client cert
+          // validation)
+          long verify_err = SSL_get_verify_result(s_ssl);
+          if (verify_err != X509_V_OK) {
+            const char *explanation = get_cert_verify_explanation(verify_err);
+            if (explanation) {
+              log_event(sim, "server", "cert_verify_error", explanation);
+            } else {
+              char verify_msg[256];
+              snprintf(verify_msg, sizeof(verify_msg),
+                       "Client certificate verification failed: %s",
+                       X509_verify_cert_error_string(verify_err));
+              log_event(sim, "server", "cert_verify_error", verify_msg);
+            }
+          }
+
+          close_log(sim, "failed", "Server handshake failed");
+          goto cleanup;
+        }
+      }
+    }
+
+    if (SSL_is_init_finished(c_ssl) && SSL_is_init_finished(s_ssl)) {
+      handshake_done = 1;
+      full.ms = now_ms() - hs_start;
+      char msg[128];
+      snprintf(msg, sizeof(msg), "Negotiated: %s", SSL_get_cipher_name(c_ssl));
+      log_event(sim, "connection", "established", msg);
+
+      // Log HRR status and round-trip count
+      if (sim->hrr_detected) {
+        log_event(sim, "connection", "hello_retry_summary",
+                  "HelloRetryRequest occurred: handshake used 2-RTT (group "
+                  "mismatch between initial ClientHello and server preference)");
+        log_event(sim, "connection", "round_trips", "2");
+      } else {
+        log_event(sim, "connection", "round_trips", "1");
+      }
+
+      // Log the negotiated key exchange group (X25519, P-256, ML-KEM, Hybrid,
+      // etc.)
+      int group_nid = SSL_get_negotiated_group(c_ssl);
+
+      char group_debug[128];
+      snprintf(group_debug, sizeof(group_debug), "Debug: Group NID=%d",
+               group_nid);
+      log_event(sim, "connection", "debug", group_debug);
+
+      if (group_nid > 0) {
+        char group_name[96];
+        negotiated_group_name(c_ssl, group_name, sizeof(group_name));
+        char group_msg[128];
+        snprintf(group_msg, sizeof(group_msg), "Key Exchange: %s", group_name);
+        log_event(sim, "connection", "key_exchange", group_msg);
+      } else {
+        log_event(sim, "connection", "debug",
+                  "Debug: No negotiated group (NID<=0)");
+      }
+
+      // Log the negotiated TLS 1.3 signature scheme as a human-readable name.
+      char scheme[128];
+      signature_scheme_name(c_ssl, s_ssl, scheme, sizeof(scheme));
+
+      char sig_msg[160];
+      snprintf(sig_msg, sizeof(sig_msg), "Peer Signature Algorithm: %s", scheme);
+      log_event(sim, "connection", "signature_algorithm", sig_msg);
+
+      log_record_summary(sim);
+      log_flight_summary(sim);
+      log_phase_timing(sim);
+      log_transport(sim, &conn.link);
+    }
+  }
+
+  if (!handshake_done) {
+    log_event(sim, "connection", "error",
+              "Handshake not completed after max steps");
+    close_log(sim, "failed", "Handshake timeout");
+    goto cleanup;
+  }
+
+  // 6. Post-Handshake Script Processing
+  input_buf script;
+  if (script_path && input_open(sim, script_path, &script) == 0) {
+    BIO *f = BIO_new_mem_buf(script.data, (int)script.len);
+    if (f) {
+      char line[1024];
+      while (BIO_gets(f, line, sizeof(line)) > 0) {
+        // Strip newline
+        line[strcspn(line, "\n")] = 0;
+        if (strlen(line) == 0)
+          continue;
+
+        if (strncmp(line, "CLIENT_SEND:", 12) == 0) {
+          const char *msg = line + 12;
+          sim->current_side = "client";
+          // Log the message being sent (before encryption)
+          char send_msg[4200];
+          snprintf(send_msg, sizeof(send_msg), "Sending: %s", msg);
+          log_event(sim, "client", "message_sent", send_msg);
+          SSL_write(c_ssl, msg, strlen(msg));
+
+          // Move data from Client Write BIO to Server Read BIO
+          pump_flash_drive(sim, &conn.link, c_wbio, s_rbio, "client");
+
+          // Server needs to read it
+          process_reads(sim, s_ssl, "server");
+        } else if (strncmp(line, "SERVER_SEND:", 12) == 0) {
+          const char *msg = line + 12;
+          sim->current_side = "server";
+          // Log the message being sent (before encryption)
+          char send_msg[4200];
+          snprintf(send_msg, sizeof(send_msg), "Sending: %s", msg);
+          log_event(sim, "server", "message_sent", send_msg);
+          SSL_write(s_ssl, msg, strlen(msg));
+
+          // Move data from Server Write BIO to Client Read BIO
+          pump_flash_drive(sim, &conn.link, s_wbio, c_rbio, "server");
+
+          // Client needs to read it
+          process_reads(sim, c_ssl, "client");
+        } else if (strncmp(line, "CLIENT_SEND_BULK", 16) == 0) {
+          bulk_command(sim, line + 16, &conn.link, c_ssl, c_wbio, s_rbio, s_ssl,
+                       "client", "server");
+        } else if (strncmp(line, "SERVER_SEND_BULK", 16) == 0) {
+          bulk_command(sim, line + 16, &conn.link, s_ssl, s_wbio, c_rbio, c_ssl,
+                       "server", "client");
+        } else if (strcmp(line, "CLIENT_DISCONNECT") == 0) {
+          log_event(sim, "client", "action", "Sending close_notify");
+          SSL_shutdown(c_ssl);                    // Send close_notify
+          int r = process_reads(sim, s_ssl, "server"); // Server receives it
+          // Server should technically respond with close_notify
+          if (r == -1)
+            SSL_shutdown(s_ssl);
+        } else if (strcmp(line, "SERVER_DISCONNECT") == 0) {
+          log_event(sim, "server", "action", "Sending close_notify");
+          SSL_shutdown(s_ssl);
+          int r = process_reads(sim, c_ssl, "client");
+          if (r == -1)
+            SSL_shutdown(c_ssl);
+        }
+      }
+      BIO_free(f);
+    }
+    input_close(&script);
+  }
+
+  if (sim->resume_mode != TLS_SIM_RESUME_OFF &&
+      run_resumption(sim, c_ctx, s_ctx, &conn, &full, &sim->early) != 0) {
+    close_log(sim, "failed", "Resumed handshake failed");
+    goto cleanup;
+  }
+
+  close_log(sim, "success", NULL);
+
+cleanup:
+  sim_conn_close(&conn);
+  if (c_ctx)
+    SSL_CTX_free(c_ctx);
+  if (s_ctx)
+    SSL_CTX_free(s_ctx);
+  trace_release(sim);
+
+  return log_result(sim);
+}
+
+// Main execution function exposed to JS
+EMSCRIPTEN_KEEPALIVE
+char *execute_tls_simulation(const char *client_conf_path,
+                             const char *server_conf_path,
+                             const char *script_path) {
+  return run_simulation(default_sim(), client_conf_path, server_conf_path,
+                        script_path);
+}
+
+// Same run on a caller-owned context; the document stays valid until the
+// context's next run or tls_sim_ctx_free().
+EMSCRIPTEN_KEEPALIVE
+const char *tls_sim_ctx_run(tls_sim_ctx *sim, const char *client_conf_path,
+                            const char *server_conf_path,
+                            const char *script_path) {
+  return run_simulation(sim, client_conf_path, server_conf_path, script_path);
+}
+
+EMSCRIPTEN_KEEPALIVE
+size_t tls_sim_ctx_result_len(const tls_sim_ctx *sim) {
+  return sim->log.result ? sim->log.result_len : sizeof(log_oom_result) - 1;
+}
+
+/* ── Batch benchmark ─────────────────────────────────────────────────────────
+ * Back-to-back handshakes over the same memory-BIO pump as the traced run,
+ * with every event category off, for capacity sizing. The contexts come from
+ * the SSL_CTX cache, so only per-connection work is timed. */
+#define TLS_SIM_BENCH_MAX_ITERATIONS 100000
+#define BENCH_MAX_STEPS 20
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// What bench_handshake() reports about a completed connection.
+typedef struct {
+  char group[96];
+  char scheme[128];
+  char cipher[64];
+  int client_hellos; // 2 after a HelloRetryRequest
+  size_t flight;      // the server's largest flight (the certificate's)
+  size_t flight_cwnd; // its window: initcwnd plus earlier server segments
+} bench_info;
+
+static void bench_msg_callback(int write_p, int version, int content_type,
+                               const void *buf, size_t len, SSL *ssl,
+                               void *arg) {
+  if (write_p && content_type == SSL3_RT_HANDSHAKE && len >= 1 &&
+      ((const unsigned char *)buf)[0] == SSL3_MT_CLIENT_HELLO)
+    ++*(int *)arg;
+}
+
+// One untraced handshake on fresh SSL objects and, for a socket transport, a
+// fresh connection (its setup counts towards the handshake). Adds the bytes
+// each side put on the wire to *c_bytes / *s_bytes; when `info` is non-NULL
+// the connection's group, signature scheme, cipher, ClientHello count and
+// server certificate flight are filled in.
+static int bench_handshake(tls_sim_ctx *sim, SSL_CTX *c_ctx, SSL_CTX *s_ctx,
+                           size_t *c_bytes,
+                           size_t *s_bytes, bench_info *info) {
+  SSL *c_ssl = SSL_new(c_ctx);
+  SSL *s_ssl = SSL_new(s_ctx);
+  BIO *c_wbio = BIO_new(BIO_s_mem());
+  BIO *c_rbio = BIO_new(BIO_s_mem());
+  BIO *s_wbio = BIO_new(BIO_s_mem());
+  BIO *s_rbio = BIO_new(BIO_s_mem());
+  sim_transport link;
+  int ok = 0;
+
+  if (transport_open(&link, sim->transport, c_rbio, s_rbio) != 0 || !c_ssl ||
+      !s_ssl || !c_wbio || !c_rbio || !s_wbio || !s_rbio) {
+    BIO_free(c_wbio);
+    BIO_free(c_rbio);
+    BIO_free(s_wbio);
+    BIO_free(s_rbio);
+    goto out;
+  }
+  SSL_set_bio(c_ssl, c_rbio, c_wbio);
+  SSL_set_bio(s_ssl, s_rbio, s_wbio);
+  BIO_set_mem_eof_return(c_rbio, -1);
+  BIO_set_mem_eof_return(s_rbio, -1);
+  SSL_set_connect_state(c_ssl);
+  SSL_set_accept_state(s_ssl);
+  if (info) {
+    info->client_hellos = 0;
+    SSL_set_msg_callback(c_ssl, bench_msg_callback);
+    SSL_set_msg_callback_arg(c_ssl, &info->client_hellos);
+    info->flight = 0;
+    info->flight_cwnd = sim->flight.initcwnd;
+  }
+
+  size_t s_segments = 0;
+  for (int steps = 0; steps < BENCH_MAX_STEPS; steps++) {
+    *c_bytes += (size_t)pump_flash_drive(sim, &link, c_wbio, s_rbio, "client");
+    int s_flight = pump_flash_drive(sim, &link, s_wbio, c_rbio, "server");
+    if (s_flight > 0) {
+      *s_bytes += (size_t)s_flight;
+      if (info && (size_t)s_flight > info->flight) {
+        info->flight = (size_t)s_flight;
+        info->flight_cwnd = sim->flight.initcwnd + s_segments;
+      }
+      s_segments += flight_segments(&sim->flight, (size_t)s_flight);
+    }
+    if (SSL_is_init_finished(c_ssl) && SSL_is_init_finished(s_ssl)) {
+      ok = 1;
+      break;
+    }
+    int r = SSL_do_handshake(c_ssl);
+    if (r <= 0 && SSL_get_error(c_ssl, r) != SSL_ERROR_WANT_READ)
+      break;
+    r = SSL_do_handshake(s_ssl);
+    if (r <= 0 && SSL_get_error(s_ssl, r) != SSL_ERROR_WANT_READ)
+      break;
+  }
+
+  if (ok && info) {
+    negotiated_group_name(c_ssl, info->group, sizeof(info->group));
+    signature_scheme_name(c_ssl, s_ssl, info->scheme, sizeof(info->scheme));
+    snprintf(info->cipher, sizeof(info->cipher), "%s",
+             SSL_get_cipher_name(c_ssl));
+  }
+
+out:
+  SSL_free(c_ssl);
+  SSL_free(s_ssl);
+  transport_close(&link);
+  return ok ? 0 : -1;
+}
+
+static const char *bench_fail(tls_sim_ctx *sim, const char *error,
+                              int completed) {
+  char ssl_err[256] = "";
+  unsigned long e = ERR_get_error();
+  if (e)
+    ERR_error_string_n(e, ssl_err, sizeof(ssl_err));
+  ERR_clear_error();
+  char escaped[2 * sizeof(ssl_err)];
+  escaped[json_escape(escaped, ssl_err, strlen(ssl_err))] = 0;
+  snprintf(sim->bench_result, sizeof(sim->bench_result),
+           "{\"status\":\"failed\",\"error\":\"%s\",\"ssl_error\":\"%s\","
+           "\"completed\":%d}",
+           error, escaped, completed);
+  return sim->bench_result;
+}
+
+// Tracing off for a whole batch; the config-phase events of a context build
+// land in a log nobody reads, and never reach the streaming sink.
+typedef struct {
+  unsigned int mask;
+  int sink;
+} bench_quiet;
+
+static bench_quiet bench_quiet_begin(tls_sim_ctx *sim) {
+  bench_quiet q = {sim->event_mask, sim->sink.enabled};
+  sim->event_mask = 0;
+  sim->sink.enabled = 0;
+  apply_trace_mask(sim);
+  reset_log(sim);
+  return q;
+}
+
+static void bench_quiet_end(tls_sim_ctx *sim, bench_quiet q) {
+  sim->event_mask = q.mask;
+  sim->sink.enabled = q.sink;
+}
+
+// `"latency_ms":{...},"handshakes_per_sec":N` for `n` samples taken over
+// `wall` ms. Sorts `lat` in place.
+static void format_latency(char *out, size_t len, double *lat, int n,
+                           double wall) {
+  double sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += lat[i];
+  qsort(lat, (size_t)n, sizeof(double), cmp_double);
+  int p99 = (99 * n + 99) / 100 - 1; // nearest rank
+  snprintf(out, len,
+           "\"latency_ms\":{\"min\":%.4f,\"median\":%.4f,\"p99\":%.4f,"
+           "\"max\":%.4f,\"mean\":%.4f},\"handshakes_per_sec\":%.1f",
+           lat[0], lat[n / 2], lat[p99], lat[n - 1], sum / n,
+           wall > 0 ? n * 1000.0 / wall : 0.0);
+}
+
+// Run `iterations` handshakes and return
+//   {"status","iterations","group","cipher",
+//    "latency_ms":{"min","median","p99","max","mean"},
+//    "handshakes_per_sec","bytes_per_handshake":{"client","server"}}
+// Latency is SSL_new through both sides finishing. The string is valid until
+// the context's next benchmark; so are the sorted samples in sim->bench_lat.
+static const char *run_benchmark(tls_sim_ctx *sim, const char *client_conf_path,
+                                 const char *server_conf_path, int iterations,
+                                 unsigned int flags) {
+  free(sim->bench_lat);
+  sim->bench_lat = NULL;
+  sim->bench_lat_n = 0;
+  if (iterations <= 0 || iterations > TLS_SIM_BENCH_MAX_ITERATIONS)
+    return bench_fail(sim, "iterations out of range", 0);
+
+  double *lat = malloc((size_t)iterations * sizeof(double));
+  if (!lat)
+    return bench_fail(sim, "out of memory", 0);
+
+  bench_quiet quiet = bench_quiet_begin(sim);
+
+  const char *error = NULL;
+  SSL_CTX *c_ctx = NULL, *s_ctx = NULL;
+  size_t c_bytes = 0, s_bytes = 0;
+  bench_info info = {"", "", "", 0};
+  int done = 0;
+  double wall = 0;
+
+  if (flags & TLS_SIM_BENCH_NEW_CTX) {
+    // Built per handshake below; a warm-up gets a throwaway pair so the
+    // first timed build doesn't pay for cold providers and decoders.
+    if ((flags & TLS_SIM_BENCH_WARMUP) &&
+        build_contexts(sim, client_conf_path, server_conf_path, &c_ctx,
+                       &s_ctx) != 0) {
+      error = "Failed to create SSL contexts";
+      goto out;
+    }
+  } else if (flags & TLS_SIM_BENCH_OWN_CTX
+                 ? build_contexts(sim, client_conf_path, server_conf_path,
+                                  &c_ctx, &s_ctx) != 0
+                 : acquire_contexts(sim, client_conf_path, server_conf_path,
+                                    &c_ctx, &s_ctx, 0) != 0) {
+    error = "Failed to create SSL contexts";
+    goto out;
+  }
+  if (flags & TLS_SIM_BENCH_WARMUP) {
+    size_t cb = 0, sb = 0;
+    if (bench_handshake(sim, c_ctx, s_ctx, &cb, &sb, NULL) != 0) {
+      error = "Warm-up handshake failed";
+      goto out;
+    }
+  }
+  if (flags & TLS_SIM_BENCH_NEW_CTX) {
+    SSL_CTX_free(c_ctx); // the warm-up pair, freed off the clock
+    SSL_CTX_free(s_ctx);
+    c_ctx = s_ctx = NULL;
+  }
+
+  double start = now_ms();
+  for (; done < iterations; done++) {
+    double t0 = now_ms();
+    if (flags & TLS_SIM_BENCH_NEW_CTX) {
+      SSL_CTX_free(c_ctx);
+      SSL_CTX_free(s_ctx);
+      c_ctx = s_ctx = NULL;
+      if (build_contexts(sim, client_conf_path, server_conf_path, &c_ctx,
+                         &s_ctx) != 0) {
+        error = "Failed to create SSL contexts";
+        goto out;
+      }
+    }
+    int last = done == iterations - 1;
+    if (bench_handshake(sim, c_ctx, s_ctx, &c_bytes, &s_bytes,
+                        last ? &info : NULL) != 0) {
+      error = "Handshake failed";
+      goto out;
+    }
+    lat[done] = now_ms() - t0;
+  }
+  wall = now_ms() - start;
+
+out:
+  SSL_CTX_free(c_ctx);
+  SSL_CTX_free(s_ctx);
+  bench_quiet_end(sim, quiet);
+
+  if (error) {
+    free(lat);
+    return bench_fail(sim, error, done);
+  }
+
+  char stats[192];
+  format_latency(stats, sizeof(stats), lat, done, wall);
+  snprintf(sim->bench_result, sizeof(sim->bench_result),
+           "{\"status\":\"success\",\"iterations\":%d,\"group\":\"%s\","
+           "\"cipher\":\"%s\",%s,"
+           "\"bytes_per_handshake\":{\"client\":%zu,\"server\":%zu}}",
+           done, info.group, info.cipher, stats, c_bytes / (size_t)done,
+           s_bytes / (size_t)done);
+  sim->bench_lat = lat;
+  sim->bench_lat_n = done;
+  return sim->bench_result;
+}
+
+EMSCRIPTEN_KEEPALIVE
+const char *execute_tls_benchmark(const char *client_conf_path,
+                                  const char *server_conf_path, int iterations,
+                                  unsigned int flags) {
+  return run_benchmark(default_sim(), client_conf_path, server_conf_path,
+                       iterations, flags);
+}
+
+// The same batch on a caller-owned context; one context per thread runs
+// batches concurrently.
+EMSCRIPTEN_KEEPALIVE
+const char *tls_sim_ctx_benchmark(tls_sim_ctx *sim,
+                                  const char *client_conf_path,
+                                  const char *server_conf_path, int iterations,
+                                  unsigned int flags) {
+  return run_benchmark(sim, client_conf_path, server_conf_path, iterations,
+                       flags);
+}
+
+// Per-handshake latencies (ms, ascending) of the context's last successful
+// benchmark, for merging the distributions of several contexts.
+EMSCRIPTEN_KEEPALIVE
+const double *tls_sim_ctx_latencies(const tls_sim_ctx *sim, int *count) {
+  *count = sim->bench_lat_n;
+  return sim->bench_lat;
+}
+
+/* ── Group × signature-algorithm matrix ──────────────────────────────────────
+ * Benchmarks every (key exchange group, server signature scheme) pair without
+ * hand-written configs: per sigalg an ephemeral server key and self-signed
+ * certificate are generated, and per pair two minimal TLS 1.3 contexts are
+ * built with the group and sigalg pinned (server authentication only).
+ * Context setup and keygen are not timed. */
+#define MATRIX_MAX_LIST 16
+#define MATRIX_NAME_MAX 64
+
+static void matrix_appendf(tls_sim_ctx *sim, const char *fmt, ...) {
+  for (;;) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = sim->matrix_result
+                ? vsnprintf(sim->matrix_result + sim->matrix_len,
+                            sim->matrix_cap - sim->matrix_len, fmt, ap)
+                : -1;
+    va_end(ap);
+    if (n >= 0 && (size_t)n < sim->matrix_cap - sim->matrix_len) {
+      sim->matrix_len += (size_t)n;
+      return;
+    }
+    size_t cap = sim->matrix_cap ? 2 * sim->matrix_cap : 4096;
+    while (n >= 0 && cap - sim->matrix_len <= (size_t)n)
+      cap *= 2;
+    char *p = realloc(sim->matrix_result, cap);
+    if (!p) {
+      sim->matrix_oom = 1;
+      return;
+    }
+    sim->matrix_result = p;
+    sim->matrix_cap = cap;
+  }
+}
+
+// Split a ':' or ',' separated list into at most MATRIX_MAX_LIST names.
+// Names go into the JSON unescaped, so only OpenSSL name characters pass.
+static int matrix_split(const char *list, char names[][MATRIX_NAME_MAX]) {
+  static const char name_chars[] = "abcdefghijklmnopqrstuvwxyz"
+                                   "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_.";
+  int n = 0;
+  while (list && *list && n < MATRIX_MAX_LIST) {
+    size_t len = strcspn(list, ":,");
+    if (len >= MATRIX_NAME_MAX || strspn(list, name_chars) < len)
+      return -1;
+    if (len > 0) {
+      memcpy(names[n], list, len);
+      names[n++][len] = 0;
+    }
+    list += len;
+    list += *list != 0;
+  }
+  return list && *list ? -1 : n;
+}
+
+// Digest named by a "_shaNNN" suffix (ECDSA, RSA), or NULL for schemes that
+// sign the message directly (EdDSA, ML-DSA, SLH-DSA).
+static const char *matrix_sigalg_md(const char *sigalg) {
+  const char *sfx = strstr(sigalg, "_sha");
+  if (!sfx)
+    return NULL;
+  if (strcmp(sfx, "_sha384") == 0)
+    return "SHA384";
+  if (strcmp(sfx, "_sha512") == 0)
+    return "SHA512";
+  return "SHA256";
+}
+
+// Default-parameter keygen by OpenSSL key type name; unlike EVP_PKEY_Q_keygen
+// this also reaches types it has no shortcut for (RSA-PSS, ML-DSA, provider
+// algorithms).
+static EVP_PKEY *matrix_keygen_type(const char *type) {
+  EVP_PKEY *pkey = NULL;
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_from_name(NULL, type, NULL);
+  if (ctx && EVP_PKEY_keygen_init(ctx) > 0)
+    EVP_PKEY_generate(ctx, &pkey);
+  EVP_PKEY_CTX_free(ctx);
+  return pkey;
+}
+
+// A fresh key able to produce `sigalg` (TLS 1.3 SignatureScheme name, e.g.
+// ecdsa_secp384r1_sha384, rsa_pss_rsae_sha256, ed25519, mldsa65). Other names
+// are tried as an OpenSSL key type, e.g. for provider-supplied algorithms.
+static EVP_PKEY *matrix_keygen(const char *sigalg) {
+  if (strncmp(sigalg, "ecdsa_secp256r1", 15) == 0)
+    return EVP_PKEY_Q_keygen(NULL, NULL, "EC", "P-256");
+  if (strncmp(sigalg, "ecdsa_secp384r1", 15) == 0)
+    return EVP_PKEY_Q_keygen(NULL, NULL, "EC", "P-384");
+  if (strncmp(sigalg, "ecdsa_secp521r1", 15) == 0)
+    return EVP_PKEY_Q_keygen(NULL, NULL, "EC", "P-521");
+  if (strncmp(sigalg, "rsa_pss_pss_", 12) == 0)
+    return matrix_keygen_type("RSA-PSS"); // 2048-bit default
+  if (strncmp(sigalg, "rsa_", 4) == 0)
+    return EVP_PKEY_Q_keygen(NULL, NULL, "RSA", (size_t)2048);
+  if (strcmp(sigalg, "ed25519") == 0)
+    return matrix_keygen_type("ED25519");
+  if (strcmp(sigalg, "ed448") == 0)
+    return matrix_keygen_type("ED448");
+  if (strncmp(sigalg, "mldsa", 5) == 0) {
+    char type[32];
+    snprintf(type, sizeof(type), "ML-DSA-%s", sigalg + 5);
+    return matrix_keygen_type(type);
+  }
+  return matrix_keygen_type(sigalg);
+}
+
+// Self-signed server certificate for `pkey`. Signed through
+// EVP_DigestSignInit_ex so provider-only key types (ML-DSA) work too.
+static X509 *matrix_self_signed(EVP_PKEY *pkey, const char *sigalg) {
+  X509 *cert = X509_new();
+  EVP_MD_CTX *mctx = EVP_MD_CTX_new();
+  int ok = cert && mctx;
+  if (ok) {
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), 60L * 60L * 24L);
+    X509_NAME *name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                               (const unsigned char *)"tls-sim-matrix", -1, -1,
+                               0);
+    X509_set_issuer_name(cert, name);
+    ok = X509_set_pubkey(cert, pkey) == 1 &&
+         EVP_DigestSignInit_ex(mctx, NULL, matrix_sigalg_md(sigalg), NULL,
+                               NULL, pkey, NULL) == 1 &&
+         X509_sign_ctx(cert, mctx) > 0;
+  }
+  EVP_MD_CTX_free(mctx);
+  if (!ok) {
+    X509_free(cert);
+    return NULL;
+  }
+  return cert;
+}
+
+// Minimal TLS 1.3 context pair for one matrix cell. With
+// TLS_SIM_BENCH_MATRIX_HRR the client also supports X25519 and sends its key
+// share first, so every other group costs a HelloRetryRequest.
+static const char *matrix_contexts(const char *group, const char *sigalg,
+                                   EVP_PKEY *pkey, X509 *cert,
+                                   unsigned int flags,
+                                   const SSL_METHOD *c_method,
+                                   const SSL_METHOD *s_method, SSL_CTX **c_out,
+                                   SSL_CTX **s_out) {
+  SSL_CTX *c_ctx = SSL_CTX_new(c_method);
+  SSL_CTX *s_ctx = SSL_CTX_new(s_method);
+  const char *error = NULL;
+  char c_groups[2 * MATRIX_NAME_MAX + 8];
+
+  if ((flags & TLS_SIM_BENCH_MATRIX_HRR) && strcasecmp(group, "X25519") != 0)
+    snprintf(c_groups, sizeof(c_groups), "X25519:%s", group);
+  else
+    snprintf(c_groups, sizeof(c_groups), "%s", group);
+
+  if (!c_ctx || !s_ctx)
+    error = "Failed to create SSL contexts";
+  else if (!SSL_CTX_set_min_proto_version(c_ctx, TLS1_3_VERSION) ||
+           !SSL_CTX_set_min_proto_version(s_ctx, TLS1_3_VERSION))
+    error = "TLS 1.3 not available";
+  else if (!SSL_CTX_set1_groups_list(c_ctx, c_groups) ||
+           !SSL_CTX_set1_groups_list(s_ctx, group))
+    error = "Unsupported group";
+  else if (!SSL_CTX_set1_sigalgs_list(c_ctx, sigalg))
+    error = "Unsupported signature algorithm";
+  else if (SSL_CTX_use_certificate(s_ctx, cert) != 1 ||
+           SSL_CTX_use_PrivateKey(s_ctx, pkey) != 1)
+    error = "Failed to load server credentials";
+  else if (X509_STORE_add_cert(SSL_CTX_get_cert_store(c_ctx), cert) != 1)
+    error = "Failed to trust server certificate";
+
+  if (error) {
+    SSL_CTX_free(c_ctx);
+    SSL_CTX_free(s_ctx);
+    return error;
+  }
+  SSL_CTX_set_verify(c_ctx, SSL_VERIFY_PEER, NULL);
+  *c_out = c_ctx;
+  *s_out = s_ctx;
+  return NULL;
+}
+
+static void matrix_row_fail(tls_sim_ctx *sim, const char *group,
+                            const char *sigalg, const char *error) {
+  char ssl_err[256] = "";
+  unsigned long e = ERR_get_error();
+  if (e)
+    ERR_error_string_n(e, ssl_err, sizeof(ssl_err));
+  ERR_clear_error();
+  char escaped[2 * sizeof(ssl_err)];
+  escaped[json_escape(escaped, ssl_err, strlen(ssl_err))] = 0;
+  matrix_appendf(sim,
+                 "{\"group\":\"%s\",\"sigalg\":\"%s\",\"status\":\"failed\","
+                 "\"error\":\"%s\",\"ssl_error\":\"%s\"}",
+                 group, sigalg, error, escaped);
+}
+
+static void matrix_row(tls_sim_ctx *sim, const char *group, const char *sigalg,
+                       EVP_PKEY *pkey, X509 *cert, int iterations,
+                       unsigned int flags, double *lat) {
+  SSL_CTX *c_ctx = NULL, *s_ctx = NULL;
+  const char *error =
+      matrix_contexts(group, sigalg, pkey, cert, flags, TLS_client_method(),
+                      TLS_server_method(), &c_ctx, &s_ctx);
+  if (error) {
+    matrix_row_fail(sim, group, sigalg, error);
+    return;
+  }
+
+  size_t c_bytes = 0, s_bytes = 0;
+  bench_info info = {"", "", "", 0};
+  if (flags & TLS_SIM_BENCH_WARMUP) {
+    size_t cb = 0, sb = 0;
+    if (bench_handshake(sim, c_ctx, s_ctx, &cb, &sb, NULL) != 0)
+      error = "Warm-up handshake failed";
+  }
+  double start = now_ms();
+  for (int i = 0; !error && i < iterations; i++) {
+    double t0 = now_ms();
+    if (bench_handshake(sim, c_ctx, s_ctx, &c_bytes, &s_bytes,
+                        i == iterations - 1 ? &info : NULL) != 0)
+      error = "Handshake failed";
+    lat[i] = now_ms() - t0;
+  }
+  double wall = now_ms() - start;
+  SSL_CTX_free(c_ctx);
+  SSL_CTX_free(s_ctx);
+  if (error) {
+    matrix_row_fail(sim, group, sigalg, error);
+    return;
+  }
+
+  char stats[192];
+  format_latency(stats, sizeof(stats), lat, iterations, wall);
+  int hrr = info.client_hellos > 1;
+  size_t segments = flight_segments(&sim->flight, info.flight);
+  int extra = flight_extra_rtts(segments, info.flight_cwnd);
+  matrix_appendf(sim,
+      "{\"group\":\"%s\",\"sigalg\":\"%s\",\"status\":\"success\","
+      "\"negotiated_group\":\"%s\",\"signature_scheme\":\"%s\","
+      "\"cipher\":\"%s\",%s,"
+      "\"bytes_per_handshake\":{\"client\":%zu,\"server\":%zu},"
+      "\"hrr\":%s,\"round_trips\":%d,"
+      "\"server_flight\":{\"bytes\":%zu,\"segments\":%zu,\"cwnd\":%zu,"
+      "\"over_initcwnd\":%s,\"extra_rtts\":%d}}",
+      group, sigalg, info.group, info.scheme, info.cipher, stats,
+      c_bytes / (size_t)iterations, s_bytes / (size_t)iterations,
+      hrr ? "true" : "false", hrr ? 2 : 1, info.flight, segments,
+      info.flight_cwnd, extra ? "true" : "false", extra);
+}
 
-    // Log Wire Data
-    char msg[4096]; // Sufficient for 1024 bytes hex (3 chars/byte + overhead)
-    char *p = msg;
-    int limit = read > 1024 ? 1024 : read; // Cap log size
+// Benchmark every pair of `groups` × `sigalgs` (':' or ',' separated, at most
+// MATRIX_MAX_LIST each) for `iterations` handshakes and return
+//   {"status","iterations","rows":[{"group","sigalg","status",
+//    "negotiated_group","signature_scheme","cipher","latency_ms":{...},
+//    "handshakes_per_sec","bytes_per_handshake":{"client","server"},
+//    "hrr","round_trips","server_flight":{"bytes","segments","cwnd",
+//    "over_initcwnd","extra_rtts"}}, ...]}
+// server_flight is the server's certificate flight measured against the
+// default context's MSS and initcwnd; its extra_rtts are on top of
+// round_trips, which counts protocol round trips only.
+// Rows are sigalg-major. A pair that cannot be set up (e.g. ML-DSA on an
+// OpenSSL without it) gets a "failed" row with the error; the others still
+// run. The string is valid until the next call.
+EMSCRIPTEN_KEEPALIVE
+const char *execute_tls_benchmark_matrix(const char *groups,
+                                         const char *sigalgs, int iterations,
+                                         unsigned int flags) {
+  tls_sim_ctx *sim = default_sim();
+  char names[2][MATRIX_MAX_LIST][MATRIX_NAME_MAX];
+  if (iterations <= 0 || iterations > TLS_SIM_BENCH_MAX_ITERATIONS)
+    return bench_fail(sim, "iterations out of range", 0);
+  int n_groups = matrix_split(groups, names[0]);
+  int n_sigalgs = matrix_split(sigalgs, names[1]);
+  if (n_groups <= 0 || n_sigalgs <= 0)
+    return bench_fail(sim, "group and sigalg lists must name 1-16 entries", 0);
+
+  double *lat = malloc((size_t)iterations * sizeof(double));
+  if (!lat)
+    return bench_fail(sim, "out of memory", 0);
 
-    for (int i = 0; i < limit; i++) {
-      p += sprintf(p, "%02X ", (unsigned char)buf[i]);
+  bench_quiet quiet = bench_quiet_begin(sim);
+  sim->matrix_len = 0;
+  sim->matrix_oom = 0;
+  matrix_appendf(sim, "{\"status\":\"success\",\"iterations\":%d,\"rows\":[",
+                 iterations);
+  for (int s = 0; s < n_sigalgs; s++) {
+    const char *sigalg = names[1][s];
+    EVP_PKEY *pkey = matrix_keygen(sigalg);
+    X509 *cert = pkey ? matrix_self_signed(pkey, sigalg) : NULL;
+    for (int g = 0; g < n_groups; g++) {
+      if (s || g)
+        matrix_appendf(sim, ",");
+      if (!cert)
+        matrix_row_fail(sim, names[0][g], sigalg,
+                        "Failed to generate server credentials");
+      else
+        matrix_row(sim, names[0][g], sigalg, pkey, cert, iterations, flags,
+                   lat);
     }
-    if (read > limit)
-      sprintf(p, "... (%d bytes)", read);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+  }
+  matrix_appendf(sim, "]}");
+  bench_quiet_end(sim, quiet);
+  free(lat);
 
-    // Use new event type
-    log_event(sender, "wire_data", msg);
+  if (sim->matrix_oom)
+    return bench_fail(sim, "out of memory", 0);
+  return sim->matrix_result;
+}
 
-    BIO_write(to, buf, read);
-    total += read;
-    pending = BIO_pending(from);
+/* ── QUIC handshake matrix ───────────────────────────────────────────────────
+ * The group × sigalg matrix over OpenSSL's QUIC stack (3.5+): a client and a
+ * listener exchange datagrams through an in-process BIO_s_dgram_pair, turn by
+ * turn. A ClientHello carrying an ML-KEM share no longer fits one 1200-byte
+ * Initial, and until the server has validated the client's address (here: by
+ * receiving a Handshake packet; Retry is off, as on most HTTP/3 servers) it
+ * may send at most 3× the bytes it received, so a large ML-DSA chain can
+ * stall until the client's ACKs arrive. Each row reports, from the client's
+ * view of the wire, the datagrams and Initial / Handshake / 1-RTT packets of
+ * each side, how many Initial datagrams the first flight took, how many
+ * server flights ended at the amplification limit, and the round trips
+ * beyond the first. */
+#define QUIC_MAX_TURNS 32
+#define QUIC_MAX_DATAGRAM 1200 // both sides' Initial datagram size
+#define QUIC_AMPLIFICATION 3
+
+typedef struct {
+  // [0] client, [1] server: what the client sent and received
+  size_t dgrams[2];
+  size_t bytes[2];
+  size_t initial[2];
+  size_t handshake[2];
+  size_t one_rtt[2];
+  size_t first_flight; // client datagrams before any reply
+  int round_trips;     // server flights the client needed
+  int stalls;          // of those, cut short at the amplification limit
+  int validated;       // client has sent a Handshake packet
+  int client_hellos;
+} quic_stats;
+
+#ifdef TLS_SIM_QUIC
+static void quic_msg_callback(int write_p, int version, int content_type,
+                              const void *buf, size_t len, SSL *ssl,
+                              void *arg) {
+  quic_stats *st = arg;
+  const unsigned char *p = buf;
+  int side = write_p ? 0 : 1;
+  switch (content_type) {
+  case SSL3_RT_QUIC_DATAGRAM:
+    st->dgrams[side]++;
+    st->bytes[side] += len;
+    break;
+  case SSL3_RT_QUIC_PACKET:
+    // Long header (0x80): packet type in bits 4-5, outside header protection
+    if (len < 1)
+      break;
+    if (!(p[0] & 0x80))
+      st->one_rtt[side]++;
+    else if ((p[0] & 0x30) == 0x00)
+      st->initial[side]++;
+    else if ((p[0] & 0x30) == 0x20) {
+      st->handshake[side]++;
+      st->validated |= write_p;
+    }
+    break;
+  case SSL3_RT_HANDSHAKE:
+    if (write_p && len >= 1 && p[0] == SSL3_MT_CLIENT_HELLO)
+      st->client_hellos++;
+    break;
   }
-  return total;
 }
 
-// Main execution function exposed to JS
-EMSCRIPTEN_KEEPALIVE
-char *execute_tls_simulation(const char *client_conf_path,
-                             const char *server_conf_path,
-                             const char *script_path) {
-  SSL_CTX *c_ctx = NULL;
-  SSL_CTX *s_ctx = NULL;
-  SSL *c_ssl = NULL;
-  SSL *s_ssl = NULL;
-  BIO *c_bio = NULL;
-  BIO *s_bio = NULL;
-  int ret = 0;
+static int quic_alpn_select(SSL *ssl, const unsigned char **out,
+                            unsigned char *outlen, const unsigned char *in,
+                            unsigned int inlen, void *arg) {
+  static const unsigned char h3[] = {2, 'h', '3'};
+  if (SSL_select_next_proto((unsigned char **)out, outlen, h3, sizeof(h3), in,
+                            inlen) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_ALERT_FATAL;
+  return SSL_TLSEXT_ERR_OK;
+}
 
-  reset_log();
-  client_hello_count = 0;
-  hrr_detected = 0;
+// One side's turn; returns 1 once its handshake is done, 0 to go on, -1 on
+// failure.
+static int quic_step(SSL *ssl) {
+  int r = SSL_do_handshake(ssl);
+  if (r == 1)
+    return 1;
+  int err = SSL_get_error(ssl, r);
+  return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? 0 : -1;
+}
 
-  // 1. Initialize Contexts
-  c_ctx = SSL_CTX_new(TLS_client_method());
-  s_ctx = SSL_CTX_new(TLS_server_method());
+// One QUIC handshake, alternating client and server turns; every datagram a
+// turn writes is delivered before the other side's turn.
+static int quic_handshake(SSL_CTX *c_ctx, SSL_CTX *s_ctx, quic_stats *st,
+                          bench_info *info) {
+  BIO *c_bio = NULL, *s_bio = NULL;
+  SSL *client = NULL, *listener = NULL, *server = NULL;
+  BIO_ADDR *peer = BIO_ADDR_new();
+  struct in_addr lo = {htonl(INADDR_LOOPBACK)};
+  int ok = 0;
 
-  if (!c_ctx || !s_ctx) {
-    close_log("error", "Failed to create SSL contexts");
-    return log_buffer;
+  memset(st, 0, sizeof(*st));
+  if (!peer || !BIO_new_bio_dgram_pair(&c_bio, 0, &s_bio, 0))
+    goto out;
+  listener = SSL_new_listener(s_ctx, SSL_LISTENER_FLAG_NO_VALIDATE);
+  client = SSL_new(c_ctx);
+  if (!listener || !client) {
+    BIO_free(c_bio);
+    BIO_free(s_bio);
+    goto out;
   }
+  SSL_set_bio(listener, s_bio, s_bio);
+  SSL_set_bio(client, c_bio, c_bio);
+  SSL_set_msg_callback(client, quic_msg_callback);
+  SSL_set_msg_callback_arg(client, st);
+  // The client addresses its datagrams; the pair just passes them through
+  if (!BIO_dgram_set_caps(c_bio, BIO_DGRAM_CAP_HANDLES_DST_ADDR) ||
+      !BIO_dgram_set_caps(s_bio, BIO_DGRAM_CAP_HANDLES_DST_ADDR) ||
+      !BIO_ADDR_rawmake(peer, AF_INET, &lo, sizeof(lo), htons(443)) ||
+      !SSL_set1_initial_peer_addr(client, peer) ||
+      !SSL_set_blocking_mode(client, 0) ||
+      !SSL_set_blocking_mode(listener, 0) || !SSL_listen(listener))
+    goto out;
 
-  // 2. Configure Client
-  SSL_CTX_set_min_proto_version(c_ctx, TLS1_3_VERSION);
-  SSL_CTX_set_max_proto_version(c_ctx, TLS1_3_VERSION);
-
-  if (client_conf_path)
-    apply_config(c_ctx, client_conf_path, "client");
+  int c_done = 0, s_done = 0;
+  for (int turn = 0; turn < QUIC_MAX_TURNS && !(c_done && s_done); turn++) {
+    if (!c_done) {
+      size_t s_bytes = st->bytes[1];
+      size_t budget = QUIC_AMPLIFICATION * st->bytes[0];
+      int validated = st->validated;
+      if ((c_done = quic_step(client)) < 0)
+        goto out;
+      if (st->bytes[1] > s_bytes) {
+        st->round_trips++;
+        // Stopped within a datagram of 3x, and the client still waits
+        if (!validated && !c_done &&
+            st->bytes[1] + QUIC_MAX_DATAGRAM > budget)
+          st->stalls++;
+      }
+      if (turn == 0)
+        st->first_flight = st->dgrams[0];
+    }
 
-  if (access("/ssl/client.crt", F_OK) == 0) {
-    SSL_CTX_use_certificate_file(c_ctx, "/ssl/client.crt", SSL_FILETYPE_PEM);
-    if (access("/ssl/client.key", F_OK) == 0)
-      SSL_CTX_use_PrivateKey_file(c_ctx, "/ssl/client.key", SSL_FILETYPE_PEM);
+    SSL_handle_events(listener);
+    if (!server)
+      server = SSL_accept_connection(listener, SSL_ACCEPT_CONNECTION_NO_BLOCK);
+    if (server && !s_done && (s_done = quic_step(server)) < 0)
+      goto out;
   }
-  // Load CA to verify server certificate
-  if (access("/ssl/client-ca.crt", F_OK) == 0) {
-    if (SSL_CTX_load_verify_locations(c_ctx, "/ssl/client-ca.crt", NULL) > 0)
-      SSL_CTX_set_verify(c_ctx, SSL_VERIFY_PEER, NULL);
+  ok = c_done && s_done;
+
+  if (ok && info) {
+    negotiated_group_name(client, info->group, sizeof(info->group));
+    signature_scheme_name(client, server, info->scheme, sizeof(info->scheme));
+    snprintf(info->cipher, sizeof(info->cipher), "%s",
+             SSL_get_cipher_name(client));
+    info->client_hellos = st->client_hellos;
   }
-  log_event("client", "init", "Created TLS 1.3 Client Context");
 
-  // 3. Configure Server
-  SSL_CTX_set_min_proto_version(s_ctx, TLS1_3_VERSION);
-  SSL_CTX_set_max_proto_version(s_ctx, TLS1_3_VERSION);
+out:
+  SSL_free(server);
+  SSL_free(client);
+  SSL_free(listener);
+  BIO_ADDR_free(peer);
+  return ok ? 0 : -1;
+}
 
-  if (server_conf_path)
-    apply_config(s_ctx, server_conf_path, "server");
+static void quic_row(tls_sim_ctx *sim, const char *group, const char *sigalg,
+                     EVP_PKEY *pkey, X509 *cert, int iterations,
+                     unsigned int flags, double *lat) {
+  SSL_CTX *c_ctx = NULL, *s_ctx = NULL;
+  const char *error = matrix_contexts(
+      group, sigalg, pkey, cert, flags, OSSL_QUIC_client_method(),
+      OSSL_QUIC_server_method(), &c_ctx, &s_ctx);
+  if (error) {
+    matrix_row_fail(sim, group, sigalg, error);
+    return;
+  }
+  static const unsigned char alpn[] = {2, 'h', '3'};
+  SSL_CTX_set_alpn_protos(c_ctx, alpn, sizeof(alpn));
+  SSL_CTX_set_alpn_select_cb(s_ctx, quic_alpn_select, NULL);
 
-  if (hsm_mode_enabled()) {
-    /* HSM mode: server private key is generated inside softhsmv3 and
-     * referenced via a pkcs11: URI loaded through pkcs11-provider. The PEM
-     * server.key on disk (if any) is intentionally ignored. */
-    if (hsm_setup_server_credentials(s_ctx) != 0) {
-      log_event("server", "warning",
-                "HSM setup failed; falling back to PEM server cert/key");
-      if (access("/ssl/server.crt", F_OK) == 0)
-        SSL_CTX_use_certificate_file(s_ctx, "/ssl/server.crt", SSL_FILETYPE_PEM);
-      if (access("/ssl/server.key", F_OK) == 0)
-        SSL_CTX_use_PrivateKey_file(s_ctx, "/ssl/server.key", SSL_FILETYPE_PEM);
-    } else if (access("/ssl/hsm-server.crt", F_OK) == 0) {
-      /* HSM succeeded: the server cert is self-signed with ML-DSA-65.
-       * Add it to the client's trust store so the chain-of-trust check passes. */
-      SSL_CTX_load_verify_locations(c_ctx, "/ssl/hsm-server.crt", NULL);
-      SSL_CTX_set_verify(c_ctx, SSL_VERIFY_PEER, NULL);
-      log_event("client", "hsm_ca_loaded",
-                "HSM self-signed cert added to client trust store");
-    }
-  } else {
-    if (access("/ssl/server.crt", F_OK) == 0) {
-      SSL_CTX_use_certificate_file(s_ctx, "/ssl/server.crt", SSL_FILETYPE_PEM);
-    }
-    if (access("/ssl/server.key", F_OK) == 0) {
-      SSL_CTX_use_PrivateKey_file(s_ctx, "/ssl/server.key", SSL_FILETYPE_PEM);
-    }
+  quic_stats st;
+  bench_info info = {"", "", "", 0};
+  if (flags & TLS_SIM_BENCH_WARMUP) {
+    if (quic_handshake(c_ctx, s_ctx, &st, NULL) != 0)
+      error = "Warm-up handshake failed";
   }
-  // Load CA to verify client certificate (mTLS)
-  if (access("/ssl/server-ca.crt", F_OK) == 0) {
-    SSL_CTX_load_verify_locations(s_ctx, "/ssl/server-ca.crt", NULL);
-    STACK_OF(X509_NAME) *list = SSL_load_client_CA_file("/ssl/server-ca.crt");
-    if (list)
-      SSL_CTX_set_client_CA_list(s_ctx, list);
+  double start = now_ms();
+  for (int i = 0; !error && i < iterations; i++) {
+    double t0 = now_ms();
+    if (quic_handshake(c_ctx, s_ctx, &st,
+                       i == iterations - 1 ? &info : NULL) != 0)
+      error = "QUIC handshake failed";
+    lat[i] = now_ms() - t0;
+  }
+  double wall = now_ms() - start;
+  SSL_CTX_free(c_ctx);
+  SSL_CTX_free(s_ctx);
+  if (error) {
+    matrix_row_fail(sim, group, sigalg, error);
+    return;
   }
-  log_event("server", "init", "Created TLS 1.3 Server Context");
-
-  // 4. Connect BIOs
-  c_ssl = SSL_new(c_ctx);
-  s_ssl = SSL_new(s_ctx);
 
-  // Initialize ex_data index if not done
-  // 4. Connect BIOs using Memory BIOs (Manual Pump to capture wire data)
-  BIO *c_wbio = BIO_new(BIO_s_mem()); // Client Writes -> Server Reads
-  BIO *c_rbio = BIO_new(BIO_s_mem()); // Client Reads <- Server Writes
-  BIO *s_wbio = BIO_new(BIO_s_mem()); // Server Writes -> Client Reads
-  BIO *s_rbio = BIO_new(BIO_s_mem()); // Server Reads <- Client Writes
+  // Latency over all iterations, the wire figures of the last handshake
+  char stats[192];
+  format_latency(stats, sizeof(stats), lat, iterations, wall);
+  matrix_appendf(sim,
+      "{\"group\":\"%s\",\"sigalg\":\"%s\",\"status\":\"success\","
+      "\"negotiated_group\":\"%s\",\"signature_scheme\":\"%s\","
+      "\"cipher\":\"%s\",%s,"
+      "\"bytes_per_handshake\":{\"client\":%zu,\"server\":%zu},"
+      "\"hrr\":%s,\"round_trips\":%d,"
+      "\"quic\":{\"datagrams\":{\"client\":%zu,\"server\":%zu},"
+      "\"packets\":{\"client\":{\"initial\":%zu,\"handshake\":%zu,"
+      "\"one_rtt\":%zu},\"server\":{\"initial\":%zu,\"handshake\":%zu,"
+      "\"one_rtt\":%zu}},\"initial_datagrams\":%zu,"
+      "\"amplification_stalls\":%d,\"extra_round_trips\":%d}}",
+      group, sigalg, info.group, info.scheme, info.cipher, stats, st.bytes[0],
+      st.bytes[1], info.client_hellos > 1 ? "true" : "false", st.round_trips,
+      st.dgrams[0], st.dgrams[1], st.initial[0], st.handshake[0],
+      st.one_rtt[0], st.initial[1], st.handshake[1], st.one_rtt[1],
+      st.first_flight, st.stalls, st.round_trips - 1);
+}
+#endif
 
-  SSL_set_bio(c_ssl, c_rbio, c_wbio);
-  SSL_set_bio(s_ssl, s_rbio, s_wbio);
+// Same lists, iterations and flags (WARMUP, MATRIX_HRR) as
+// execute_tls_benchmark_matrix(); rows add a "quic" object. Without QUIC
+// support in the OpenSSL build the whole run fails.
+EMSCRIPTEN_KEEPALIVE
+const char *execute_tls_quic_matrix(const char *groups, const char *sigalgs,
+                                    int iterations, unsigned int flags) {
+  tls_sim_ctx *sim = default_sim();
+#ifndef TLS_SIM_QUIC
+  (void)groups;
+  (void)sigalgs;
+  (void)iterations;
+  (void)flags;
+  return bench_fail(sim, "QUIC requires OpenSSL 3.5 or later", 0);
+#else
+  char names[2][MATRIX_MAX_LIST][MATRIX_NAME_MAX];
+  if (iterations <= 0 || iterations > TLS_SIM_BENCH_MAX_ITERATIONS)
+    return bench_fail(sim, "iterations out of range", 0);
+  int n_groups = matrix_split(groups, names[0]);
+  int n_sigalgs = matrix_split(sigalgs, names[1]);
+  if (n_groups <= 0 || n_sigalgs <= 0)
+    return bench_fail(sim, "group and sigalg lists must name 1-16 entries", 0);
 
-  // Initialize ex_data index if not done
-  BIO_set_mem_eof_return(c_rbio, -1);
-  BIO_set_mem_eof_return(s_rbio, -1);
+  double *lat = malloc((size_t)iterations * sizeof(double));
+  if (!lat)
+    return bench_fail(sim, "out of memory", 0);
 
-  if (ssl_side_ex_data_idx < 0) {
-    ssl_side_ex_data_idx = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+  bench_quiet quiet = bench_quiet_begin(sim);
+  sim->matrix_len = 0;
+  sim->matrix_oom = 0;
+  matrix_appendf(sim,
+                 "{\"status\":\"success\",\"transport\":\"quic\","
+                 "\"iterations\":%d,\"rows\":[",
+                 iterations);
+  for (int s = 0; s < n_sigalgs; s++) {
+    const char *sigalg = names[1][s];
+    EVP_PKEY *pkey = matrix_keygen(sigalg);
+    X509 *cert = pkey ? matrix_self_signed(pkey, sigalg) : NULL;
+    for (int g = 0; g < n_groups; g++) {
+      if (s || g)
+        matrix_appendf(sim, ",");
+      if (!cert)
+        matrix_row_fail(sim, names[0][g], sigalg,
+                        "Failed to generate server credentials");
+      else
+        quic_row(sim, names[0][g], sigalg, pkey, cert, iterations, flags,
+                 lat);
+    }
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
   }
+  matrix_appendf(sim, "]}");
+  bench_quiet_end(sim, quiet);
+  free(lat);
 
-  // Set side identifier on each SSL object
-  SSL_set_ex_data(c_ssl, ssl_side_ex_data_idx, (void *)"client");
-  SSL_set_ex_data(s_ssl, ssl_side_ex_data_idx, (void *)"server");
+  if (sim->matrix_oom)
+    return bench_fail(sim, "out of memory", 0);
+  return sim->matrix_result;
+#endif
+}
 
-  // 5. Handshake
-  SSL_set_connect_state(c_ssl);
-  SSL_set_accept_state(s_ssl);
+/* ── Connection-burst load ───────────────────────────────────────────────────
+ * K clients connect to one server SSL_CTX at the same instant. Every
+ * connection keeps its own four memory BIOs; a single FIFO run queue plays
+ * the event loop, handing each side its turn whenever the peer has flushed
+ * bytes to it, so handshakes interleave the way they would on a
+ * single-threaded server. Tracing is off, as for the benchmark. */
+#define TLS_SIM_LOAD_MAX_CONNECTIONS 10000
 
-  // Setup Info Callbacks for handshake state logging
-  SSL_set_info_callback(c_ssl, info_callback);
-  SSL_set_info_callback(s_ssl, info_callback);
+typedef struct {
+  SSL *ssl[2]; // 0 = client, 1 = server
+  BIO *wbio[2];
+  BIO *rbio[2];
+  double done_ms; // completion time since the burst started, < 0 = pending
+  int failed;
+} load_conn;
 
-  // Setup Message Callback for HRR detection
-  SSL_CTX_set_msg_callback(c_ctx, msg_callback);
-  SSL_CTX_set_msg_callback(s_ctx, msg_callback);
+// Bytes currently allocated through malloc, for the peak-heap figure; 0
+// where the C library has no mallinfo (the figure is reported as null).
+static size_t heap_in_use(void) {
+#if !defined(TLS_SIM_HEAP_STATS)
+  return 0;
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  return mallinfo2().uordblks;
+#else
+  return (size_t)mallinfo().uordblks;
+#endif
+}
 
-  // Setup Keylogging
-  SSL_CTX_set_keylog_callback(c_ctx, keylog_callback);
-  SSL_CTX_set_keylog_callback(s_ctx, keylog_callback);
+static int load_conn_open(load_conn *lc, SSL_CTX *c_ctx, SSL_CTX *s_ctx) {
+  lc->done_ms = -1;
+  lc->failed = 0;
+  for (int side = 0; side < 2; side++) {
+    lc->ssl[side] = SSL_new(side ? s_ctx : c_ctx);
+    lc->wbio[side] = BIO_new(BIO_s_mem());
+    lc->rbio[side] = BIO_new(BIO_s_mem());
+    if (!lc->ssl[side] || !lc->wbio[side] || !lc->rbio[side]) {
+      BIO_free(lc->wbio[side]);
+      BIO_free(lc->rbio[side]);
+      SSL_free(lc->ssl[side]);
+      lc->ssl[side] = NULL;
+      return -1;
+    }
+    BIO_set_mem_eof_return(lc->rbio[side], -1);
+    SSL_set_bio(lc->ssl[side], lc->rbio[side], lc->wbio[side]);
+  }
+  SSL_set_connect_state(lc->ssl[0]);
+  SSL_set_accept_state(lc->ssl[1]);
+  return 0;
+}
 
-  // Setup Tracing (Global)
-  // We use a trick: trace_callback uses 'current_side' global variable
-  OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_TLS, trace_callback, NULL);
-  OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_TLS_CIPHER, trace_callback, NULL);
-  // OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_INIT, trace_callback, NULL); //
-  // Too verbose
-  OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_DECODER, trace_callback, NULL);
-  OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_ENCODER, trace_callback, NULL);
-  OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_PROVIDER, trace_callback, NULL);
-  OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_QUERY, trace_callback, NULL);
-  OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_STORE, trace_callback, NULL);
-  OSSL_trace_set_callback(OSSL_TRACE_CATEGORY_X509V3_POLICY, trace_callback,
-                          NULL);
+// Run `connections` simultaneous handshakes against one server context and
+// return
+//   {"status","connections","completed","group","cipher",
+//    "latency_ms":{...},"handshakes_per_sec","makespan_ms",
+//    "server_cpu_ms":{"total","per_connection"},
+//    "peak_heap_bytes","heap_bytes_per_connection",
+//    "bytes_per_connection":{"client","server"}}
+// The heap figures are null where the C library has no mallinfo (non-glibc
+// native builds).
+// latency_ms is each handshake's completion time measured from the start of
+// the burst, less the time spent sampling the heap after each turn. Client
+// and server share the thread, so it includes client work; server_cpu_ms
+// counts only the server's SSL_do_handshake calls (wall time under
+// Emscripten, which has no per-thread CPU clock). The string is valid until
+// the next call.
+EMSCRIPTEN_KEEPALIVE
+const char *execute_tls_load(const char *client_conf_path,
+                             const char *server_conf_path, int connections) {
+  tls_sim_ctx *sim = default_sim();
+  if (connections <= 0 || connections > TLS_SIM_LOAD_MAX_CONNECTIONS)
+    return bench_fail(sim, "connections out of range", 0);
 
-  int steps = 0;
-  int handshake_done = 0;
-  while (steps < 20 && !handshake_done) {
-    steps++;
-    // Pump data between BIOs
-    pump_flash_drive(c_wbio, s_rbio, "client");
-    pump_flash_drive(s_wbio, c_rbio, "server");
+  bench_quiet quiet = bench_quiet_begin(sim);
+  SSL_CTX *c_ctx = NULL, *s_ctx = NULL;
+  if (acquire_contexts(sim, client_conf_path, server_conf_path, &c_ctx, &s_ctx,
+                       0) != 0) {
+    bench_quiet_end(sim, quiet);
+    return bench_fail(sim, "Failed to create SSL contexts", 0);
+  }
 
-    int c_done = SSL_is_init_finished(c_ssl);
-    int s_done = SSL_is_init_finished(s_ssl);
+  // Run queue of (connection, side) turns; each side is queued at most once,
+  // so 2K slots suffice for the ring.
+  size_t heap_base = heap_in_use(), heap_peak = heap_base;
+  load_conn *conns = calloc((size_t)connections, sizeof(load_conn));
+  int *queue = malloc(2 * (size_t)connections * sizeof(int));
+  unsigned char *queued = calloc(2 * (size_t)connections, 1);
+  double *lat = malloc((size_t)connections * sizeof(double));
+  const char *error = NULL;
+  char msg[64];
+  int opened = 0, completed = 0, failed = 0;
+  size_t c_bytes = 0, s_bytes = 0;
+  double server_cpu = 0, makespan = 0;
+  double paused = 0; // heap sampling, kept out of the timings
+  bench_info info = {"", "", "", 0};
 
-    if (!c_done) {
-      current_side = "client";
-      int r = SSL_do_handshake(c_ssl);
-      if (r <= 0) {
-        int err = SSL_get_error(c_ssl, r);
-        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
-          char msg[512];
-          char ssl_err[256];
-          ERR_error_string_n(ERR_get_error(), ssl_err, sizeof(ssl_err));
-          snprintf(msg, sizeof(msg), "Client handshake error: %d - %s", err,
-                   ssl_err);
-          log_event("client", "error", msg);
+  if (!conns || !queue || !queued || !lat) {
+    error = "out of memory";
+    goto out;
+  }
+  for (; opened < connections; opened++)
+    if (load_conn_open(&conns[opened], c_ctx, s_ctx) != 0) {
+      error = "out of memory";
+      goto out;
+    }
 
-          // Check for certificate verification error and log explanation
-          long verify_err = SSL_get_verify_result(c_ssl);
-          if (verify_err != X509_V_OK) {
-            const char *explanation = get_cert_verify_explanation(verify_err);
-            if (explanation) {
-              log_event("client", "cert_verify_error", explanation);
-            } else {
-              char verify_msg[256];
-              snprintf(verify_msg, sizeof(verify_msg),
-                       "Certificate verification failed: %s",
-                       X509_verify_cert_error_string(verify_err));
-              log_event("client", "cert_verify_error", verify_msg);
-            }
-          }
+  size_t head = 0, tail = 0, cap = 2 * (size_t)connections;
+  for (int i = 0; i < connections; i++) {
+    queue[tail++ % cap] = 2 * i; // every client sends its ClientHello first
+    queued[2 * i] = 1;
+  }
 
-          close_log("failed", "Client handshake failed");
-          goto cleanup;
-        }
+  double start = now_ms();
+  while (head != tail) {
+    int turn = queue[head++ % cap];
+    queued[turn] = 0;
+    load_conn *lc = &conns[turn / 2];
+    int side = turn % 2;
+    if (lc->failed || lc->done_ms >= 0)
+      continue;
+
+    SSL *ssl = lc->ssl[side];
+    if (!SSL_is_init_finished(ssl)) {
+      double cpu0 = side ? cpu_now_ms() : 0;
+      int r = SSL_do_handshake(ssl);
+      if (side)
+        server_cpu += cpu_now_ms() - cpu0;
+      if (r <= 0 && SSL_get_error(ssl, r) != SSL_ERROR_WANT_READ) {
+        lc->failed = 1;
+        failed++;
+        continue;
       }
     }
-    if (!s_done) {
-      current_side = "server";
-      int r = SSL_do_handshake(s_ssl);
-      if (r <= 0) {
-        int err = SSL_get_error(s_ssl, r);
-        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
-          char msg[512];
-          char ssl_err[256];
-          ERR_error_string_n(ERR_get_error(), ssl_err, sizeof(ssl_err));
-          snprintf(msg, sizeof(msg), "Server handshake error: %d - %s", err,
-                   ssl_err);
-          log_event("server", "error", msg);
 
-          // Check for certificate verification error (mTLS client cert
-          // validation)
-          long verify_err = SSL_get_verify_result(s_ssl);
-          if (verify_err != X509_V_OK) {
-            const char *explanation = get_cert_verify_explanation(verify_err);
-            if (explanation) {
-              log_event("server", "cert_verify_error", explanation);
-            } else {
-              char verify_msg[256];
-              snprintf(verify_msg, sizeof(verify_msg),
-                       "Client certificate verification failed: %s",
-                       X509_verify_cert_error_string(verify_err));
-              log_event("server", "cert_verify_error", verify_msg);
-            }
-          }
+    // Deliver this side's flight; the peer gets a turn once bytes arrive
+    int n =
+        pump_flash_drive(sim, NULL, lc->wbio[side], lc->rbio[!side], "load");
+    if (side)
+      s_bytes += (size_t)n;
+    else
+      c_bytes += (size_t)n;
+    if (n > 0 && !queued[turn ^ 1]) {
+      queue[tail++ % cap] = turn ^ 1;
+      queued[turn ^ 1] = 1;
+    }
 
-          close_log("failed", "Server handshake failed");
-          goto cleanup;
-        }
+    if (SSL_is_init_finished(lc->ssl[0]) && SSL_is_init_finished(lc->ssl[1])) {
+      lc->done_ms = now_ms() - start - paused;
+      lat[completed++] = lc->done_ms;
+      if (completed == connections) {
+        negotiated_group_name(lc->ssl[0], info.group, sizeof(info.group));
+        snprintf(info.cipher, sizeof(info.cipher), "%s",
+                 SSL_get_cipher_name(lc->ssl[0]));
       }
     }
+#ifdef TLS_SIM_HEAP_STATS
+    // mallinfo walks every arena under its lock; stop the clock meanwhile.
+    double h0 = now_ms();
+    size_t heap = heap_in_use();
+    if (heap > heap_peak)
+      heap_peak = heap;
+    paused += now_ms() - h0;
+#endif
+  }
+  makespan = now_ms() - start - paused;
 
-    if (SSL_is_init_finished(c_ssl) && SSL_is_init_finished(s_ssl)) {
-      handshake_done = 1;
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Negotiated: %s", SSL_get_cipher_name(c_ssl));
-      log_event("connection", "established", msg);
+  if (completed < connections) {
+    snprintf(msg, sizeof(msg), "%d of %d handshakes failed",
+             failed ? failed : connections - completed, connections);
+    error = msg;
+  }
 
-      // Log HRR status and round-trip count
-      if (hrr_detected) {
-        log_event("connection", "hello_retry_summary",
-                  "HelloRetryRequest occurred: handshake used 2-RTT (group "
-                  "mismatch between initial ClientHello and server preference)");
-        log_event("connection", "round_trips", "2");
-      } else {
-        log_event("connection", "round_trips", "1");
-      }
+out:
+  for (int i = 0; i < opened; i++) {
+    SSL_free(conns[i].ssl[0]);
+    SSL_free(conns[i].ssl[1]);
+  }
+  free(conns);
+  free(queue);
+  free(queued);
+  SSL_CTX_free(c_ctx);
+  SSL_CTX_free(s_ctx);
+  bench_quiet_end(sim, quiet);
 
-      // Log the negotiated key exchange group (X25519, P-256, ML-KEM, Hybrid,
-      // etc.)
-      int group_nid = SSL_get_negotiated_group(c_ssl);
+  if (error) {
+    free(lat);
+    return bench_fail(sim, error, completed);
+  }
 
-      char group_debug[128];
-      snprintf(group_debug, sizeof(group_debug), "Debug: Group NID=%d",
-               group_nid);
-      log_event("connection", "debug", group_debug);
+  char stats[192];
+  format_latency(stats, sizeof(stats), lat, completed, makespan);
+  free(lat);
+  char heap[96] = "\"peak_heap_bytes\":null,\"heap_bytes_per_connection\":null";
+#ifdef TLS_SIM_HEAP_STATS
+  size_t heap_delta = heap_peak - heap_base;
+  snprintf(heap, sizeof(heap),
+           "\"peak_heap_bytes\":%zu,\"heap_bytes_per_connection\":%zu",
+           heap_delta, heap_delta / (size_t)connections);
+#endif
+  snprintf(sim->bench_result, sizeof(sim->bench_result),
+           "{\"status\":\"success\",\"connections\":%d,\"completed\":%d,"
+           "\"group\":\"%s\",\"cipher\":\"%s\",%s,\"makespan_ms\":%.3f,"
+           "\"server_cpu_ms\":{\"total\":%.3f,\"per_connection\":%.4f},%s,"
+           "\"bytes_per_connection\":{\"client\":%zu,\"server\":%zu}}",
+           connections, completed, info.group, info.cipher, stats, makespan,
+           server_cpu, server_cpu / connections, heap,
+           c_bytes / (size_t)connections, s_bytes / (size_t)connections);
+  return sim->bench_result;
+}
 
-      if (group_nid > 0) {
-        // Use SSL_group_to_name (OpenSSL 3.x API) - works for PQC/Hybrid groups
-        const char *group_name = SSL_group_to_name(c_ssl, group_nid);
-        char group_msg[128];
-        if (group_name && strlen(group_name) > 0) {
-          snprintf(group_msg, sizeof(group_msg), "Key Exchange: %s",
-                   group_name);
-        } else {
-          // Final fallback: raw NID (should rarely happen with
-          // SSL_group_to_name)
-          snprintf(group_msg, sizeof(group_msg), "Key Exchange: NID-%d",
-                   group_nid);
-        }
-        log_event("connection", "key_exchange", group_msg);
-      } else {
-        log_event("connection", "debug", "Debug: No negotiated group (NID<=0)");
-      }
+#ifdef TLS_SIM_SOCKETS
+/* ── Kernel TLS ──────────────────────────────────────────────────────────────
+ * Native Linux only. Client and server talk over a loopback TCP connection
+ * instead of memory BIOs, because the kernel's "tls" ULP only attaches to
+ * TCP sockets. With SSL_OP_ENABLE_KTLS set, OpenSSL hands the traffic keys to
+ * the kernel once the handshake completes. The server then streams a payload
+ * with SSL_sendfile(), straight from a file into the socket. The same
+ * transfer is repeated over a second connection without the option (read +
+ * SSL_write in user space) for comparison. Offload silently stays off when
+ * OpenSSL was built without kTLS, the tls module isn't loaded or the kernel
+ * lacks the cipher suite; the kTLS run then falls back to the user-space
+ * path, and the per-direction flags in the result show what engaged. */
+#define KTLS_HANDSHAKE_POLL_MS 1000
 
-      // Log the negotiated TLS 1.3 signature scheme as a human-readable name.
-      // SSL_get_peer_signature_nid() returns the HASH NID (e.g. NID_sha256=672),
-      // not the scheme.  We combine the hash NID with the key type NID and the
-      // peer cert pubkey type to reconstruct the full scheme name.
-      int hash_nid = 0, type_nid = 0;
-      SSL_get_peer_signature_nid(c_ssl, &hash_nid);
-      SSL_get_peer_signature_type_nid(c_ssl, &type_nid);
-
-      // Fallback: server's own sig nids
-      if (hash_nid == 0) SSL_get_signature_nid(s_ssl, &hash_nid);
-      if (type_nid == 0) SSL_get_signature_type_nid(s_ssl, &type_nid);
-
-      // Resolve peer public key type from the server cert (most reliable for PQC)
-      X509 *srv_cert = SSL_get_certificate(s_ssl); // non-owning
-      EVP_PKEY *srv_pkey = srv_cert ? X509_get0_pubkey(srv_cert) : NULL;
-      const char *pkey_type = srv_pkey ? EVP_PKEY_get0_type_name(srv_pkey) : NULL;
-
-      // Map hash NID → lowercase suffix
-      const char *hash_sfx = NULL;
-      if      (hash_nid == NID_sha224) hash_sfx = "sha224";
-      else if (hash_nid == NID_sha256) hash_sfx = "sha256";
-      else if (hash_nid == NID_sha384) hash_sfx = "sha384";
-      else if (hash_nid == NID_sha512) hash_sfx = "sha512";
-
-      char scheme[128] = "";
-
-      // ML-DSA — pkey type name IS the algorithm, no hash suffix
-      if (pkey_type && (strstr(pkey_type, "ML-DSA") || strstr(pkey_type, "MLDSA"))) {
-        if      (strstr(pkey_type, "44")) snprintf(scheme, sizeof(scheme), "mldsa44");
-        else if (strstr(pkey_type, "65")) snprintf(scheme, sizeof(scheme), "mldsa65");
-        else if (strstr(pkey_type, "87")) snprintf(scheme, sizeof(scheme), "mldsa87");
-        else snprintf(scheme, sizeof(scheme), "%s", pkey_type);
-      }
-      // SLH-DSA — similarly no separate hash suffix in the scheme name
-      else if (pkey_type && strstr(pkey_type, "SLH-DSA")) {
-        snprintf(scheme, sizeof(scheme), "%s", pkey_type);
-      }
-      // EdDSA — no hash suffix
-      else if (type_nid == EVP_PKEY_ED25519 ||
-               (pkey_type && strcmp(pkey_type, "ED25519") == 0)) {
-        snprintf(scheme, sizeof(scheme), "ed25519");
-      }
-      else if (type_nid == EVP_PKEY_ED448 ||
-               (pkey_type && strcmp(pkey_type, "ED448") == 0)) {
-        snprintf(scheme, sizeof(scheme), "ed448");
-      }
-      // RSA-PSS (TLS 1.3 always uses PSS for RSA)
-      else if (type_nid == EVP_PKEY_RSA_PSS ||
-               (pkey_type && strcmp(pkey_type, "RSA") == 0)) {
-        if (hash_sfx)
-          snprintf(scheme, sizeof(scheme), "rsa_pss_rsae_%s", hash_sfx);
-        else
-          snprintf(scheme, sizeof(scheme), "rsa_pss_rsae_nid%d", hash_nid);
-      }
-      // ECDSA — derive curve from key bits
-      else if (type_nid == EVP_PKEY_EC ||
-               (pkey_type && strcmp(pkey_type, "EC") == 0)) {
-        const char *curve = "secp256r1"; // default
-        if (srv_pkey) {
-          int bits = EVP_PKEY_get_bits(srv_pkey);
-          if (bits == 384) curve = "secp384r1";
-          else if (bits == 521) curve = "secp521r1";
-        }
-        if (hash_sfx)
-          snprintf(scheme, sizeof(scheme), "ecdsa_%s_%s", curve, hash_sfx);
-        else
-          snprintf(scheme, sizeof(scheme), "ecdsa_%s_nid%d", curve, hash_nid);
-      }
-      // Unknown — show type + hash NIDs
-      else {
-        snprintf(scheme, sizeof(scheme), "type%d_hash%d", type_nid, hash_nid);
-      }
+#ifndef OPENSSL_NO_KTLS
+#define KTLS_COMPILED 1
+#define KTLS_TX(ssl) (BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0)
+#define KTLS_RX(ssl) (BIO_get_ktls_recv(SSL_get_rbio(ssl)) > 0)
+#else
+#define KTLS_COMPILED 0
+#define KTLS_TX(ssl) 0
+#define KTLS_RX(ssl) 0
+#endif
 
-      char sig_msg[160];
-      snprintf(sig_msg, sizeof(sig_msg), "Peer Signature Algorithm: %s", scheme);
-      log_event("connection", "signature_algorithm", sig_msg);
+typedef struct {
+  SSL *ssl[2]; // 0 = client, 1 = server
+  int fd[2];
+} ktls_conn;
+
+static void ktls_conn_close(ktls_conn *kc) {
+  for (int side = 0; side < 2; side++) {
+    SSL_free(kc->ssl[side]);
+    if (kc->fd[side] >= 0)
+      close(kc->fd[side]);
+  }
+}
+
+// Connect and handshake; both ends share this thread, so the sockets are
+// non-blocking until the handshake is done and blocking afterwards.
+static int ktls_conn_open(ktls_conn *kc, SSL_CTX *c_ctx, SSL_CTX *s_ctx,
+                          int ktls) {
+  kc->ssl[0] = kc->ssl[1] = NULL;
+  if (tcp_loopback_pair(kc->fd) != 0)
+    return -1;
+  for (int side = 0; side < 2; side++) {
+    SSL *ssl = kc->ssl[side] = SSL_new(side ? s_ctx : c_ctx);
+    if (!ssl || !SSL_set_fd(ssl, kc->fd[side]))
+      return -1;
+    if (ktls)
+      SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+    else
+      SSL_clear_options(ssl, SSL_OP_ENABLE_KTLS);
+    set_blocking(kc->fd[side], 0);
+  }
+  SSL_set_connect_state(kc->ssl[0]);
+  SSL_set_accept_state(kc->ssl[1]);
+
+  for (int step = 0; step < BENCH_MAX_STEPS; step++) {
+    int done = 1;
+    for (int side = 0; side < 2; side++) {
+      int r = SSL_do_handshake(kc->ssl[side]);
+      if (r == 1)
+        continue;
+      int err = SSL_get_error(kc->ssl[side], r);
+      if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+        return -1;
+      done = 0;
     }
+    if (done) {
+      set_blocking(kc->fd[0], 1);
+      set_blocking(kc->fd[1], 1);
+      return 0;
+    }
+    // Wait for the peer's flight rather than spinning
+    struct pollfd pfd[2] = {{kc->fd[0], POLLIN, 0}, {kc->fd[1], POLLIN, 0}};
+    if (poll(pfd, 2, KTLS_HANDSHAKE_POLL_MS) <= 0)
+      return -1;
   }
+  return -1;
+}
 
-  if (!handshake_done) {
-    log_event("connection", "error", "Handshake not completed after max steps");
-    close_log("failed", "Handshake timeout");
-    goto cleanup;
+typedef struct {
+  SSL *ssl;
+  int fd[2]; // client's and server's sockets
+  size_t expect;
+  size_t received;
+  int failed;
+} ktls_reader;
+
+static void *ktls_read_all(void *arg) {
+  ktls_reader *rd = arg;
+  unsigned char buf[SSL3_RT_MAX_PLAIN_LENGTH];
+  size_t n = 0;
+  while (rd->received < rd->expect) {
+    if (!SSL_read_ex(rd->ssl, buf, sizeof(buf), &n)) {
+      rd->failed = 1;
+      // The writer would block on full socket buffers forever; shutting the
+      // sockets down fails its next (or current) send with EPIPE.
+      shutdown(rd->fd[0], SHUT_RDWR);
+      shutdown(rd->fd[1], SHUT_RDWR);
+      break;
+    }
+    rd->received += n;
   }
+  return NULL;
+}
 
-  // 6. Post-Handshake Script Processing
-  if (script_path && access(script_path, F_OK) == 0) {
-    FILE *f = fopen(script_path, "r");
-    if (f) {
-      char line[1024];
-      while (fgets(line, sizeof(line), f)) {
-        // Strip newline
-        line[strcspn(line, "\n")] = 0;
-        if (strlen(line) == 0)
-          continue;
+// Stream `bytes` of `file` from the server while a second thread reads them
+// on the client. Returns the ms until the last byte was read, < 0 on error.
+// SIGPIPE is blocked meanwhile (the reader thread inherits the mask): the
+// socket BIO writes without MSG_NOSIGNAL, and a failed reader shuts the
+// connection down under the writer.
+static double ktls_stream(ktls_conn *kc, int file, size_t bytes,
+                          int use_sendfile) {
+  ktls_reader rd = {kc->ssl[0], {kc->fd[0], kc->fd[1]}, bytes, 0, 0};
+  unsigned char *buf = use_sendfile ? NULL : malloc(BULK_CHUNK_DEFAULT);
+  sigset_t pipe_set, saved;
+  sigemptyset(&pipe_set);
+  sigaddset(&pipe_set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_set, &saved);
+  pthread_t reader;
+  if ((!use_sendfile && !buf) ||
+      pthread_create(&reader, NULL, ktls_read_all, &rd) != 0) {
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    free(buf);
+    return -1;
+  }
 
-        if (strncmp(line, "CLIENT_SEND:", 12) == 0) {
-          const char *msg = line + 12;
-          current_side = "client";
-          // Log the message being sent (before encryption)
-          char send_msg[4200];
-          snprintf(send_msg, sizeof(send_msg), "Sending: %s", msg);
-          log_event("client", "message_sent", send_msg);
-          SSL_write(c_ssl, msg, strlen(msg));
+  size_t sent = 0;
+  int failed = 0;
+  double start = now_ms();
+  while (sent < bytes && !failed) {
+    if (use_sendfile) {
+      ossl_ssize_t w =
+          SSL_sendfile(kc->ssl[1], file, (off_t)sent, bytes - sent, 0);
+      if (w <= 0)
+        failed = 1;
+      else
+        sent += (size_t)w;
+    } else {
+      size_t n = bytes - sent < BULK_CHUNK_DEFAULT ? bytes - sent
+                                                   : BULK_CHUNK_DEFAULT;
+      size_t w = 0;
+      if (pread(file, buf, n, (off_t)sent) != (ssize_t)n ||
+          !SSL_write_ex(kc->ssl[1], buf, n, &w))
+        failed = 1;
+      else
+        sent += w;
+    }
+  }
+  if (failed)
+    shutdown(kc->fd[1], SHUT_RDWR); // wake the reader
+  pthread_join(reader, NULL);
+  double ms = now_ms() - start;
+  // Consume a SIGPIPE raised on this thread before unblocking it.
+  sigset_t pending;
+  const struct timespec no_wait = {0, 0};
+  if (sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) &&
+      !sigismember(&saved, SIGPIPE))
+    sigtimedwait(&pipe_set, NULL, &no_wait);
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+  free(buf);
+  return failed || rd.failed ? -1 : ms;
+}
 
-          // Move data from Client Write BIO to Server Read BIO
-          pump_flash_drive(c_wbio, s_rbio, "client");
+// Transfer `bytes` from server to client over loopback TCP, once with kernel
+// TLS requested and once without, and return
+//   {"status","bytes","group","cipher",
+//    "ktls":{"compiled","client_tx","client_rx","server_tx","server_rx",
+//            "sendfile","ms","mb_per_sec"},
+//    "userspace":{"ms","mb_per_sec"},"speedup"}
+// where the *_tx / *_rx flags say whether the kernel took over that
+// direction and "sendfile" whether SSL_sendfile() was usable. MB/s is 10^6
+// payload bytes per second. The string is valid until the next call.
+const char *execute_tls_ktls(const char *client_conf_path,
+                             const char *server_conf_path, size_t bytes) {
+  tls_sim_ctx *sim = default_sim();
+  if (bytes == 0 || bytes > BULK_MAX_BYTES)
+    return bench_fail(sim, "bytes out of range", 0);
 
-          // Server needs to read it
-          process_reads(s_ssl, "server");
-        } else if (strncmp(line, "SERVER_SEND:", 12) == 0) {
-          const char *msg = line + 12;
-          current_side = "server";
-          // Log the message being sent (before encryption)
-          char send_msg[4200];
-          snprintf(send_msg, sizeof(send_msg), "Sending: %s", msg);
-          log_event("server", "message_sent", send_msg);
-          SSL_write(s_ssl, msg, strlen(msg));
+  bench_quiet quiet = bench_quiet_begin(sim);
+  SSL_CTX *c_ctx = NULL, *s_ctx = NULL;
+  if (acquire_contexts(sim, client_conf_path, server_conf_path, &c_ctx, &s_ctx,
+                       0) != 0) {
+    bench_quiet_end(sim, quiet);
+    return bench_fail(sim, "Failed to create SSL contexts", 0);
+  }
 
-          // Move data from Server Write BIO to Client Read BIO
-          pump_flash_drive(s_wbio, c_rbio, "server");
+  // The payload lives in an unlinked temporary file for sendfile(2)
+  const char *error = NULL;
+  FILE *payload = tmpfile();
+  unsigned char block[4096];
+  for (size_t i = 0; i < sizeof(block); i++)
+    block[i] = (unsigned char)i;
+  for (size_t left = bytes; payload && left > 0;) {
+    size_t n = left < sizeof(block) ? left : sizeof(block);
+    if (fwrite(block, 1, n, payload) != n)
+      break;
+    left -= n;
+  }
+  if (!payload || fflush(payload) != 0 || ftell(payload) != (long)bytes)
+    error = "Failed to create the payload file";
 
-          // Client needs to read it
-          process_reads(c_ssl, "client");
-        } else if (strcmp(line, "CLIENT_DISCONNECT") == 0) {
-          log_event("client", "action", "Sending close_notify");
-          SSL_shutdown(c_ssl);                    // Send close_notify
-          int r = process_reads(s_ssl, "server"); // Server receives it
-          // Server should technically respond with close_notify
-          if (r == -1)
-            SSL_shutdown(s_ssl);
-        } else if (strcmp(line, "SERVER_DISCONNECT") == 0) {
-          log_event("server", "action", "Sending close_notify");
-          SSL_shutdown(s_ssl);
-          int r = process_reads(c_ssl, "client");
-          if (r == -1)
-            SSL_shutdown(c_ssl);
-        }
-      }
-      fclose(f);
+  ktls_conn kc = {{NULL, NULL}, {-1, -1}};
+  int tx[2] = {0, 0}, rx[2] = {0, 0}, use_sendfile = 0;
+  double ktls_ms = -1, user_ms = -1;
+  bench_info info = {"", "", "", 0};
+  if (!error && ktls_conn_open(&kc, c_ctx, s_ctx, 1) != 0)
+    error = "kTLS handshake failed";
+  if (!error) {
+    for (int side = 0; side < 2; side++) {
+      tx[side] = KTLS_TX(kc.ssl[side]);
+      rx[side] = KTLS_RX(kc.ssl[side]);
     }
+    use_sendfile = tx[1]; // SSL_sendfile() needs kTLS transmit
+    negotiated_group_name(kc.ssl[0], info.group, sizeof(info.group));
+    snprintf(info.cipher, sizeof(info.cipher), "%s",
+             SSL_get_cipher_name(kc.ssl[0]));
+    ktls_ms = ktls_stream(&kc, fileno(payload), bytes, use_sendfile);
+    if (ktls_ms < 0)
+      error = "kTLS transfer failed";
   }
+  ktls_conn_close(&kc);
 
-  close_log("success", NULL);
+  ktls_conn plain = {{NULL, NULL}, {-1, -1}};
+  if (!error && ktls_conn_open(&plain, c_ctx, s_ctx, 0) != 0)
+    error = "Handshake failed";
+  if (!error && (user_ms = ktls_stream(&plain, fileno(payload), bytes, 0)) < 0)
+    error = "User-space transfer failed";
+  ktls_conn_close(&plain);
 
-cleanup:
-  if (c_ssl)
-    SSL_free(c_ssl);
-  if (s_ssl)
-    SSL_free(s_ssl);
-  if (c_ctx)
-    SSL_CTX_free(c_ctx);
-  if (s_ctx)
-    SSL_CTX_free(s_ctx);
+  if (payload)
+    fclose(payload);
+  SSL_CTX_free(c_ctx);
+  SSL_CTX_free(s_ctx);
+  bench_quiet_end(sim, quiet);
+  if (error)
+    return bench_fail(sim, error, 0);
 
-  return log_buffer;
+  double ktls_mbps = ktls_ms > 0 ? (double)bytes / 1e3 / ktls_ms : 0;
+  double user_mbps = user_ms > 0 ? (double)bytes / 1e3 / user_ms : 0;
+  snprintf(sim->bench_result, sizeof(sim->bench_result),
+           "{\"status\":\"success\",\"bytes\":%zu,\"group\":\"%s\","
+           "\"cipher\":\"%s\",\"ktls\":{\"compiled\":%s,\"client_tx\":%s,"
+           "\"client_rx\":%s,\"server_tx\":%s,\"server_rx\":%s,"
+           "\"sendfile\":%s,\"ms\":%.3f,\"mb_per_sec\":%.1f},"
+           "\"userspace\":{\"ms\":%.3f,\"mb_per_sec\":%.1f},"
+           "\"speedup\":%.2f}",
+           bytes, info.group, info.cipher, KTLS_COMPILED ? "true" : "false",
+           tx[0] ? "true" : "false", rx[0] ? "true" : "false",
+           tx[1] ? "true" : "false", rx[1] ? "true" : "false",
+           use_sendfile ? "true" : "false", ktls_ms, ktls_mbps, user_ms,
+           user_mbps, user_mbps > 0 ? ktls_mbps / user_mbps : 0);
+  return sim->bench_result;
 }
+#endif
 
 // Dummy CMP functions to satisfy linker
 typedef struct options_st {
@@ -0,0 +1,155 @@
+/*
+ * tls_simulation.h — public API of the TLS 1.3 simulator.
+ *
+ * The same functions are exported from the WASM build (called from
+ * openssl.worker.ts via cwrap) and linked by native drivers such as
+ * tls_sim_cli.c.
+ */
+#ifndef TLS_SIMULATION_H
+#define TLS_SIMULATION_H
+
+#include <stddef.h>
+
+/* Event categories for tls_simulation_set_event_mask(). */
+#define TLS_SIM_EV_STATE 0x0001           // handshake_start/state/done
+#define TLS_SIM_EV_MSG 0x0002             // handshake_msg (msg_callback)
+#define TLS_SIM_EV_KEYLOG 0x0004          // keylog secrets
+#define TLS_SIM_EV_WIRE 0x0008            // wire_data hex dumps
+#define TLS_SIM_EV_TRACE_TLS 0x0010       // crypto_trace_state
+#define TLS_SIM_EV_TRACE_CIPHER 0x0020    // crypto_trace_data
+#define TLS_SIM_EV_TRACE_PROVIDER 0x0040  // crypto_trace_provider
+#define TLS_SIM_EV_TRACE_EVP 0x0080       // crypto_trace_evp (QUERY, STORE)
+#define TLS_SIM_EV_TRACE_CODER 0x0100     // crypto_trace_coder
+#define TLS_SIM_EV_TRACE_POLICY 0x0200    // crypto_trace_other (X509V3_POLICY)
+#define TLS_SIM_EV_RECORD 0x0400          // tls_record, handshake_message,
+                                          // record_summary + raw capture buffer
+#define TLS_SIM_EV_TIMING 0x0800          // per-phase handshake_timing summary
+#define TLS_SIM_EV_ALL 0x0FFF
+
+/* Modes for tls_simulation_set_wire_capture(). */
+#define WIRE_CAPTURE_NONE 0
+#define WIRE_CAPTURE_HEAD 1
+#define WIRE_CAPTURE_FULL 2
+
+/* Flags for execute_tls_benchmark(). */
+#define TLS_SIM_BENCH_WARMUP 0x1   // one untimed handshake first (with
+                                   // NEW_CTX, on its own untimed contexts)
+#define TLS_SIM_BENCH_NEW_CTX 0x2  // rebuild both contexts per handshake, timed
+#define TLS_SIM_BENCH_MATRIX_HRR 0x4  // matrix: client key share is X25519
+#define TLS_SIM_BENCH_OWN_CTX 0x8  // contexts private to the run, not cached
+
+/* Modes for tls_simulation_set_resumption(). */
+#define TLS_SIM_RESUME_OFF 0
+#define TLS_SIM_RESUME_PSK_DHE 1  // resume with psk_dhe_ke (fresh key share)
+#define TLS_SIM_RESUME_PSK 2      // resume with psk_ke where the server allows
+
+/* Transports for tls_simulation_set_transport(). */
+#define TLS_SIM_TRANSPORT_MEM 0         // memory BIOs only (default)
+#define TLS_SIM_TRANSPORT_SOCKETPAIR 1  // AF_UNIX socketpair (native Linux)
+#define TLS_SIM_TRANSPORT_TCP 2         // loopback TCP (native Linux)
+
+/* Per-run simulator state (trace document, settings, capture buffers). The
+ * tls_simulation_* and execute_tls_* functions act on a built-in default
+ * context. */
+typedef struct tls_sim_ctx tls_sim_ctx;
+
+/* Run one handshake plus the optional command script; returns the JSON
+ * trace document, valid until the next run. */
+char *execute_tls_simulation(const char *client_conf_path,
+                             const char *server_conf_path,
+                             const char *script_path);
+
+/* Run `iterations` untraced handshakes; returns a JSON statistics document,
+ * valid until the next call. */
+const char *execute_tls_benchmark(const char *client_conf_path,
+                                  const char *server_conf_path, int iterations,
+                                  unsigned int flags);
+
+/* Benchmark every group × sigalg pair (':' or ',' separated lists) with
+ * generated server credentials; returns a JSON document with one row per
+ * pair, valid until the next call. */
+const char *execute_tls_benchmark_matrix(const char *groups,
+                                         const char *sigalgs, int iterations,
+                                         unsigned int flags);
+
+/* The same matrix as QUIC handshakes (OpenSSL 3.5+) over an in-process
+ * datagram pair; rows add datagram and packet counts, the Initial datagrams
+ * of the first flight, anti-amplification stalls and extra round trips.
+ * Fails as a whole when the OpenSSL build has no QUIC. */
+const char *execute_tls_quic_matrix(const char *groups, const char *sigalgs,
+                                    int iterations, unsigned int flags);
+
+/* Burst of `connections` simultaneous handshakes against one server context
+ * on a single run queue; returns a JSON document with the completion time
+ * distribution, server CPU time and peak heap, valid until the next call. */
+const char *execute_tls_load(const char *client_conf_path,
+                             const char *server_conf_path, int connections);
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+/* Native Linux only: stream `bytes` from server to client over loopback TCP,
+ * once with kernel TLS offload requested (SSL_sendfile() when the kernel
+ * took over transmit) and once through user space; returns a JSON document
+ * with both throughputs and which directions were offloaded, valid until the
+ * next call. */
+const char *execute_tls_ktls(const char *client_conf_path,
+                             const char *server_conf_path, size_t bytes);
+#endif
+
+/* Separate contexts let runs proceed concurrently, one per thread. A new
+ * context copies the default context's settings (event mask, log limit, wire
+ * capture, resumption, transport, flight parameters, credential directory,
+ * HSM mode) but streams nowhere and starts without in-memory inputs.
+ * tls_sim_ctx_run() is execute_tls_simulation() on that context; its document
+ * stays valid until the context's next run or tls_sim_ctx_free().
+ * Exception: OpenSSL's trace channels are process-wide, so runs with any
+ * TLS_SIM_EV_TRACE_* category enabled are serialised (one waits for the
+ * other), and each keeps only the trace lines of its own thread. */
+tls_sim_ctx *tls_sim_ctx_new(void);
+void tls_sim_ctx_free(tls_sim_ctx *sim);
+const char *tls_sim_ctx_run(tls_sim_ctx *sim, const char *client_conf_path,
+                            const char *server_conf_path,
+                            const char *script_path);
+size_t tls_sim_ctx_result_len(const tls_sim_ctx *sim);
+const char *tls_sim_ctx_benchmark(tls_sim_ctx *sim,
+                                  const char *client_conf_path,
+                                  const char *server_conf_path, int iterations,
+                                  unsigned int flags);
+/* Sorted latencies (ms) of the context's last successful benchmark; valid
+ * until its next benchmark. */
+const double *tls_sim_ctx_latencies(const tls_sim_ctx *sim, int *count);
+
+/* In-memory inputs: `len` bytes (copied) that stand in for the file at `path`
+ * wherever the simulator would read it — config files, the VerifyCAFile they
+ * name, credential files and the command script. Certificates and keys may be
+ * PEM or DER. NULL `data` removes the input; returns -1 if the path is too
+ * long or all 16 slots are taken. */
+int tls_sim_ctx_set_input(tls_sim_ctx *sim, const char *path, const void *data,
+                          size_t len);
+void tls_sim_ctx_clear_inputs(tls_sim_ctx *sim);
+int tls_simulation_set_input(const char *path, const void *data, size_t len);
+void tls_simulation_clear_inputs(void);
+
+const char *tls_simulation_result_ptr(void);
+size_t tls_simulation_result_len(void);
+const unsigned char *tls_simulation_capture_ptr(void);
+size_t tls_simulation_capture_len(void);
+
+void tls_simulation_set_event_mask(unsigned int mask);
+unsigned int tls_simulation_get_event_mask(void);
+void tls_simulation_set_log_limit(size_t max_bytes);
+void tls_simulation_set_event_sink(int fd, int retain, size_t batch_bytes);
+void tls_simulation_set_wire_capture(int mode, size_t head_bytes);
+int tls_simulation_set_cred_dir(const char *dir);
+void tls_simulation_set_ctx_cache(int enabled);
+void tls_simulation_set_resumption(int mode);
+/* How wire bytes travel between the two sides of simulations and benchmarks
+ * (load mode always uses memory); socket transports are non-blocking and
+ * still captured. Returns -1 for a transport this build lacks. */
+int tls_simulation_set_transport(int kind);
+/* Flight accounting (record events): TCP segment size and initial congestion
+ * window, in segments, that handshake flights are measured against; 0 keeps
+ * the default (1460 B, 10 segments). */
+void tls_simulation_set_flight_params(unsigned int mss, unsigned int initcwnd);
+void tls_simulation_ctx_cache_flush(void);
+
+#endif /* TLS_SIMULATION_H */
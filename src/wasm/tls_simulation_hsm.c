@@ -22,6 +22,8 @@
  * Build under Emscripten only.
  */
 
+#include "tls_simulation.h"
+
 #ifdef __EMSCRIPTEN__
 
 #include <openssl/bio.h>
@@ -67,6 +69,7 @@ typedef CK_FUNCTION_LIST **CK_FUNCTION_LIST_PTR_PTR;
 #define CK_TRUE  1
 #define CK_FALSE 0
 #define CKR_OK                            0x00000000UL
+#define CKR_USER_ALREADY_LOGGED_IN        0x00000100UL
 #define CKR_CRYPTOKI_ALREADY_INITIALIZED  0x00000191UL
 #define CKF_OS_LOCKING_OK                 0x00000002UL
 #define CKF_SERIAL_SESSION                0x00000004UL
@@ -168,30 +171,24 @@ extern int p11prov_OSSL_provider_init(const void *handle,
                                        const void **out,
                                        void **provctx);
 
-/* Logging hook — defined in tls_simulation.c, shared JSON event stream. */
-extern void log_event(const char *side, const char *event, const char *details);
+/* Logging hook — defined in tls_simulation.c; events go to the trace of the
+ * simulation context whose run is building the server SSL_CTX. */
+extern void log_event(tls_sim_ctx *sim, const char *side, const char *event,
+                      const char *details);
+/* First certificate at a path, taken from the context's in-memory inputs
+ * (tls_simulation_set_input) before the filesystem; PEM or DER. */
+extern X509 *sim_load_cert(tls_sim_ctx *sim, const char *path);
+/* Cached SSL_CTXs hold the HSM key; dropped on tls_simulation_hsm_reset(). */
+extern void tls_simulation_ctx_cache_flush(void);
 
 /* ── Module state ───────────────────────────────────────────────────────── */
 
-static int g_hsm_mode_enabled = 0;
+/* HSM mode itself is a per-context setting (tls_sim_ctx.hsm_mode, set via
+ * tls_simulation_set_hsm_mode()). The provider and token below are shared by
+ * every context: both live in the process-wide OpenSSL / PKCS#11 state. */
 static int g_hsm_initialized  = 0;
 static OSSL_PROVIDER *g_pkcs11_provider = NULL;
 
-EMSCRIPTEN_KEEPALIVE
-void tls_simulation_set_hsm_mode(int enabled) {
-    g_hsm_mode_enabled = enabled ? 1 : 0;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int tls_simulation_get_hsm_mode(void) {
-    return g_hsm_mode_enabled;
-}
-
-/* Externally callable from tls_simulation.c. */
-int hsm_mode_enabled(void) {
-    return g_hsm_mode_enabled;
-}
-
 /* ── softhsmv3 conf bootstrap (idempotent) ─────────────────────────────── */
 
 static int hsm_write_conf(void) {
@@ -216,7 +213,7 @@ static int hsm_write_conf(void) {
  * end-to-end before TLS even begins.
  *
  * Returns a malloc'd PEM string. Caller frees. NULL on error. */
-static char *hsm_mint_self_signed_cert(const unsigned char *pubkey_der,
+static char *hsm_mint_self_signed_cert(tls_sim_ctx *sim, const unsigned char *pubkey_der,
                                        size_t pubkey_der_len,
                                        EVP_PKEY *signer_pkey) {
     X509 *cert = NULL;
@@ -237,7 +234,7 @@ static char *hsm_mint_self_signed_cert(const unsigned char *pubkey_der,
             char errbuf[128];
             snprintf(errbuf, sizeof(errbuf),
                      "EVP_PKEY_fromdata(ML-DSA-65,pub) failed: 0x%lx", ERR_get_error());
-            log_event("server", "hsm_error", errbuf);
+            log_event(sim, "server", "hsm_error", errbuf);
             EVP_PKEY_CTX_free(pctx);
             goto out;
         }
@@ -267,20 +264,20 @@ static char *hsm_mint_self_signed_cert(const unsigned char *pubkey_der,
      * EVP_DigestSignInit_ex (NULL mdname = pure sign, no separate hash). */
     {
         EVP_MD_CTX *sign_ctx = EVP_MD_CTX_new();
-        if (!sign_ctx) { log_event("server", "hsm_error", "EVP_MD_CTX_new failed"); goto out; }
+        if (!sign_ctx) { log_event(sim, "server", "hsm_error", "EVP_MD_CTX_new failed"); goto out; }
 
         /* NULL mdname → pure/direct sign (correct for ML-DSA which hashes internally) */
         int dsi_ret = EVP_DigestSignInit_ex(sign_ctx, NULL, NULL, NULL, NULL, signer_pkey, NULL);
         {
             char chk[64]; snprintf(chk, sizeof(chk), "EVP_DigestSignInit_ex ret=%d", dsi_ret);
-            log_event("server", "hsm_debug", chk);
+            log_event(sim, "server", "hsm_debug", chk);
         }
         if (dsi_ret != 1) {
             unsigned long e;
             char errbuf[256];
             while ((e = ERR_get_error()) != 0) {
                 ERR_error_string_n(e, errbuf, sizeof(errbuf));
-                log_event("server", "hsm_error", errbuf);
+                log_event(sim, "server", "hsm_error", errbuf);
             }
             EVP_MD_CTX_free(sign_ctx);
             goto out;
@@ -294,7 +291,7 @@ static char *hsm_mint_self_signed_cert(const unsigned char *pubkey_der,
             char errbuf[256];
             while ((e = ERR_get_error()) != 0) {
                 ERR_error_string_n(e, errbuf, sizeof(errbuf));
-                log_event("server", "hsm_error", errbuf);
+                log_event(sim, "server", "hsm_error", errbuf);
             }
             EVP_MD_CTX_free(sign_ctx);
             goto out;
@@ -315,7 +312,7 @@ static char *hsm_mint_self_signed_cert(const unsigned char *pubkey_der,
     memcpy(pem, bptr->data, bptr->length);
     pem[bptr->length] = 0;
 
-    log_event("server", "hsm_cert_minted",
+    log_event(sim, "server", "hsm_cert_minted",
               "Self-signed cert built from softhsmv3 ML-DSA-65 SPKI; signed via pkcs11-provider");
 
 out:
@@ -346,14 +343,14 @@ static const char *PKCS11_OPENSSL_CONF =
     "pkcs11-module-token-pin = 1234\n"
     "activate = 1\n";
 
-static int hsm_load_provider(void) {
+static int hsm_load_provider(tls_sim_ctx *sim) {
     if (g_pkcs11_provider) return 0;
 
     /* Register the static entry point under the name "pkcs11" so
      * OSSL_PROVIDER_load can find it without a real dlopen. */
     if (OSSL_PROVIDER_add_builtin(NULL, "pkcs11",
             (OSSL_provider_init_fn *)p11prov_OSSL_provider_init) != 1) {
-        log_event("server", "hsm_error", "OSSL_PROVIDER_add_builtin(pkcs11) failed");
+        log_event(sim, "server", "hsm_error", "OSSL_PROVIDER_add_builtin(pkcs11) failed");
         return -1;
     }
 
@@ -361,7 +358,7 @@ static int hsm_load_provider(void) {
      * picks up its module-path / pin. */
     FILE *f = fopen("/ssl/pkcs11.cnf", "w");
     if (!f) {
-        log_event("server", "hsm_error", "could not open /ssl/pkcs11.cnf for write");
+        log_event(sim, "server", "hsm_error", "could not open /ssl/pkcs11.cnf for write");
         return -1;
     }
     fputs(PKCS11_OPENSSL_CONF, f);
@@ -369,7 +366,7 @@ static int hsm_load_provider(void) {
     if (OSSL_LIB_CTX_load_config(NULL, "/ssl/pkcs11.cnf") != 1) {
         char err[128];
         snprintf(err, sizeof(err), "OSSL_LIB_CTX_load_config failed: 0x%lx", ERR_get_error());
-        log_event("server", "hsm_error", err);
+        log_event(sim, "server", "hsm_error", err);
         return -1;
     }
 
@@ -377,10 +374,10 @@ static int hsm_load_provider(void) {
     if (!g_pkcs11_provider) {
         char err[128];
         snprintf(err, sizeof(err), "OSSL_PROVIDER_load(pkcs11) failed: 0x%lx", ERR_get_error());
-        log_event("server", "hsm_error", err);
+        log_event(sim, "server", "hsm_error", err);
         return -1;
     }
-    log_event("server", "hsm_provider_loaded", "pkcs11-provider 0.4.0 (static, softhsmv3 backend)");
+    log_event(sim, "server", "hsm_provider_loaded", "pkcs11-provider 0.4.0 (static, softhsmv3 backend)");
     return 0;
 }
 
@@ -388,17 +385,12 @@ static int hsm_load_provider(void) {
 
 #define HSM_PIN "1234"
 
-/* Read the server cert at /ssl/server.crt (the user-selected cert) and return
- * the ML-DSA paramset CKP_ML_DSA_*_VAL that matches, defaulting to 65 for any
- * non-ML-DSA cert (RSA, ECDSA) so HSM mode can still proceed. */
-static CK_ULONG detect_mldsa_paramset(char *label_out, size_t label_len) {
-    BIO *bio = BIO_new_file("/ssl/server.crt", "r");
-    if (!bio) {
-        strncpy(label_out, "tls-server-mldsa65", label_len);
-        return CKP_ML_DSA_65_VAL;
-    }
-    X509 *cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
-    BIO_free(bio);
+/* Read the server cert at /ssl/server.crt (the user-selected cert, file or
+ * in-memory input) and return the ML-DSA paramset CKP_ML_DSA_*_VAL that
+ * matches, defaulting to 65 for any non-ML-DSA cert (RSA, ECDSA) so HSM mode
+ * can still proceed. */
+static CK_ULONG detect_mldsa_paramset(tls_sim_ctx *sim, char *label_out, size_t label_len) {
+    X509 *cert = sim_load_cert(sim, "/ssl/server.crt");
     if (!cert) {
         strncpy(label_out, "tls-server-mldsa65", label_len);
         return CKP_ML_DSA_65_VAL;
@@ -424,13 +416,13 @@ static CK_ULONG detect_mldsa_paramset(char *label_out, size_t label_len) {
     return ps;
 }
 
-static EVP_PKEY *hsm_load_pkcs11_key(const char *uri) {
+static EVP_PKEY *hsm_load_pkcs11_key(tls_sim_ctx *sim, const char *uri) {
     OSSL_STORE_CTX *store = OSSL_STORE_open(uri, NULL, NULL, NULL, NULL);
     if (!store) {
         char err[256];
         snprintf(err, sizeof(err), "OSSL_STORE_open(%s) failed: 0x%lx",
                  uri, ERR_get_error());
-        log_event("server", "hsm_error", err);
+        log_event(sim, "server", "hsm_error", err);
         return NULL;
     }
     EVP_PKEY *pkey = NULL;
@@ -450,34 +442,100 @@ static EVP_PKEY *hsm_load_pkcs11_key(const char *uri) {
         char err[256];
         snprintf(err, sizeof(err), "OSSL_STORE_load(%s) found no key; last err=0x%lx",
                  uri, ERR_get_error());
-        log_event("server", "hsm_error", err);
+        log_event(sim, "server", "hsm_error", err);
     } else {
         char msg[256];
         snprintf(msg, sizeof(msg), "OSSL_STORE_load(%s) → key type=%d", uri, EVP_PKEY_base_id(pkey));
-        log_event("server", "pkcs11_call", msg);
+        log_event(sim, "server", "pkcs11_call", msg);
     }
     return pkey;
 }
 
-/* Public entry: invoked by tls_simulation.c right before SSL_CTX gets its
- * server cert/key. Replaces the file-backed PEM load with HSM-backed key. */
-int hsm_setup_server_credentials(SSL_CTX *s_ctx) {
-    if (!g_hsm_mode_enabled) return 0; /* no-op */
+/* ── Credential cache ───────────────────────────────────────────────────────
+ * Keygen, the OSSL_STORE lookup and the cert mint are done once per ML-DSA
+ * paramset. Later runs (and the SSL_CTX cache's rebuilds) attach the cached
+ * provider-backed EVP_PKEY and cert to the new SSL_CTX. The keypair stays on
+ * the token until tls_simulation_hsm_reset(). */
+
+typedef struct {
+    CK_ULONG          paramset;     /* 0 = empty slot */
+    char              label[32];
+    CK_OBJECT_HANDLE  hpub, hpriv;
+    EVP_PKEY         *pkey;         /* pkcs11: URI key, signs via the provider */
+    X509             *cert;
+    char             *cert_pem;
+} hsm_cred;
+
+static hsm_cred g_hsm_creds[3];     /* one per ML-DSA paramset */
+static CK_FUNCTION_LIST *g_p11 = NULL;
+static CK_SLOT_ID g_hsm_slot = 0;
+static int g_hsm_token_ready = 0;
+
+static hsm_cred *hsm_cred_find(CK_ULONG paramset) {
+    for (size_t i = 0; i < sizeof(g_hsm_creds) / sizeof(g_hsm_creds[0]); i++)
+        if (g_hsm_creds[i].paramset == paramset) return &g_hsm_creds[i];
+    return NULL;
+}
+
+/* Open a session logged in as the user. Once pkcs11-provider holds a session
+ * the token is already logged in; that login is shared, so *own_login says
+ * whether a C_Logout is ours to make. */
+static int hsm_open_user_session(CK_SESSION_HANDLE *sess, int *own_login) {
+    if (g_p11->C_OpenSession(g_hsm_slot, CKF_SERIAL_SESSION | CKF_RW_SESSION,
+                             NULL, NULL, sess) != CKR_OK)
+        return -1;
+    CK_RV rv = g_p11->C_Login(*sess, CKU_USER, (CK_UTF8CHAR_PTR)HSM_PIN, strlen(HSM_PIN));
+    if (rv != CKR_OK && rv != CKR_USER_ALREADY_LOGGED_IN) {
+        g_p11->C_CloseSession(*sess);
+        return -1;
+    }
+    *own_login = (rv == CKR_OK);
+    return 0;
+}
+
+static void hsm_close_user_session(CK_SESSION_HANDLE sess, int own_login) {
+    if (own_login) g_p11->C_Logout(sess);
+    g_p11->C_CloseSession(sess);
+}
 
-    log_event("server", "hsm_mode", "Live HSM enabled — softhsmv3 will hold the server private key");
+/* Destroy every token object carrying `label` (keypairs left behind by an
+ * earlier instance or an interrupted reset), so the pkcs11: URI lookup can
+ * only resolve to the key generated next. */
+static void hsm_destroy_label(tls_sim_ctx *sim, CK_SESSION_HANDLE sess, const char *label) {
+    CK_ATTRIBUTE tmpl[] = {
+        { CKA_LABEL, (void *)label, (CK_ULONG)strlen(label) },
+    };
+    CK_OBJECT_HANDLE found[8];
+    CK_ULONG count = 0;
+    if (g_p11->C_FindObjectsInit(sess, tmpl, 1) != CKR_OK) return;
+    g_p11->C_FindObjects(sess, found, 8, &count);
+    g_p11->C_FindObjectsFinal(sess);
+    for (CK_ULONG i = 0; i < count; i++)
+        g_p11->C_DestroyObject(sess, found[i]);
+    if (count > 0) {
+        char m[96];
+        snprintf(m, sizeof(m), "C_DestroyObject × %lu (stale %s objects)",
+                 (unsigned long)count, label);
+        log_event(sim, "server", "pkcs11_call", m);
+    }
+}
+
+/* softhsmv3 bring-up: C_Initialize, slot lookup, token + PIN init. Runs once
+ * per WASM instance — re-running C_InitToken would wipe the cached keys. */
+static int hsm_init_token(tls_sim_ctx *sim) {
+    if (g_hsm_token_ready) return 0;
 
     if (!g_hsm_initialized) {
         if (hsm_write_conf() != 0) {
-            log_event("server", "hsm_error", "could not write softhsm conf");
+            log_event(sim, "server", "hsm_error", "could not write softhsm conf");
             return -1;
         }
         g_hsm_initialized = 1;
     }
 
-    /* Step 1: PKCS#11 session + ML-DSA-65 keypair generation. */
     CK_FUNCTION_LIST *p11 = NULL;
     if (C_GetFunctionList(&p11) != CKR_OK || !p11) {
-        log_event("server", "hsm_error", "C_GetFunctionList unavailable");
+        log_event(sim, "server", "hsm_error", "C_GetFunctionList unavailable");
         return -1;
     }
     CK_C_INITIALIZE_ARGS iargs = { 0 };
@@ -485,25 +543,25 @@ int hsm_setup_server_credentials(SSL_CTX *s_ctx) {
     CK_RV rv = p11->C_Initialize(&iargs);
     if (rv != CKR_OK && rv != CKR_CRYPTOKI_ALREADY_INITIALIZED) {
         char m[64]; snprintf(m, sizeof(m), "C_Initialize rv=0x%lx", (unsigned long)rv);
-        log_event("server", "hsm_error", m);
+        log_event(sim, "server", "hsm_error", m);
         return -1;
     }
-    log_event("server", "pkcs11_call", "C_Initialize");
+    log_event(sim, "server", "pkcs11_call", "C_Initialize");
 
     CK_SLOT_ID slot_id = 0;
     CK_ULONG   slot_count = 1;
     rv = p11->C_GetSlotList(CK_FALSE, &slot_id, &slot_count);
     if (rv != CKR_OK || slot_count == 0) {
-        log_event("server", "hsm_error", "C_GetSlotList: no slot");
+        log_event(sim, "server", "hsm_error", "C_GetSlotList: no slot");
         return -1;
     }
-    log_event("server", "pkcs11_call", "C_GetSlotList");
+    log_event(sim, "server", "pkcs11_call", "C_GetSlotList");
 
     /* Init token + PINs. Idempotent (CKR_OK on first run, errors swallowed thereafter). */
     CK_BYTE label[32]; memset(label, ' ', sizeof(label));
     memcpy(label, "tls-sim-token", 13);
     p11->C_InitToken(slot_id, (CK_UTF8CHAR_PTR)HSM_PIN, strlen(HSM_PIN), (CK_UTF8CHAR_PTR)label);
-    log_event("server", "pkcs11_call", "C_InitToken");
+    log_event(sim, "server", "pkcs11_call", "C_InitToken");
 
     CK_SESSION_HANDLE so_sess;
     if (p11->C_OpenSession(slot_id, CKF_SERIAL_SESSION | CKF_RW_SESSION,
@@ -514,27 +572,28 @@ int hsm_setup_server_credentials(SSL_CTX *s_ctx) {
         p11->C_CloseSession(so_sess);
     }
 
+    g_p11 = p11;
+    g_hsm_slot = slot_id;
+    g_hsm_token_ready = 1;
+    return 0;
+}
+
+/* Generate the keypair for `paramset` on the token, resolve it through
+ * pkcs11-provider and mint its self-signed cert into `cred`. */
+static int hsm_cred_create(tls_sim_ctx *sim, hsm_cred *cred, CK_ULONG paramset, const char *key_label) {
+    if (hsm_init_token(sim) != 0) return -1;
+
+    /* Step 1: PKCS#11 session + ML-DSA keypair generation. */
     CK_SESSION_HANDLE sess;
-    if (p11->C_OpenSession(slot_id, CKF_SERIAL_SESSION | CKF_RW_SESSION,
-                           NULL, NULL, &sess) != CKR_OK) {
-        log_event("server", "hsm_error", "C_OpenSession failed");
+    int own_login = 0;
+    if (hsm_open_user_session(&sess, &own_login) != 0) {
+        log_event(sim, "server", "hsm_error", "C_OpenSession/C_Login(user) failed");
         return -1;
     }
-    log_event("server", "pkcs11_call", "C_OpenSession");
-    if (p11->C_Login(sess, CKU_USER, (CK_UTF8CHAR_PTR)HSM_PIN, strlen(HSM_PIN)) != CKR_OK) {
-        log_event("server", "hsm_error", "C_Login(user) failed");
-        return -1;
-    }
-    log_event("server", "pkcs11_call", "C_Login(CKU_USER)");
+    log_event(sim, "server", "pkcs11_call", "C_OpenSession");
+    log_event(sim, "server", "pkcs11_call", "C_Login(CKU_USER)");
+    hsm_destroy_label(sim, sess, key_label);
 
-    char            key_label_buf[32];
-    CK_ULONG        paramset  = detect_mldsa_paramset(key_label_buf, sizeof(key_label_buf));
-    {
-        char msg[128];
-        snprintf(msg, sizeof(msg), "Detected ML-DSA paramset=0x%02lx label=%s",
-                 (unsigned long)paramset, key_label_buf);
-        log_event("server", "hsm_paramset", msg);
-    }
     CK_MECHANISM keygen_mech = { CKM_ML_DSA_KEY_PAIR_GEN, NULL, 0 };
     CK_OBJECT_CLASS pubclass  = CKO_PUBLIC_KEY;
     CK_OBJECT_CLASS privclass = CKO_PRIVATE_KEY;
@@ -542,7 +601,6 @@ int hsm_setup_server_credentials(SSL_CTX *s_ctx) {
     CK_BBOOL        ck_true   = CK_TRUE;
     /* A token-resident keypair so OSSL_STORE can locate it via pkcs11: URI. */
     CK_BBOOL        ck_token  = CK_TRUE;
-    const char     *key_label = key_label_buf;
     const char     *key_id    = "01";
     CK_ATTRIBUTE pub_tmpl[] = {
         { CKA_CLASS,             &pubclass, sizeof(pubclass) },
@@ -564,13 +622,14 @@ int hsm_setup_server_credentials(SSL_CTX *s_ctx) {
     };
 
     CK_OBJECT_HANDLE hpub, hpriv;
-    rv = p11->C_GenerateKeyPair(sess, &keygen_mech,
-                                pub_tmpl,  sizeof(pub_tmpl)  / sizeof(pub_tmpl[0]),
-                                priv_tmpl, sizeof(priv_tmpl) / sizeof(priv_tmpl[0]),
-                                &hpub, &hpriv);
+    CK_RV rv = g_p11->C_GenerateKeyPair(sess, &keygen_mech,
+                                        pub_tmpl,  sizeof(pub_tmpl)  / sizeof(pub_tmpl[0]),
+                                        priv_tmpl, sizeof(priv_tmpl) / sizeof(priv_tmpl[0]),
+                                        &hpub, &hpriv);
     if (rv != CKR_OK) {
         char m[96]; snprintf(m, sizeof(m), "C_GenerateKeyPair rv=0x%lx", (unsigned long)rv);
-        log_event("server", "hsm_error", m);
+        log_event(sim, "server", "hsm_error", m);
+        hsm_close_user_session(sess, own_login);
         return -1;
     }
     {
@@ -579,29 +638,30 @@ int hsm_setup_server_credentials(SSL_CTX *s_ctx) {
                                "→ pub=0x%lx, priv=0x%lx (private never leaves softhsmv3)",
                  (unsigned long)paramset, key_label,
                  (unsigned long)hpub, (unsigned long)hpriv);
-        log_event("server", "pkcs11_call", m);
+        log_event(sim, "server", "pkcs11_call", m);
     }
 
     /* Step 2: Read public-key bytes (SPKI-encoded) from softhsmv3. */
     CK_ATTRIBUTE pub_value[] = { { CKA_VALUE, NULL, 0 } };
-    rv = p11->C_GetAttributeValue(sess, hpub, pub_value, 1);
+    unsigned char *pub_buf = NULL;
+    rv = g_p11->C_GetAttributeValue(sess, hpub, pub_value, 1);
     if (rv != CKR_OK || pub_value[0].ulValueLen == 0) {
-        log_event("server", "hsm_error", "C_GetAttributeValue(CKA_VALUE) sizing failed");
-        return -1;
+        log_event(sim, "server", "hsm_error", "C_GetAttributeValue(CKA_VALUE) sizing failed");
+        goto fail_destroy;
     }
-    unsigned char *pub_buf = (unsigned char *)malloc(pub_value[0].ulValueLen);
-    if (!pub_buf) return -1;
+    pub_buf = (unsigned char *)malloc(pub_value[0].ulValueLen);
+    if (!pub_buf) goto fail_destroy;
     pub_value[0].pValue = pub_buf;
-    rv = p11->C_GetAttributeValue(sess, hpub, pub_value, 1);
+    rv = g_p11->C_GetAttributeValue(sess, hpub, pub_value, 1);
     if (rv != CKR_OK) {
-        log_event("server", "hsm_error", "C_GetAttributeValue(CKA_VALUE) read failed");
-        free(pub_buf); return -1;
+        log_event(sim, "server", "hsm_error", "C_GetAttributeValue(CKA_VALUE) read failed");
+        goto fail_destroy;
     }
     {
         char m[96];
         snprintf(m, sizeof(m), "C_GetAttributeValue(CKA_VALUE) → %lu B SubjectPublicKeyInfo",
                  (unsigned long)pub_value[0].ulValueLen);
-        log_event("server", "pkcs11_call", m);
+        log_event(sim, "server", "pkcs11_call", m);
     }
 
     /* Close our manual session before pkcs11-provider opens its own.
@@ -609,12 +669,11 @@ int hsm_setup_server_credentials(SSL_CTX *s_ctx) {
      * attempted while our session is still active. pkcs11-provider does not
      * handle that case cleanly, so we must yield the slot here.
      * The keypair is token-resident (CKA_TOKEN=CK_TRUE) and persists. */
-    p11->C_Logout(sess);
-    p11->C_CloseSession(sess);
-    log_event("server", "pkcs11_call", "C_CloseSession (yielding slot to pkcs11-provider)");
+    hsm_close_user_session(sess, own_login);
+    log_event(sim, "server", "pkcs11_call", "C_CloseSession (yielding slot to pkcs11-provider)");
 
     /* Step 3: Load pkcs11-provider so we can build an EVP_PKEY URI handle. */
-    if (hsm_load_provider() != 0) {
+    if (hsm_load_provider(sim) != 0) {
         free(pub_buf); return -1;
     }
 
@@ -623,58 +682,126 @@ int hsm_setup_server_credentials(SSL_CTX *s_ctx) {
     snprintf(uri, sizeof(uri),
              "pkcs11:object=%s;type=private?pin-value=%s",
              key_label, HSM_PIN);
-    EVP_PKEY *priv_pkey = hsm_load_pkcs11_key(uri);
+    EVP_PKEY *priv_pkey = hsm_load_pkcs11_key(sim, uri);
     if (!priv_pkey) { free(pub_buf); return -1; }
 
     /* Step 5: Mint a self-signed cert. X509_sign routes via pkcs11-provider
      * → softhsmv3 → live C_SignInit + C_Sign. */
-    char *cert_pem = hsm_mint_self_signed_cert(pub_buf, pub_value[0].ulValueLen, priv_pkey);
+    char *cert_pem = hsm_mint_self_signed_cert(sim, pub_buf, pub_value[0].ulValueLen, priv_pkey);
     free(pub_buf);
     if (!cert_pem) { EVP_PKEY_free(priv_pkey); return -1; }
 
-    /* Step 6: Wire into SSL_CTX. CertificateVerify during the handshake will
-     * call EVP_DigestSign on priv_pkey, again routing via the provider. */
     BIO *cert_bio = BIO_new_mem_buf(cert_pem, -1);
     X509 *cert = PEM_read_bio_X509(cert_bio, NULL, NULL, NULL);
     BIO_free(cert_bio);
     if (!cert) {
-        log_event("server", "hsm_error", "Failed to parse minted cert PEM");
+        log_event(sim, "server", "hsm_error", "Failed to parse minted cert PEM");
         free(cert_pem); EVP_PKEY_free(priv_pkey);
         return -1;
     }
 
-    if (SSL_CTX_use_certificate(s_ctx, cert) != 1) {
-        log_event("server", "hsm_error", "SSL_CTX_use_certificate(hsm_cert) failed");
-        X509_free(cert); free(cert_pem); EVP_PKEY_free(priv_pkey);
+    cred->paramset = paramset;
+    strncpy(cred->label, key_label, sizeof(cred->label) - 1);
+    cred->label[sizeof(cred->label) - 1] = '\0';
+    cred->hpub = hpub;
+    cred->hpriv = hpriv;
+    cred->pkey = priv_pkey;
+    cred->cert = cert;
+    cred->cert_pem = cert_pem;
+    return 0;
+
+fail_destroy:
+    /* Don't leave a half-set-up keypair on the token. */
+    g_p11->C_DestroyObject(sess, hpriv);
+    g_p11->C_DestroyObject(sess, hpub);
+    hsm_close_user_session(sess, own_login);
+    free(pub_buf);
+    return -1;
+}
+
+/* Public entry: invoked by tls_simulation.c, for contexts in HSM mode, right
+ * before SSL_CTX gets its server cert/key. Replaces the file-backed PEM load with HSM-backed key. */
+int hsm_setup_server_credentials(tls_sim_ctx *sim, SSL_CTX *s_ctx) {
+    log_event(sim, "server", "hsm_mode", "Live HSM enabled — softhsmv3 will hold the server private key");
+
+    char            key_label_buf[32];
+    CK_ULONG        paramset  = detect_mldsa_paramset(sim, key_label_buf, sizeof(key_label_buf));
+    {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Detected ML-DSA paramset=0x%02lx label=%s",
+                 (unsigned long)paramset, key_label_buf);
+        log_event(sim, "server", "hsm_paramset", msg);
+    }
+
+    hsm_cred *cred = hsm_cred_find(paramset);
+    if (cred) {
+        char m[192];
+        snprintf(m, sizeof(m), "Reusing token keypair %s (pub=0x%lx, priv=0x%lx) and its "
+                               "minted cert from an earlier run — no keygen",
+                 cred->label, (unsigned long)cred->hpub, (unsigned long)cred->hpriv);
+        log_event(sim, "server", "hsm_cache", m);
+    } else {
+        cred = hsm_cred_find(0);
+        if (!cred || hsm_cred_create(sim, cred, paramset, key_label_buf) != 0)
+            return -1;
+    }
+
+    /* Step 6: Wire into SSL_CTX. CertificateVerify during the handshake will
+     * call EVP_DigestSign on the key, again routing via the provider. */
+    if (SSL_CTX_use_certificate(s_ctx, cred->cert) != 1) {
+        log_event(sim, "server", "hsm_error", "SSL_CTX_use_certificate(hsm_cert) failed");
         return -1;
     }
-    if (SSL_CTX_use_PrivateKey(s_ctx, priv_pkey) != 1) {
-        log_event("server", "hsm_error", "SSL_CTX_use_PrivateKey(pkcs11_uri) failed");
-        X509_free(cert); free(cert_pem); EVP_PKEY_free(priv_pkey);
+    if (SSL_CTX_use_PrivateKey(s_ctx, cred->pkey) != 1) {
+        log_event(sim, "server", "hsm_error", "SSL_CTX_use_PrivateKey(pkcs11_uri) failed");
         return -1;
     }
-    log_event("server", "hsm_attached",
+    log_event(sim, "server", "hsm_attached",
               "SSL_CTX configured: cert from softhsmv3 SPKI, private key via pkcs11: URI");
 
     /* Write the self-signed cert to a well-known path so the client context
      * can load it as a trusted CA.  Without this the client rejects the cert
-     * because it was not signed by the pre-existing RSA CA in client-ca.crt. */
+     * because it was not signed by the pre-existing RSA CA in client-ca.crt.
+     * Rewritten every run: the last run may have used another paramset. */
     FILE *ca_fp = fopen("/ssl/hsm-server.crt", "w");
     if (ca_fp) {
-        fputs(cert_pem, ca_fp);
+        fputs(cred->cert_pem, ca_fp);
         fclose(ca_fp);
-        log_event("server", "hsm_ca_written",
+        log_event(sim, "server", "hsm_ca_written",
                   "Self-signed cert written to /ssl/hsm-server.crt for client trust");
     }
-
-    /* OpenSSL retains the cert + key; we can free our refs. */
-    X509_free(cert);
-    EVP_PKEY_free(priv_pkey);
-    free(cert_pem);
     return 0;
 }
 
+/* Destroy the cached keypairs on the token and drop their EVP_PKEYs and
+ * certs; the next HSM run generates fresh ones. The token itself stays
+ * initialised. Cached SSL_CTXs reference these keys, so they go too. */
+EMSCRIPTEN_KEEPALIVE
+void tls_simulation_hsm_reset(void) {
+    tls_simulation_ctx_cache_flush();
+
+    CK_SESSION_HANDLE sess;
+    int own_login = 0;
+    int have_sess = g_hsm_token_ready && hsm_open_user_session(&sess, &own_login) == 0;
+    for (size_t i = 0; i < sizeof(g_hsm_creds) / sizeof(g_hsm_creds[0]); i++) {
+        hsm_cred *cred = &g_hsm_creds[i];
+        if (!cred->paramset) continue;
+        if (have_sess) {
+            g_p11->C_DestroyObject(sess, cred->hpriv);
+            g_p11->C_DestroyObject(sess, cred->hpub);
+        }
+        EVP_PKEY_free(cred->pkey);
+        X509_free(cred->cert);
+        free(cred->cert_pem);
+        memset(cred, 0, sizeof(*cred));
+    }
+    if (have_sess) hsm_close_user_session(sess, own_login);
+    unlink("/ssl/hsm-server.crt");
+}
+
 #else /* !__EMSCRIPTEN__ */
-int hsm_mode_enabled(void) { return 0; }
-int hsm_setup_server_credentials(void *ctx) { (void)ctx; return 0; }
+int hsm_setup_server_credentials(tls_sim_ctx *sim, void *ctx) {
+    (void)sim; (void)ctx;
+    return 0;
+}
 #endif /* __EMSCRIPTEN__ */